@@ -0,0 +1,419 @@
+/**
+ *  (c) 2002-2024 - Remi Peyronnet  (see README.md for contributors and changelog)
+ *
+ *  fourier-bench : timings of the Fourier Transform core
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ *  process_fft_forward and process_fft_inverse are run on synthetic images
+ *  of several sizes and shapes, and their timings are written as JSON, one
+ *  result per size, bpp and direction, so that runs can be compared.
+ *
+ *  make bench  or  fourier-bench [--max-size N] [--repeat N] [--json FILE]
+ *
+ *  The forward->inverse round trips of a single precision build can also be
+ *  checked against those of a double precision build, which must be within
+ *  one code value: fourier-bench --fidelity-save FILE in the double build,
+ *  then fourier-bench --fidelity FILE in the single one (make fidelity).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "fourier-core.h"
+
+/** Cases ********************************************************************/
+
+typedef struct
+{
+  const gchar *shape;
+  gint width, height;
+} FourierBenchCase;
+
+static const FourierBenchCase fourier_bench_cases[] =
+{
+  { "pow2", 256, 256 },
+  { "pow2", 1024, 1024 },
+  { "pow2", 2048, 2048 },
+  { "pow2", 4096, 4096 },
+  { "pow2", 8192, 8192 },
+  { "pow2", 16384, 16384 },
+  { "odd", 1001, 999 },
+  { "odd", 3003, 3003 },
+  { "odd", 15015, 15015 },
+  { "prime", 257, 257 },
+  { "prime", 1021, 1021 },
+  { "prime", 4093, 4093 },
+  { "prime", 16381, 16381 },
+  { "wide", 8192, 64 },
+  { "wide", 65536, 256 },
+  { "wide", 262144, 512 },
+};
+
+static const gint fourier_bench_bpps[] = { 3, 4 };
+
+/** Phases *******************************************************************/
+
+/*
+ * process_fft_*() report their progress at the end of each phase: planning,
+ * deinterleave (spectrum decoding for the inverse), execute and quantize, at
+ * 0, 1/3, 2/3 and 1. Mapped scratches also report progress within execute.
+ */
+enum
+{
+  PHASE_PLAN,
+  PHASE_DEINTERLEAVE,
+  PHASE_EXECUTE,
+  PHASE_QUANTIZE,
+  PHASES
+};
+
+static const gchar *fourier_bench_phases[PHASES] =
+{
+  "plan", "deinterleave", "execute", "quantize"
+};
+
+static gint64 fourier_bench_marks[PHASES + 1];
+static gint fourier_bench_mark;
+
+static void fourier_bench_progress(gdouble fraction)
+{
+  if (fourier_bench_mark < PHASES && fraction >= fourier_bench_mark / 3.0 - 1e-9)
+    fourier_bench_marks[++fourier_bench_mark] = g_get_monotonic_time();
+}
+
+typedef struct
+{
+  double phases[PHASES];   /* seconds, best of the runs */
+  double total;            /* seconds, best of the runs */
+} FourierBenchTimes;
+
+static void fourier_bench_run(guchar *src, guchar *dst, gint width, gint height, gint bpp,
+                              gboolean inverse, gint repeat, FourierBenchTimes *times)
+{
+  gint64 end;
+  double seconds;
+  gint run, phase;
+
+  for (phase = 0; phase < PHASES; phase++)
+    times->phases[phase] = G_MAXDOUBLE;
+  times->total = G_MAXDOUBLE;
+
+  for (run = 0; run < repeat; run++)
+  {
+    fourier_bench_mark = 0;
+    fourier_bench_marks[0] = g_get_monotonic_time();
+    if (!inverse)
+      process_fft_forward(src, dst, width, height, bpp, bpp);
+    else
+      process_fft_inverse(src, dst, width, height, bpp, bpp);
+    end = g_get_monotonic_time();
+
+    for (phase = 0; phase < PHASES; phase++)
+    {
+      seconds = (fourier_bench_marks[phase + 1] - fourier_bench_marks[phase]) / 1e6;
+      times->phases[phase] = MIN(times->phases[phase], seconds);
+    }
+    times->total = MIN(times->total, (end - fourier_bench_marks[0]) / 1e6);
+  }
+}
+
+/* Smooth shapes and noise, so that the spectrum is not almost empty */
+static void fourier_bench_fill(guchar *pixels, gint width, gint height, gint bpp)
+{
+  GRand *rand = g_rand_new_with_seed(width * 31 + height);
+  gint row, col, cur_bpp;
+  double value;
+
+  for (row = 0; row < height; row++)
+    for (col = 0; col < width; col++)
+      for (cur_bpp = 0; cur_bpp < bpp; cur_bpp++)
+      {
+        value = 128.0 + 64.0 * sin(col * (0.01 + 0.003 * cur_bpp)) * cos(row * 0.02)
+                + g_rand_int_range(rand, -32, 32);
+        *pixels++ = (guchar)CLAMP(value, 0.0, 255.0);
+      }
+  g_rand_free(rand);
+}
+
+/** Fidelity *****************************************************************/
+
+/*
+ * The reference holds the round trip of each case, a "shape width height bpp"
+ * line followed by the pixels, in the order of fourier_bench_cases.
+ */
+static gint fourier_bench_fidelity(const gchar *filename, gboolean save, gint max_size,
+                                   const gchar *shape, FILE *out)
+{
+  const FourierBenchCase *bench;
+  guchar *pixels, *spectrum, *result, *reference;
+  gchar header[64], line[64];
+  gsize size, k;
+  gint max_diff, max_error, diff, failed = 0;
+  gint64 differing;
+  gboolean first = TRUE, missing = FALSE;
+  FILE *file;
+  guint i, j;
+
+  if (!(file = fopen(filename, save ? "wb" : "rb")))
+  {
+    g_printerr("%s: %s\n", filename, g_strerror(errno));
+    return 1;
+  }
+
+  fprintf(out, "{\n  \"precision\": \"%s\",\n  \"%s\": \"%s\",\n  \"results\": [",
+          sizeof(fourier_real) == sizeof(float) ? "single" : "double",
+          save ? "saved" : "reference", filename);
+
+  for (i = 0; i < G_N_ELEMENTS(fourier_bench_cases); i++)
+  {
+    bench = &fourier_bench_cases[i];
+    if ((gint64)bench->width * bench->height > (gint64)max_size * max_size)
+      continue;
+    if (shape && strcmp(shape, bench->shape))
+      continue;
+
+    for (j = 0; j < G_N_ELEMENTS(fourier_bench_bpps); j++)
+    {
+      size = (gsize)bench->width * bench->height * fourier_bench_bpps[j];
+      g_snprintf(header, sizeof(header), "%s %d %d %d\n",
+                 bench->shape, bench->width, bench->height, fourier_bench_bpps[j]);
+      pixels = g_malloc(size);
+      spectrum = g_malloc(size);
+      result = g_malloc(size);
+      fourier_bench_fill(pixels, bench->width, bench->height, fourier_bench_bpps[j]);
+      process_fft_forward(pixels, spectrum, bench->width, bench->height,
+                          fourier_bench_bpps[j], fourier_bench_bpps[j]);
+      process_fft_inverse(spectrum, result, bench->width, bench->height,
+                          fourier_bench_bpps[j], fourier_bench_bpps[j]);
+
+      // Distance to the original pixels, the spectrum is quantized to 8 bits
+      max_error = 0;
+      for (k = 0; k < size; k++)
+        max_error = MAX(max_error, ABS(result[k] - pixels[k]));
+
+      max_diff = 0;
+      differing = 0;
+      if (save)
+      {
+        fputs(header, file);
+        fwrite(result, 1, size, file);
+      }
+      else
+      {
+        reference = pixels;
+        if (!fgets(line, sizeof(line), file) || strcmp(line, header)
+            || fread(reference, 1, size, file) != size)
+        {
+          g_printerr("%s: no reference for %s", filename, header);
+          missing = TRUE;
+        }
+        else
+        {
+          for (k = 0; k < size; k++)
+          {
+            diff = ABS(result[k] - reference[k]);
+            max_diff = MAX(max_diff, diff);
+            differing += (diff != 0);
+          }
+        }
+        if (missing || max_diff > 1)
+          failed++;
+      }
+
+      fprintf(out, "%s\n    { \"shape\": \"%s\", \"width\": %d, \"height\": %d, \"bpp\": %d, "
+              "\"round_trip_max_error\": %d",
+              first ? "" : ",", bench->shape, bench->width, bench->height,
+              fourier_bench_bpps[j], max_error);
+      if (!save)
+        fprintf(out, ", \"max_diff\": %d, \"differing\": %" G_GINT64_FORMAT,
+                missing ? -1 : max_diff, differing);
+      fprintf(out, " }");
+      fflush(out);
+      first = FALSE;
+
+      g_free(pixels);
+      g_free(spectrum);
+      g_free(result);
+      if (missing)
+        break;
+    }
+    if (missing)
+      break;
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+  fclose(file);
+  if (failed)
+    g_printerr("%d round trips differ from %s by more than one code value\n", failed, filename);
+
+  return failed ? 1 : 0;
+}
+
+/** Main *********************************************************************/
+
+int main(int argc, char **argv)
+{
+  gint max_size = 4096, repeat = 3, threads = 0, rigor = RIGOR_ESTIMATE, memory_limit = 0;
+  gchar *shape = NULL, *json = NULL, *backend = NULL, *fidelity = NULL, *fidelity_save = NULL;
+  GOptionEntry entries[] =
+  {
+    { "max-size", 's', 0, G_OPTION_ARG_INT, &max_size,
+      "Skip images of more than N * N pixels, 16384 runs all sizes (default: 4096)", "N" },
+    { "shape", 0, 0, G_OPTION_ARG_STRING, &shape,
+      "Only run sizes of this shape: pow2, odd, prime or wide", "SHAPE" },
+    { "repeat", 'n', 0, G_OPTION_ARG_INT, &repeat,
+      "Runs of each transform, the best time is kept (default: 3)", "N" },
+    { "threads", 't', 0, G_OPTION_ARG_INT, &threads,
+      "Number of threads used by the FFT (default: 0 = one per processor)", "N" },
+    { "rigor", 'r', 0, G_OPTION_ARG_INT, &rigor,
+      "FFT planning rigor { Estimate (0), Measure (1), Patient (2), Exhaustive (3) }", "N" },
+    { "memory-limit", 'm', 0, G_OPTION_ARG_INT, &memory_limit,
+      "Memory used by the FFT in MB, larger images are processed in a temporary file (default: 0 = unlimited)", "MB" },
+    { "backend", 'b', 0, G_OPTION_ARG_STRING, &backend,
+      "FFT engine: fftw, builtin or auto (default: FOURIER_BACKEND, else fftw)", "NAME" },
+    { "json", 'o', 0, G_OPTION_ARG_FILENAME, &json,
+      "Write the results to FILE (default: standard output)", "FILE" },
+    { "fidelity-save", 0, 0, G_OPTION_ARG_FILENAME, &fidelity_save,
+      "Write the forward->inverse round trips to FILE instead of timing them", "FILE" },
+    { "fidelity", 0, 0, G_OPTION_ARG_FILENAME, &fidelity,
+      "Fail if the round trips differ from those of FILE by more than one code value", "FILE" },
+    { NULL }
+  };
+  GOptionContext *context;
+  GError *error = NULL;
+  FourierBenchTimes times;
+  const FourierBenchCase *bench;
+  guchar *pixels, *spectrum, *result;
+  gsize size;
+  gboolean first = TRUE;
+  FILE *out = stdout;
+  guint i, j;
+  gint inverse, phase, status;
+
+  context = g_option_context_new("- timings of the Fourier transform core");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+  {
+    g_printerr("%s\n", error->message);
+    return 2;
+  }
+  g_option_context_free(context);
+
+  fvals.threads = MAX(threads, 0);
+  fvals.rigor = CLAMP(rigor, RIGOR_ESTIMATE, RIGOR_EXHAUSTIVE);
+  fvals.memory_limit = MAX(memory_limit, 0);
+  fourier_backend_init();
+  if (backend && fourier_backend_from_name(backend) < 0)
+  {
+    g_printerr("Unknown backend '%s'\n", backend);
+    return 2;
+  }
+  if (backend)
+    fvals.backend = fourier_backend_from_name(backend);
+  repeat = MAX(repeat, 1);
+  fourier_set_progress_func(fourier_bench_progress);
+
+  if (json && !(out = fopen(json, "w")))
+  {
+    g_printerr("%s: %s\n", json, g_strerror(errno));
+    return 1;
+  }
+
+  if (fidelity || fidelity_save)
+  {
+    status = fourier_bench_fidelity(fidelity ? fidelity : fidelity_save, !fidelity,
+                                    max_size, shape, out);
+    if (out != stdout)
+      fclose(out);
+    g_free(shape);
+    g_free(json);
+    g_free(backend);
+    g_free(fidelity);
+    g_free(fidelity_save);
+    return status;
+  }
+
+  fprintf(out, "{\n  \"precision\": \"%s\",\n", sizeof(fourier_real) == sizeof(float) ? "single" : "double");
+  fprintf(out, "  \"backend\": \"%s\",\n", (fvals.backend == BACKEND_AUTO) ? "auto" :
+                                             (fvals.backend == BACKEND_BUILTIN) ? "builtin" : "fftw");
+  fprintf(out, "  \"threads\": %d,\n  \"rigor\": %d,\n  \"memory_limit\": %d,\n  \"repeat\": %d,\n",
+          fvals.threads ? fvals.threads : (gint)g_get_num_processors(), fvals.rigor, fvals.memory_limit, repeat);
+  fprintf(out, "  \"results\": [");
+
+  for (i = 0; i < G_N_ELEMENTS(fourier_bench_cases); i++)
+  {
+    bench = &fourier_bench_cases[i];
+    if ((gint64)bench->width * bench->height > (gint64)max_size * max_size)
+      continue;
+    if (shape && strcmp(shape, bench->shape))
+      continue;
+
+    for (j = 0; j < G_N_ELEMENTS(fourier_bench_bpps); j++)
+    {
+      size = (gsize)bench->width * bench->height * fourier_bench_bpps[j];
+      pixels = g_try_malloc(size);
+      spectrum = g_try_malloc(size);
+      result = g_try_malloc(size);
+      if (!pixels || !spectrum || !result)
+      {
+        g_printerr("%dx%dx%d: not enough memory, skipped\n",
+                   bench->width, bench->height, fourier_bench_bpps[j]);
+        g_free(pixels);
+        g_free(spectrum);
+        g_free(result);
+        continue;
+      }
+      fourier_bench_fill(pixels, bench->width, bench->height, fourier_bench_bpps[j]);
+
+      // The inverse transforms the spectrum of the forward
+      for (inverse = 0; inverse < 2; inverse++)
+      {
+        fourier_bench_run(inverse ? spectrum : pixels, inverse ? result : spectrum,
+                          bench->width, bench->height, fourier_bench_bpps[j],
+                          inverse, repeat, &times);
+
+        fprintf(out, "%s\n    { \"shape\": \"%s\", \"width\": %d, \"height\": %d, \"bpp\": %d, "
+                "\"direction\": \"%s\",\n      ",
+                first ? "" : ",", bench->shape, bench->width, bench->height,
+                fourier_bench_bpps[j], inverse ? "inverse" : "forward");
+        for (phase = 0; phase < PHASES; phase++)
+          fprintf(out, "\"%s_s\": %.6f, ", fourier_bench_phases[phase], times.phases[phase]);
+        fprintf(out, "\"total_s\": %.6f,\n      \"mpixels_per_s\": %.3f }",
+                times.total, (double)bench->width * bench->height / 1e6 / MAX(times.total, 1e-9));
+        fflush(out);
+        first = FALSE;
+      }
+
+      g_free(pixels);
+      g_free(spectrum);
+      g_free(result);
+    }
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout)
+    fclose(out);
+  g_free(shape);
+  g_free(json);
+  g_free(backend);
+
+  return 0;
+}
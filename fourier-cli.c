@@ -0,0 +1,513 @@
+/**
+ *  (c) 2002-2024 - Remi Peyronnet  (see README.md for contributors and changelog)
+ *
+ *  fourier-cli : Fourier Transform of image files, without GIMP
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ *  Images are transformed by the same core as the plugin, so that spectra
+ *  written by one can be transformed back by the other.
+ *
+ *  fourier-cli [--inverse] [--jobs N] --output DIR FILE|DIR...
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "fourier-core.h"
+
+/** Images *******************************************************************/
+
+typedef struct
+{
+  gint width, height;
+  gint bpp;           /* 1 (gray), 3 (RGB) or 4 (RGBA) */
+  guchar *pixels;     /* rows of width * bpp bytes */
+} FourierImage;
+
+static FourierImage *fourier_image_new(gint width, gint height, gint bpp)
+{
+  FourierImage *image = g_new(FourierImage, 1);
+
+  image->width = width;
+  image->height = height;
+  image->bpp = bpp;
+  image->pixels = g_new(guchar, (gsize)width * height * bpp);
+  return image;
+}
+
+static void fourier_image_free(FourierImage *image)
+{
+  g_free(image->pixels);
+  g_free(image);
+}
+
+/* Format of a file from its extension: "png", "tiff", "pnm" or NULL */
+static const gchar *fourier_image_format(const gchar *filename)
+{
+  const gchar *ext = strrchr(filename, '.');
+
+  if (!ext)
+    return NULL;
+  if (!g_ascii_strcasecmp(ext, ".png"))
+    return "png";
+  if (!g_ascii_strcasecmp(ext, ".tif") || !g_ascii_strcasecmp(ext, ".tiff"))
+    return "tiff";
+  if (!g_ascii_strcasecmp(ext, ".pgm") || !g_ascii_strcasecmp(ext, ".ppm") ||
+      !g_ascii_strcasecmp(ext, ".pnm"))
+    return "pnm";
+  return NULL;
+}
+
+/*
+ * PNM files are binary graymaps (P5) and pixmaps (P6) of 8 bits, read
+ * directly as gdk-pixbuf cannot write them and would expand graymaps.
+ */
+static gboolean fourier_pnm_number(const gchar **data, const gchar *end, gint *value)
+{
+  const gchar *cur = *data;
+
+  // whitespace and comments up to the next number
+  while (cur < end && (g_ascii_isspace(*cur) || *cur == '#'))
+  {
+    if (*cur == '#')
+      while (cur < end && *cur != '\n')
+        cur++;
+    else
+      cur++;
+  }
+  if (cur >= end || !g_ascii_isdigit(*cur))
+    return FALSE;
+  *value = 0;
+  while (cur < end && g_ascii_isdigit(*cur) && *value < 65536)
+    *value = *value * 10 + (*cur++ - '0');
+  *data = cur;
+  return TRUE;
+}
+
+static FourierImage *fourier_pnm_load(const gchar *filename, GError **error)
+{
+  gchar *contents;
+  gsize length;
+  const gchar *data, *end;
+  gint width, height, maxval, bpp;
+  FourierImage *image = NULL;
+
+  if (!g_file_get_contents(filename, &contents, &length, error))
+    return NULL;
+  data = contents + 2;
+  end = contents + length;
+
+  bpp = 0;
+  if (length > 2 && contents[0] == 'P')
+    bpp = (contents[1] == '5') ? 1 : (contents[1] == '6') ? 3 : 0;
+  if (!bpp ||
+      !fourier_pnm_number(&data, end, &width) || !fourier_pnm_number(&data, end, &height) ||
+      !fourier_pnm_number(&data, end, &maxval) || data >= end || !g_ascii_isspace(*data) ||
+      width <= 0 || height <= 0 || maxval != 255)
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "Only binary PGM and PPM files of 8 bits are supported");
+  else if ((gsize)(end - data - 1) < (gsize)width * height * bpp)
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Truncated PNM file");
+  else
+  {
+    image = fourier_image_new(width, height, bpp);
+    memcpy(image->pixels, data + 1, (gsize)width * height * bpp);
+  }
+
+  g_free(contents);
+  return image;
+}
+
+static gboolean fourier_pnm_save(const FourierImage *image, const gchar *filename, GError **error)
+{
+  gboolean success;
+  FILE *file;
+
+  if (image->bpp != 1 && image->bpp != 3)
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "PNM files cannot keep the alpha channel");
+    return FALSE;
+  }
+
+  file = g_fopen(filename, "wb");
+  if (!file)
+  {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Could not open for writing: %s", g_strerror(errno));
+    return FALSE;
+  }
+  fprintf(file, "P%c\n%d %d\n255\n", (image->bpp == 1) ? '5' : '6', image->width, image->height);
+  fwrite(image->pixels, image->bpp, (gsize)image->width * image->height, file);
+  success = !ferror(file);
+  if (fclose(file) != 0 || !success)
+  {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Could not write: %s", g_strerror(errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* PNG and TIFF files, through gdk-pixbuf */
+static FourierImage *fourier_pixbuf_load(const gchar *filename, GError **error)
+{
+  GdkPixbuf *pixbuf;
+  FourierImage *image;
+  gint row;
+
+  pixbuf = gdk_pixbuf_new_from_file(filename, error);
+  if (!pixbuf)
+    return NULL;
+
+  image = fourier_image_new(gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+                            gdk_pixbuf_get_n_channels(pixbuf));
+  for (row = 0; row < image->height; row++)
+    memcpy(image->pixels + (gsize)row * image->width * image->bpp,
+           gdk_pixbuf_read_pixels(pixbuf) + (gsize)row * gdk_pixbuf_get_rowstride(pixbuf),
+           (gsize)image->width * image->bpp);
+
+  g_object_unref(pixbuf);
+  return image;
+}
+
+static gboolean fourier_pixbuf_save(const FourierImage *image, const gchar *filename,
+                                    const gchar *type, GError **error)
+{
+  GdkPixbuf *pixbuf;
+  guchar *rgb = NULL;
+  gsize i;
+  gboolean success;
+
+  // Graymaps are saved as RGB, each channel has the same spectrum
+  if (image->bpp == 1)
+  {
+    rgb = g_new(guchar, (gsize)image->width * image->height * 3);
+    for (i = 0; i < (gsize)image->width * image->height; i++)
+      rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = image->pixels[i];
+  }
+
+  pixbuf = gdk_pixbuf_new_from_data(rgb ? rgb : image->pixels, GDK_COLORSPACE_RGB,
+                                    image->bpp == 4, 8, image->width, image->height,
+                                    image->width * (rgb ? 3 : image->bpp), NULL, NULL);
+  success = gdk_pixbuf_save(pixbuf, filename, type, error, NULL);
+
+  g_object_unref(pixbuf);
+  g_free(rgb);
+  return success;
+}
+
+static FourierImage *fourier_image_load(const gchar *filename, GError **error)
+{
+  if (!g_strcmp0(fourier_image_format(filename), "pnm"))
+    return fourier_pnm_load(filename, error);
+  return fourier_pixbuf_load(filename, error);
+}
+
+static gboolean fourier_image_save(const FourierImage *image, const gchar *filename, GError **error)
+{
+  const gchar *format = fourier_image_format(filename);
+
+  // Spectra must not be written to lossy formats
+  if (!format)
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "Unsupported output format, use --format");
+    return FALSE;
+  }
+  if (!strcmp(format, "pnm"))
+    return fourier_pnm_save(image, filename, error);
+  return fourier_pixbuf_save(image, filename, format, error);
+}
+
+/** Batch ********************************************************************/
+
+typedef struct
+{
+  gboolean inverse;
+  const gchar *output_dir;
+  const gchar *format;    /* of the output files, NULL to keep the input one */
+  gint failed;
+} FourierBatch;
+
+/*
+ * Each worker thread keeps the scratch of its last image, with its plans:
+ * images of the same size and channels as the previous one are transformed
+ * without any planning nor allocation.
+ */
+static GPrivate fourier_thread_scratch = G_PRIVATE_INIT((GDestroyNotify)fourier_scratch_free);
+
+static FourierScratch *fourier_thread_scratch_get(gint width, gint height, gint planes, gboolean inverse)
+{
+  FourierScratch *scratch = g_private_get(&fourier_thread_scratch);
+
+  if (scratch && scratch->width == width && scratch->height == height &&
+      scratch->planes == planes && scratch->inverse == inverse)
+    return scratch;
+
+  scratch = fourier_scratch_new(width, height, planes, inverse);
+  g_private_replace(&fourier_thread_scratch, scratch);
+  return scratch;
+}
+
+static gchar *fourier_output_filename(const FourierBatch *batch, const gchar *filename, gint bpp)
+{
+  gchar *basename = g_path_get_basename(filename);
+  gchar *output, *ext;
+
+  if (batch->format)
+  {
+    ext = strrchr(basename, '.');
+    if (ext)
+      *ext = '\0';
+    output = g_strconcat(basename, ".",
+                         !strcmp(batch->format, "pnm") ? ((bpp == 1) ? "pgm" : "ppm") :
+                         !strcmp(batch->format, "tiff") ? "tif" : batch->format,
+                         NULL);
+    g_free(basename);
+    basename = output;
+  }
+  output = g_build_filename(batch->output_dir, basename, NULL);
+  g_free(basename);
+  return output;
+}
+
+static void fourier_batch_process(gpointer data, gpointer user_data)
+{
+  gchar *filename = data;
+  FourierBatch *batch = user_data;
+  FourierImage *image;
+  FourierScratch *scratch;
+  GError *error = NULL;
+  gchar *output = NULL, *input_path = NULL, *output_path = NULL;
+  guchar *pixels;
+  gint planes;
+
+  // Files still queued when cancelled are skipped
+  if (fourier_cancelled())
+  {
+    g_free(filename);
+    return;
+  }
+
+  FOURIER_TRACE_BEGIN("load");
+  image = fourier_image_load(filename, &error);
+  FOURIER_TRACE_END();
+  if (image)
+  {
+    output = fourier_output_filename(batch, filename, image->bpp);
+    input_path = g_canonicalize_filename(filename, NULL);
+    output_path = g_canonicalize_filename(output, NULL);
+    if (!strcmp(input_path, output_path))
+      g_set_error(&error, G_FILE_ERROR, G_FILE_ERROR_EXIST, "Output would replace the input file");
+    else
+    {
+      // Alpha is kept and gray RGB images are transformed once, as by the plugin
+      planes = fourier_pixels_planes(image->pixels, (gsize)image->width * image->height, image->bpp);
+      scratch = fourier_thread_scratch_get(image->width, image->height, planes, batch->inverse);
+      pixels = g_new(guchar, (gsize)image->width * image->height * image->bpp);
+      if (fourier_scratch_process(scratch, image->pixels, pixels, image->bpp))
+      {
+        g_free(image->pixels);
+        image->pixels = pixels;
+        FOURIER_TRACE_BEGIN("save");
+        fourier_image_save(image, output, &error);
+        FOURIER_TRACE_END();
+      }
+      else
+      {
+        // Cancelled, nothing is written and the scratch is not kept
+        g_free(pixels);
+        g_private_replace(&fourier_thread_scratch, NULL);
+      }
+    }
+    fourier_image_free(image);
+  }
+
+  if (error)
+  {
+    g_printerr("%s: %s\n", filename, error->message);
+    g_error_free(error);
+    g_atomic_int_inc(&batch->failed);
+  }
+  g_free(input_path);
+  g_free(output_path);
+  g_free(output);
+  g_free(filename);
+}
+
+/* Files of the inputs, directories are replaced by their supported files in name order */
+static GPtrArray *fourier_batch_files(gchar **inputs)
+{
+  GPtrArray *files = g_ptr_array_new();
+  GPtrArray *entries;
+  const gchar *name;
+  GDir *dir;
+  guint i;
+
+  for (; *inputs; inputs++)
+  {
+    if (!g_file_test(*inputs, G_FILE_TEST_IS_DIR))
+    {
+      g_ptr_array_add(files, g_strdup(*inputs));
+      continue;
+    }
+    dir = g_dir_open(*inputs, 0, NULL);
+    if (!dir)
+      continue;
+    entries = g_ptr_array_new();
+    while ((name = g_dir_read_name(dir)))
+      if (fourier_image_format(name))
+        g_ptr_array_add(entries, g_build_filename(*inputs, name, NULL));
+    g_dir_close(dir);
+    g_ptr_array_sort(entries, (GCompareFunc)g_strcmp0);
+    for (i = 0; i < entries->len; i++)
+      g_ptr_array_add(files, g_ptr_array_index(entries, i));
+    g_ptr_array_free(entries, TRUE);
+  }
+  return files;
+}
+
+/** Main *********************************************************************/
+
+/* A first interrupt cancels the batch, a second one quits at once */
+static void fourier_cancel_signal(int signum)
+{
+  fourier_cancel();
+  signal(signum, SIG_DFL);
+}
+
+int main(int argc, char **argv)
+{
+  gboolean inverse = FALSE;
+  gchar *output_dir = NULL, *format = NULL, *wisdom = NULL, *backend = NULL;
+  gchar **inputs = NULL;
+  gint jobs = 1, threads = 0, rigor = RIGOR_ESTIMATE, memory_limit = 0;
+  GOptionEntry entries[] =
+  {
+    { "inverse", 'i', 0, G_OPTION_ARG_NONE, &inverse,
+      "Inverse transform of spectrum images (default: forward)", NULL },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir,
+      "Directory of the transformed images", "DIR" },
+    { "format", 'f', 0, G_OPTION_ARG_STRING, &format,
+      "Format of the transformed images: png, tiff or pnm (default: same as input)", "FORMAT" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Number of images transformed at once (default: 1)", "N" },
+    { "threads", 't', 0, G_OPTION_ARG_INT, &threads,
+      "Number of threads used by the FFT of each image (default: processors / jobs)", "N" },
+    { "rigor", 'r', 0, G_OPTION_ARG_INT, &rigor,
+      "FFT planning rigor { Estimate (0), Measure (1), Patient (2), Exhaustive (3) }", "N" },
+    { "memory-limit", 'm', 0, G_OPTION_ARG_INT, &memory_limit,
+      "Memory used by the FFT of each image in MB, larger images are processed in a temporary file (default: 0 = unlimited)", "MB" },
+    { "wisdom", 'w', 0, G_OPTION_ARG_FILENAME, &wisdom,
+      "FFTW wisdom file (default: " FOURIER_WISDOM_FILE " in the user cache directory)", "FILE" },
+    { "backend", 'b', 0, G_OPTION_ARG_STRING, &backend,
+      "FFT engine: fftw, builtin or auto, the faster one for each size (default: FOURIER_BACKEND, else fftw)", "NAME" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs, NULL, "FILE|DIR..." },
+    { NULL }
+  };
+  GOptionContext *context;
+  GError *error = NULL;
+  FourierBatch batch = { FALSE, NULL, NULL, 0 };
+  GThreadPool *pool;
+  GPtrArray *files;
+  gchar *dirname;
+  guint i;
+
+  context = g_option_context_new("- Fourier transform of PNG, TIFF and PNM images");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_set_description(context,
+    "Spectrum images are encoded as by the FFT Forward filter of the GIMP plugin,\n"
+    "and can be transformed back by either. Directories are replaced by their\n"
+    "PNG, TIFF and PNM files, results are written to the output directory with\n"
+    "the same names.\n");
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+  {
+    g_printerr("%s\n", error->message);
+    return 2;
+  }
+  if (!inputs || !output_dir || jobs < 1 ||
+      (format && strcmp(format, "png") && strcmp(format, "tiff") && strcmp(format, "pnm")) ||
+      (backend && fourier_backend_from_name(backend) < 0))
+  {
+    gchar *help = g_option_context_get_help(context, TRUE, NULL);
+    g_printerr("%s", help);
+    g_free(help);
+    return 2;
+  }
+  g_option_context_free(context);
+
+  fvals.threads = (threads > 0) ? threads : MAX(1, g_get_num_processors() / jobs);
+  fvals.rigor = CLAMP(rigor, RIGOR_ESTIMATE, RIGOR_EXHAUSTIVE);
+  fvals.memory_limit = MAX(memory_limit, 0);
+  fourier_backend_init();
+  if (backend)
+    fvals.backend = fourier_backend_from_name(backend);
+
+  if (!wisdom)
+    wisdom = g_build_filename(g_get_user_cache_dir(), "fourier", FOURIER_WISDOM_FILE, NULL);
+  dirname = g_path_get_dirname(wisdom);
+  g_mkdir_with_parents(dirname, 0700);
+  g_free(dirname);
+  fourier_set_wisdom_file(wisdom);
+  fourier_trace_init();
+  signal(SIGINT, fourier_cancel_signal);
+  signal(SIGTERM, fourier_cancel_signal);
+
+  if (g_mkdir_with_parents(output_dir, 0755) != 0)
+  {
+    g_printerr("%s: %s\n", output_dir, g_strerror(errno));
+    return 1;
+  }
+
+  batch.inverse = inverse;
+  batch.output_dir = output_dir;
+  batch.format = format;
+
+  // Threads are kept for the whole batch, each with its scratch
+  files = fourier_batch_files(inputs);
+  pool = g_thread_pool_new(fourier_batch_process, &batch, jobs, TRUE, &error);
+  if (!pool)
+  {
+    g_printerr("%s\n", error->message);
+    return 1;
+  }
+  for (i = 0; i < files->len; i++)
+    g_thread_pool_push(pool, g_ptr_array_index(files, i), NULL);
+  g_thread_pool_free(pool, FALSE, TRUE);
+  fourier_trace_finish();
+
+  g_ptr_array_free(files, TRUE);
+  g_strfreev(inputs);
+  g_free(output_dir);
+  g_free(format);
+  g_free(wisdom);
+  g_free(backend);
+
+  if (fourier_cancelled())
+  {
+    g_printerr("Cancelled\n");
+    return 130;
+  }
+  return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,2928 @@
+/**
+ *  (c) 2002-2024 - Remi Peyronnet  (see README.md for contributors and changelog)
+ *
+ *  Fourier Transform core, shared by the GIMP plugin and fourier-cli
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "fourier-core.h"
+#include "fourier-fft.h"
+
+#ifdef FOURIER_HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/** Options ******************************************************************/
+
+FourierVals fvals =
+{
+  0,              /* threads */
+  RIGOR_ESTIMATE, /* rigor */
+  0,              /* memory_limit */
+  PADDING_NONE,   /* padding */
+  FALSE,          /* luma */
+#ifndef FOURIER_WITHOUT_FFTW
+  BACKEND_FFTW,   /* backend */
+#else
+  BACKEND_BUILTIN, /* backend */
+#endif
+  1024            /* record_limit */
+};
+
+static FourierProgressFunc fourier_progress_func = NULL;
+
+void fourier_set_progress_func(FourierProgressFunc func)
+{
+  fourier_progress_func = func;
+}
+
+static void fourier_progress_update(gdouble fraction)
+{
+  if (fourier_progress_func)
+    fourier_progress_func(fraction);
+}
+
+static gint fourier_cancel_requested = FALSE;
+
+void fourier_cancel(void)
+{
+  g_atomic_int_set(&fourier_cancel_requested, TRUE);
+}
+
+void fourier_cancel_reset(void)
+{
+  g_atomic_int_set(&fourier_cancel_requested, FALSE);
+}
+
+gboolean fourier_cancelled(void)
+{
+  return g_atomic_int_get(&fourier_cancel_requested);
+}
+
+/** Instrumentation **********************************************************/
+
+typedef struct _FourierTraceFrame FourierTraceFrame;
+
+/* An open phase of a thread */
+struct _FourierTraceFrame
+{
+  const gchar *phase;
+  gint64 start;
+  gsize peak;               /* scratch bytes */
+  FourierTraceFrame *parent;
+};
+
+typedef struct
+{
+  const gchar *phase;       /* NULL for a change of the scratch memory */
+  gint tid;
+  gint64 start, duration;   /* microseconds since fourier_trace_init() */
+  gsize bytes;              /* peak of the phase, or scratch memory after the change */
+} FourierTraceEvent;
+
+gboolean fourier_tracing = FALSE;
+
+G_LOCK_DEFINE_STATIC(fourier_trace);
+static gchar *fourier_trace_target = NULL;
+static gint64 fourier_trace_origin;
+static GArray *fourier_trace_events = NULL;
+static GList *fourier_trace_open = NULL;    /* open frames of all threads */
+static gsize fourier_trace_scratch = 0;
+static gint fourier_trace_threads = 0;
+static GPrivate fourier_trace_frame;        /* innermost open frame of the thread */
+static GPrivate fourier_trace_tid;
+
+/* Reads FOURIER_TRACE, must be called before the first run */
+void fourier_trace_init(void)
+{
+  const gchar *target = g_getenv("FOURIER_TRACE");
+
+  G_LOCK(fourier_trace);
+  fourier_tracing = target && *target;
+  if (fourier_tracing && !fourier_trace_events)
+  {
+    fourier_trace_target = g_strdup(target);
+    fourier_trace_origin = g_get_monotonic_time();
+    fourier_trace_events = g_array_new(FALSE, FALSE, sizeof(FourierTraceEvent));
+  }
+  G_UNLOCK(fourier_trace);
+}
+
+static gint fourier_trace_get_tid(void)
+{
+  gint tid = GPOINTER_TO_INT(g_private_get(&fourier_trace_tid));
+
+  if (!tid)
+  {
+    tid = ++fourier_trace_threads;
+    g_private_set(&fourier_trace_tid, GINT_TO_POINTER(tid));
+  }
+  return tid;
+}
+
+void fourier_trace_push(const gchar *phase)
+{
+  FourierTraceFrame *frame = g_new(FourierTraceFrame, 1);
+
+  G_LOCK(fourier_trace);
+  frame->phase = phase;
+  frame->start = g_get_monotonic_time() - fourier_trace_origin;
+  frame->peak = fourier_trace_scratch;
+  frame->parent = g_private_get(&fourier_trace_frame);
+  fourier_trace_open = g_list_prepend(fourier_trace_open, frame);
+  g_private_set(&fourier_trace_frame, frame);
+  G_UNLOCK(fourier_trace);
+}
+
+void fourier_trace_pop(void)
+{
+  FourierTraceFrame *frame = g_private_get(&fourier_trace_frame);
+  FourierTraceEvent event;
+
+  if (!frame)
+    return;
+  G_LOCK(fourier_trace);
+  event.phase = frame->phase;
+  event.tid = fourier_trace_get_tid();
+  event.start = frame->start;
+  event.duration = g_get_monotonic_time() - fourier_trace_origin - frame->start;
+  event.bytes = frame->peak;
+  g_array_append_val(fourier_trace_events, event);
+  fourier_trace_open = g_list_remove(fourier_trace_open, frame);
+  g_private_set(&fourier_trace_frame, frame->parent);
+  G_UNLOCK(fourier_trace);
+  g_free(frame);
+}
+
+/* Scratch memory allocated (bytes > 0) or freed (bytes < 0) */
+void fourier_trace_memory(gssize bytes)
+{
+  FourierTraceEvent event;
+  GList *list;
+
+  G_LOCK(fourier_trace);
+  fourier_trace_scratch += bytes;
+  for (list = fourier_trace_open; list; list = list->next)
+  {
+    FourierTraceFrame *frame = list->data;
+    frame->peak = MAX(frame->peak, fourier_trace_scratch);
+  }
+  event.phase = NULL;
+  event.tid = fourier_trace_get_tid();
+  event.start = g_get_monotonic_time() - fourier_trace_origin;
+  event.duration = 0;
+  event.bytes = fourier_trace_scratch;
+  g_array_append_val(fourier_trace_events, event);
+  G_UNLOCK(fourier_trace);
+}
+
+/* One line per phase name: total time, number of times and peak scratch */
+static void fourier_trace_log(void)
+{
+  FourierTraceEvent *event, *other;
+  gint64 duration;
+  gsize peak;
+  guint i, j, count;
+
+  for (i = 0; i < fourier_trace_events->len; i++)
+  {
+    event = &g_array_index(fourier_trace_events, FourierTraceEvent, i);
+    if (!event->phase)
+      continue;
+    for (j = 0; j < i; j++)
+      if (!g_strcmp0(g_array_index(fourier_trace_events, FourierTraceEvent, j).phase, event->phase))
+        break;
+    if (j < i)
+      continue;
+
+    duration = 0;
+    peak = 0;
+    count = 0;
+    for (j = i; j < fourier_trace_events->len; j++)
+    {
+      other = &g_array_index(fourier_trace_events, FourierTraceEvent, j);
+      if (g_strcmp0(other->phase, event->phase))
+        continue;
+      duration += other->duration;
+      peak = MAX(peak, other->bytes);
+      count++;
+    }
+    g_printerr("fourier: %-16s %10.3f ms %6u x  scratch peak %8.1f MB\n",
+               event->phase, duration / 1000.0, count, peak / (1024.0 * 1024.0));
+  }
+}
+
+/* Chrome trace events, for chrome://tracing or https://ui.perfetto.dev */
+static void fourier_trace_write(const gchar *filename)
+{
+  GString *json = g_string_new("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  FourierTraceEvent *event;
+  GError *error = NULL;
+  guint i;
+
+  for (i = 0; i < fourier_trace_events->len; i++)
+  {
+    event = &g_array_index(fourier_trace_events, FourierTraceEvent, i);
+    if (event->phase)
+      g_string_append_printf(json,
+        "%s{\"name\": \"%s\", \"cat\": \"fourier\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+        "\"ts\": %" G_GINT64_FORMAT ", \"dur\": %" G_GINT64_FORMAT ", "
+        "\"args\": {\"scratch_peak_bytes\": %" G_GSIZE_FORMAT "}}",
+        i ? ",\n" : "", event->phase, event->tid, event->start, event->duration, event->bytes);
+    else
+      g_string_append_printf(json,
+        "%s{\"name\": \"scratch\", \"cat\": \"fourier\", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, "
+        "\"ts\": %" G_GINT64_FORMAT ", \"args\": {\"bytes\": %" G_GSIZE_FORMAT "}}",
+        i ? ",\n" : "", event->tid, event->start, event->bytes);
+  }
+  g_string_append(json, "\n]}\n");
+  if (!g_file_set_contents(filename, json->str, json->len, &error))
+  {
+    g_warning("Cannot write trace: %s", error->message);
+    g_error_free(error);
+  }
+  g_string_free(json, TRUE);
+}
+
+/*
+ * Report the phases recorded since fourier_trace_init(), as a log on the
+ * standard error for FOURIER_TRACE=log, else to the file it names.
+ */
+void fourier_trace_finish(void)
+{
+  if (!fourier_tracing)
+    return;
+  G_LOCK(fourier_trace);
+  if (!strcmp(fourier_trace_target, "log"))
+    fourier_trace_log();
+  else
+    fourier_trace_write(fourier_trace_target);
+  g_array_set_size(fourier_trace_events, 0);
+  G_UNLOCK(fourier_trace);
+}
+
+/** Conversion functions *****************************************************/
+
+inline gint round_gint(double value)
+{
+  double floored = floor(value);
+  if (value - floored > 0.5)
+  {
+    return (gint)(floored + 1);
+  }
+  return (gint)floored;
+}
+
+inline gint boost(double value)
+{
+  double bounded = fabs(value / 160.0);
+  gint boosted = round_gint(128.0 * sqrt(bounded));
+  boosted = (value > 0) ? boosted : -boosted;
+  return boosted;
+}
+
+inline double unboost(double value)
+{
+  double bounded = fabs(value / 128.0);
+  double unboosted = 160.0 * bounded * bounded;
+  unboosted = (value > 0) ? unboosted : -unboosted;
+  return unboosted;
+}
+
+inline guchar get_guchar(gint x, gint y, double d)
+{
+  gint i = round_gint(d);
+  // if (i > 255 || i < 0) { printf(" (%d, %d: %d) ", x, y, i); }
+  return (guchar)(i >= 255) ? 255 : ((i < 0) ? 0 : i);
+}
+
+inline guchar get_gchar128(gint x, gint y, gint i)
+{
+  // if (i > 127 || i < -128) { printf(" (%d, %d: %d) ", x, y, i); }
+  return (guchar)(i >= (gint)128) ? 255 : ((i <= (gint)-128) ? 0 : i + 128);
+}
+
+inline double get_double128(gint x, gint y, guchar c)
+{
+  return (double)(c)-128.0;
+}
+
+/* Should pixel store imaginary part? */
+static inline gint pixel_imag(gint row, gint col, gint h, gint w)
+{
+  if (row == 0 && h % 2 == 0 || row == h / 2)
+    return col > w / 2;
+  else
+    return row > h / 2;
+}
+
+/*
+ * Map images coordinates (row, col) into Fourier array indices (row2, col2).
+ */
+static inline void map(gint row, gint col, gint h, gint w,
+                       gint *row2, gint *col2)
+{
+  *row2 = (row + (h + 1) / 2) % h; /* shift origin */
+  *col2 = (col + (w + 1) / 2) % w;
+  if (*col2 > w / 2)
+  { /* wrap */
+    *row2 = (h - *row2) % h;
+    *col2 = w - *col2;
+  }
+  *col2 *= 2; /* unit = real number */
+  if (pixel_imag(row, col, h, w))
+    (*col2)++; /* take imaginary part */
+}
+
+inline double normalize(gint x, gint y, gint width, gint height)
+{
+  double cx = (double)abs(x - width / 2);
+  double cy = (double)abs(y - height / 2);
+  double energy = (sqrt(cx) + sqrt(cy));
+  return energy * energy;
+}
+
+/** Quantization kernels *****************************************************/
+
+/*
+ * Row versions of the conversion functions, with SIMD variants selected at
+ * runtime. SIMD variants do exactly the same double operations as the
+ * scalar ones (division, sqrt, floor, compare), so that spectrum layers do
+ * not depend on the processor.
+ */
+
+typedef void (*FourierQuantizeFunc)(const double *values, guchar *dst, gint n, gint dst_stride);
+
+/* dst[i] = get_gchar128(boost(values[i])) */
+static void quantize_spectrum_c(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  gint i;
+  for (i = 0; i < n; i++)
+    dst[i * dst_stride] = get_gchar128(i, 0, boost(values[i]));
+}
+
+/* dst[i] = get_guchar(values[i]) */
+static void quantize_pixels_c(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  gint i;
+  for (i = 0; i < n; i++)
+    dst[i * dst_stride] = get_guchar(i, 0, values[i]);
+}
+
+// Scalar math must not use x87 to match SSE results; AVX spills are misaligned with mingw64
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2_MATH__)))
+#define FOURIER_SIMD_SSE41
+#if !defined(_WIN32)
+#define FOURIER_SIMD_AVX
+#endif
+#include <immintrin.h>
+#endif
+
+#ifdef FOURIER_SIMD_SSE41
+__attribute__((target("sse4.1")))
+static void quantize_spectrum_sse41(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+  const __m128d c160 = _mm_set1_pd(160.0), c128 = _mm_set1_pd(128.0);
+  const __m128d half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0), zero = _mm_setzero_pd();
+  const __m128i lo = _mm_set1_epi32(-128), hi = _mm_set1_epi32(127), c128i = _mm_set1_epi32(128);
+  gint32 out[4];
+  gint i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+  {
+    __m128d x = _mm_loadu_pd(values + i);
+    __m128d m = _mm_mul_pd(c128, _mm_sqrt_pd(_mm_and_pd(_mm_div_pd(x, c160), abs_mask)));
+    __m128d f = _mm_round_pd(m, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m128d r = _mm_add_pd(f, _mm_and_pd(_mm_cmpgt_pd(_mm_sub_pd(m, f), half), one));
+    r = _mm_blendv_pd(_mm_sub_pd(zero, r), r, _mm_cmpgt_pd(x, zero));
+    // clamp after the conversion, out of range values behave like the (gint) cast
+    _mm_storeu_si128((__m128i *)out,
+                     _mm_add_epi32(_mm_min_epi32(_mm_max_epi32(_mm_cvttpd_epi32(r), lo), hi), c128i));
+    dst[i * dst_stride] = (guchar)out[0];
+    dst[(i + 1) * dst_stride] = (guchar)out[1];
+  }
+  quantize_spectrum_c(values + i, dst + i * dst_stride, n - i, dst_stride);
+}
+
+__attribute__((target("sse4.1")))
+static void quantize_pixels_sse41(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  const __m128d half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0);
+  const __m128i lo = _mm_setzero_si128(), hi = _mm_set1_epi32(255);
+  gint32 out[4];
+  gint i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+  {
+    __m128d x = _mm_loadu_pd(values + i);
+    __m128d f = _mm_round_pd(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m128d r = _mm_add_pd(f, _mm_and_pd(_mm_cmpgt_pd(_mm_sub_pd(x, f), half), one));
+    _mm_storeu_si128((__m128i *)out, _mm_min_epi32(_mm_max_epi32(_mm_cvttpd_epi32(r), lo), hi));
+    dst[i * dst_stride] = (guchar)out[0];
+    dst[(i + 1) * dst_stride] = (guchar)out[1];
+  }
+  quantize_pixels_c(values + i, dst + i * dst_stride, n - i, dst_stride);
+}
+#endif
+
+#ifdef FOURIER_SIMD_AVX
+__attribute__((target("avx2")))
+static void quantize_spectrum_avx2(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+  const __m256d c160 = _mm256_set1_pd(160.0), c128 = _mm256_set1_pd(128.0);
+  const __m256d half = _mm256_set1_pd(0.5), one = _mm256_set1_pd(1.0), zero = _mm256_setzero_pd();
+  const __m128i lo = _mm_set1_epi32(-128), hi = _mm_set1_epi32(127), c128i = _mm_set1_epi32(128);
+  gint32 out[4];
+  gint i, k;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    __m256d x = _mm256_loadu_pd(values + i);
+    __m256d m = _mm256_mul_pd(c128, _mm256_sqrt_pd(_mm256_and_pd(_mm256_div_pd(x, c160), abs_mask)));
+    __m256d f = _mm256_round_pd(m, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_add_pd(f, _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(m, f), half, _CMP_GT_OQ), one));
+    r = _mm256_blendv_pd(_mm256_sub_pd(zero, r), r, _mm256_cmp_pd(x, zero, _CMP_GT_OQ));
+    _mm_storeu_si128((__m128i *)out,
+                     _mm_add_epi32(_mm_min_epi32(_mm_max_epi32(_mm256_cvttpd_epi32(r), lo), hi), c128i));
+    for (k = 0; k < 4; k++)
+      dst[(i + k) * dst_stride] = (guchar)out[k];
+  }
+  quantize_spectrum_c(values + i, dst + i * dst_stride, n - i, dst_stride);
+}
+
+__attribute__((target("avx2")))
+static void quantize_pixels_avx2(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  const __m256d half = _mm256_set1_pd(0.5), one = _mm256_set1_pd(1.0);
+  const __m128i lo = _mm_setzero_si128(), hi = _mm_set1_epi32(255);
+  gint32 out[4];
+  gint i, k;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    __m256d x = _mm256_loadu_pd(values + i);
+    __m256d f = _mm256_round_pd(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_add_pd(f, _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(x, f), half, _CMP_GT_OQ), one));
+    _mm_storeu_si128((__m128i *)out, _mm_min_epi32(_mm_max_epi32(_mm256_cvttpd_epi32(r), lo), hi));
+    for (k = 0; k < 4; k++)
+      dst[(i + k) * dst_stride] = (guchar)out[k];
+  }
+  quantize_pixels_c(values + i, dst + i * dst_stride, n - i, dst_stride);
+}
+
+__attribute__((target("avx512f")))
+static void quantize_spectrum_avx512(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  const __m512d c160 = _mm512_set1_pd(160.0), c128 = _mm512_set1_pd(128.0);
+  const __m512d half = _mm512_set1_pd(0.5), one = _mm512_set1_pd(1.0), zero = _mm512_setzero_pd();
+  const __m256i lo = _mm256_set1_epi32(-128), hi = _mm256_set1_epi32(127), c128i = _mm256_set1_epi32(128);
+  gint32 out[8];
+  gint i, k;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    __m512d x = _mm512_loadu_pd(values + i);
+    __m512d m = _mm512_mul_pd(c128, _mm512_sqrt_pd(_mm512_abs_pd(_mm512_div_pd(x, c160))));
+    __m512d f = _mm512_roundscale_pd(m, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_mask_add_pd(f, _mm512_cmp_pd_mask(_mm512_sub_pd(m, f), half, _CMP_GT_OQ), f, one);
+    r = _mm512_mask_sub_pd(r, _mm512_cmp_pd_mask(x, zero, _CMP_NGT_UQ), zero, r);
+    _mm256_storeu_si256((__m256i *)out,
+                        _mm256_add_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm512_cvttpd_epi32(r), lo), hi), c128i));
+    for (k = 0; k < 8; k++)
+      dst[(i + k) * dst_stride] = (guchar)out[k];
+  }
+  quantize_spectrum_c(values + i, dst + i * dst_stride, n - i, dst_stride);
+}
+
+__attribute__((target("avx512f")))
+static void quantize_pixels_avx512(const double *values, guchar *dst, gint n, gint dst_stride)
+{
+  const __m512d half = _mm512_set1_pd(0.5), one = _mm512_set1_pd(1.0);
+  const __m256i lo = _mm256_setzero_si256(), hi = _mm256_set1_epi32(255);
+  gint32 out[8];
+  gint i, k;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    __m512d x = _mm512_loadu_pd(values + i);
+    __m512d f = _mm512_roundscale_pd(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_mask_add_pd(f, _mm512_cmp_pd_mask(_mm512_sub_pd(x, f), half, _CMP_GT_OQ), f, one);
+    _mm256_storeu_si256((__m256i *)out, _mm256_min_epi32(_mm256_max_epi32(_mm512_cvttpd_epi32(r), lo), hi));
+    for (k = 0; k < 8; k++)
+      dst[(i + k) * dst_stride] = (guchar)out[k];
+  }
+  quantize_pixels_c(values + i, dst + i * dst_stride, n - i, dst_stride);
+}
+#endif
+
+static FourierQuantizeFunc fourier_quantize_spectrum = quantize_spectrum_c;
+static FourierQuantizeFunc fourier_quantize_pixels = quantize_pixels_c;
+
+/* unboost() of every 8 bits spectrum value */
+static double fourier_unboost_table[256];
+
+static void fourier_kernels_init(void)
+{
+  static gsize kernels_ready = 0;
+  gint c;
+
+  if (!g_once_init_enter(&kernels_ready))
+    return;
+
+  for (c = 0; c < 256; c++)
+    fourier_unboost_table[c] = unboost(get_double128(0, 0, (guchar)c));
+
+#ifdef FOURIER_SIMD_SSE41
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.1"))
+  {
+    fourier_quantize_spectrum = quantize_spectrum_sse41;
+    fourier_quantize_pixels = quantize_pixels_sse41;
+  }
+#ifdef FOURIER_SIMD_AVX
+  if (__builtin_cpu_supports("avx2"))
+  {
+    fourier_quantize_spectrum = quantize_spectrum_avx2;
+    fourier_quantize_pixels = quantize_pixels_avx2;
+  }
+  if (__builtin_cpu_supports("avx512f"))
+  {
+    fourier_quantize_spectrum = quantize_spectrum_avx512;
+    fourier_quantize_pixels = quantize_pixels_avx512;
+  }
+#endif
+#endif
+  g_once_init_leave(&kernels_ready, 1);
+}
+
+/** Geometry tables **********************************************************/
+
+/*
+ * map() and normalize() are separable, so instead of a table of
+ * width * height entries, the geometry of a size is stored as one table
+ * per row and one per column, and expanded once per row for all channels
+ * by fourier_geometry_row().
+ */
+struct _FourierGeometry
+{
+  gint    ref_count;
+  gint    width, height;
+  gint    stride;       /* doubles per padded row of a plane */
+  gint   *col_offset;   /* col2 * 2 */
+  guchar *col_wrap;     /* spectrum column taken from the conjugate half */
+  guchar *col_upper;    /* col > width / 2 */
+  gint   *row_offset;   /* row2 * stride, [row * 2 + 1] for wrapped columns */
+  gint   *row_imag;     /* 0 or 1 for the whole row, -1 when given by col_upper */
+  double *col_sqrt;     /* sqrt(abs(col - width / 2)) */
+  double *row_sqrt;     /* sqrt(abs(row - height / 2)) */
+};
+
+static void fourier_geometry_free(FourierGeometry *geo)
+{
+  g_free(geo->col_offset);
+  g_free(geo->col_wrap);
+  g_free(geo->col_upper);
+  g_free(geo->row_offset);
+  g_free(geo->row_imag);
+  g_free(geo->col_sqrt);
+  g_free(geo->row_sqrt);
+  g_free(geo);
+}
+
+static FourierGeometry *fourier_geometry_new(gint width, gint height)
+{
+  FourierGeometry *geo = g_new0(FourierGeometry, 1);
+  gint row, col, row2, col2;
+
+  geo->ref_count = 1;
+  geo->width = width;
+  geo->height = height;
+  geo->stride = width + ((width & 1) ? 1 : 2);
+
+  geo->col_offset = g_new(gint, width);
+  geo->col_wrap = g_new(guchar, width);
+  geo->col_upper = g_new(guchar, width);
+  geo->col_sqrt = g_new(double, width);
+  for (col = 0; col < width; col++)
+  {
+    // same as map()
+    col2 = (col + (width + 1) / 2) % width;
+    geo->col_wrap[col] = (col2 > width / 2);
+    geo->col_offset[col] = (geo->col_wrap[col] ? width - col2 : col2) * 2;
+    geo->col_upper[col] = (col > width / 2);
+    // same as normalize()
+    geo->col_sqrt[col] = sqrt((double)abs(col - width / 2));
+  }
+
+  geo->row_offset = g_new(gint, height * 2);
+  geo->row_imag = g_new(gint, height);
+  geo->row_sqrt = g_new(double, height);
+  for (row = 0; row < height; row++)
+  {
+    row2 = (row + (height + 1) / 2) % height;
+    geo->row_offset[row * 2] = row2 * geo->stride;
+    geo->row_offset[row * 2 + 1] = ((height - row2) % height) * geo->stride;
+    // same as pixel_imag()
+    if (row == 0 && height % 2 == 0 || row == height / 2)
+      geo->row_imag[row] = -1;
+    else
+      geo->row_imag[row] = (row > height / 2);
+    geo->row_sqrt[row] = sqrt((double)abs(row - height / 2));
+  }
+
+  return geo;
+}
+
+static void fourier_geometry_unref(FourierGeometry *geo)
+{
+  if (g_atomic_int_dec_and_test(&geo->ref_count))
+    fourier_geometry_free(geo);
+}
+
+/*
+ * Geometry of the last size used, kept for the next channels, directions and
+ * runs. Each scratch holds a reference to its own.
+ */
+static FourierGeometry *fourier_geometry_cache = NULL;
+G_LOCK_DEFINE_STATIC(fourier_geometry_cache);
+
+static FourierGeometry *fourier_geometry_get(gint width, gint height)
+{
+  FourierGeometry *geo;
+
+  G_LOCK(fourier_geometry_cache);
+  if (fourier_geometry_cache &&
+      (fourier_geometry_cache->width != width || fourier_geometry_cache->height != height))
+  {
+    fourier_geometry_unref(fourier_geometry_cache);
+    fourier_geometry_cache = NULL;
+  }
+  if (!fourier_geometry_cache)
+    fourier_geometry_cache = fourier_geometry_new(width, height);
+  geo = fourier_geometry_cache;
+  g_atomic_int_inc(&geo->ref_count);
+  G_UNLOCK(fourier_geometry_cache);
+
+  return geo;
+}
+
+void fourier_geometry_cache_free(void)
+{
+  G_LOCK(fourier_geometry_cache);
+  if (fourier_geometry_cache)
+    fourier_geometry_unref(fourier_geometry_cache);
+  fourier_geometry_cache = NULL;
+  G_UNLOCK(fourier_geometry_cache);
+}
+
+/*
+ * Expand columns [col, col + cols) of one row: index[i] is the position in a
+ * plane of the spectrum value shown at (row, col + i), norm[i] its
+ * normalize() factor.
+ */
+static void fourier_geometry_row(const FourierGeometry *geo, gint row, gint col, gint cols,
+                                 gint *index, double *norm)
+{
+  const gint *row_offset = geo->row_offset + row * 2;
+  gint imag = geo->row_imag[row];
+  double row_sqrt = geo->row_sqrt[row];
+  double energy;
+  gint i, cur_col;
+
+  for (i = 0; i < cols; i++)
+  {
+    cur_col = col + i;
+    index[i] = row_offset[geo->col_wrap[cur_col]] + geo->col_offset[cur_col] +
+               ((imag < 0) ? geo->col_upper[cur_col] : imag);
+    energy = geo->col_sqrt[cur_col] + row_sqrt;
+    norm[i] = energy * energy;
+  }
+}
+
+/** Pixel kernels ************************************************************/
+
+/*
+ * Pixels are converted by blocks of columns: a block of interleaved pixels
+ * stays in L1 cache while each of its channels is streamed to its plane.
+ */
+#define FOURIER_BLOCK_COLS 256
+
+/*
+ * Split a width * height rectangle of interleaved pixels (bpp bytes each,
+ * first planes channels used) into the planes of fft_real at (x, y).
+ */
+static void fourier_deinterleave(const guchar *pixels, gint rowstride, gint bpp, gint planes,
+                                 gint x, gint y, gint width, gint height,
+                                 fourier_real *fft_real, gint stride, gsize plane_size)
+{
+  gint row;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (row = 0; row < height; row++)
+  {
+    const guchar *src_row = pixels + (gsize)row * rowstride;
+    fourier_real *dst_row = fft_real + (gsize)(y + row) * stride + x;
+    gint block, block_cols, col, cur_bpp;
+
+    for (block = 0; block < width; block += FOURIER_BLOCK_COLS)
+    {
+      block_cols = MIN(FOURIER_BLOCK_COLS, width - block);
+      for (cur_bpp = 0; cur_bpp < planes; cur_bpp++)
+      {
+        const guchar *src = src_row + block * bpp + cur_bpp;
+        fourier_real *dst = dst_row + cur_bpp * plane_size + block;
+        for (col = 0; col < block_cols; col++)
+          dst[col] = (fourier_real)src[col * bpp];
+      }
+    }
+  }
+}
+
+/*
+ * Rec. 601 luma, the Y' of Y'CbCr, of the first three channels of the
+ * pixels into the first plane of fft_real at (x, y).
+ */
+static void fourier_deinterleave_luma(const guchar *pixels, gint rowstride, gint bpp,
+                                      gint x, gint y, gint width, gint height,
+                                      fourier_real *fft_real, gint stride)
+{
+  gint row;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (row = 0; row < height; row++)
+  {
+    const guchar *src = pixels + (gsize)row * rowstride;
+    fourier_real *dst = fft_real + (gsize)(y + row) * stride + x;
+    gint col;
+
+    for (col = 0; col < width; col++, src += bpp)
+      dst[col] = (fourier_real)(0.299 * src[0] + 0.587 * src[1] + 0.114 * src[2]);
+  }
+}
+
+/* Quantize width values of each plane from src_row into one row of pixels */
+static void fourier_interleave_row(const fourier_real *src_row, gsize plane_size, gint width,
+                                   guchar *dst_row, gint bpp, gint planes)
+{
+  gint block, block_cols, cur_bpp;
+#ifdef FOURIER_SINGLE_PRECISION
+  double values[FOURIER_BLOCK_COLS];
+  gint col;
+#endif
+
+  for (block = 0; block < width; block += FOURIER_BLOCK_COLS)
+  {
+    block_cols = MIN(FOURIER_BLOCK_COLS, width - block);
+    for (cur_bpp = 0; cur_bpp < planes; cur_bpp++)
+    {
+      const fourier_real *src = src_row + cur_bpp * plane_size + block;
+      guchar *dst = dst_row + block * bpp + cur_bpp;
+#ifdef FOURIER_SINGLE_PRECISION
+      // quantization is always done in double precision
+      for (col = 0; col < block_cols; col++)
+        values[col] = src[col];
+      fourier_quantize_pixels(values, dst, block_cols, bpp);
+#else
+      fourier_quantize_pixels(src, dst, block_cols, bpp);
+#endif
+    }
+  }
+}
+
+/*
+ * Reverse of fourier_deinterleave(): quantize the planes of fft_real at
+ * (x, y) into a width * height rectangle of interleaved pixels.
+ */
+static void fourier_interleave(const fourier_real *fft_real, gint stride, gsize plane_size,
+                               gint x, gint y, gint width, gint height,
+                               guchar *pixels, gint rowstride, gint bpp, gint planes)
+{
+  gint row;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (row = 0; row < height; row++)
+    fourier_interleave_row(fft_real + (gsize)(y + row) * stride + x, plane_size, width,
+                           pixels + (gsize)row * rowstride, bpp, planes);
+}
+
+/** FFT backends *************************************************************/
+
+static gint fourier_get_threads(gint sel_width, gint sel_height)
+{
+  gint threads = (fvals.threads > 0) ? fvals.threads : g_get_num_processors();
+  // Threads do not pay off on small selections
+  if ((gint64)sel_width * sel_height < 256 * 256)
+    threads = 1;
+  return threads;
+}
+
+/*
+ * Wisdom is shared by all runs of the plugin: plans measured once for a size
+ * are reused by later runs, even with FFTW_ESTIMATE. The backends chosen by
+ * auto are kept next to it.
+ */
+static gchar *fourier_wisdom_file = NULL;
+static gboolean fourier_wisdom_loaded = FALSE;
+static GKeyFile *fourier_backends = NULL;
+
+void fourier_set_wisdom_file(const gchar *filename)
+{
+  // Long running users set it before each run, it is only read once
+  if (!g_strcmp0(filename, fourier_wisdom_file))
+    return;
+  g_free(fourier_wisdom_file);
+  fourier_wisdom_file = g_strdup(filename);
+  fourier_wisdom_loaded = FALSE;
+  if (fourier_backends)
+    g_key_file_free(fourier_backends);
+  fourier_backends = NULL;
+}
+
+#ifndef FOURIER_WITHOUT_FFTW
+/* Must be called before each plan creation */
+static void fourier_plan_with_threads(gint threads)
+{
+#ifdef HAVE_FFTW3_THREADS
+  static gboolean threads_ready = FALSE;
+  if (!threads_ready)
+    threads_ready = (FFTW(init_threads)() != 0);
+  if (threads_ready)
+    FFTW(plan_with_nthreads)(threads);
+#endif
+}
+
+static void fourier_wisdom_load(void)
+{
+  gchar *wisdom;
+
+  if (fourier_wisdom_loaded || !fourier_wisdom_file)
+    return;
+  fourier_wisdom_loaded = TRUE;
+
+  if (g_file_get_contents(fourier_wisdom_file, &wisdom, NULL, NULL))
+  {
+    if (!FFTW(import_wisdom_from_string)(wisdom))
+      g_warning("Ignoring invalid FFTW wisdom file '%s'", fourier_wisdom_file);
+    g_free(wisdom);
+  }
+}
+
+static void fourier_wisdom_save(void)
+{
+  gchar *wisdom;
+
+  if (!fourier_wisdom_file)
+    return;
+  wisdom = FFTW(export_wisdom_to_string)();
+  if (wisdom)
+  {
+    // Written atomically as several plugin instances may run at once
+    g_file_set_contents(fourier_wisdom_file, wisdom, -1, NULL);
+    free(wisdom);
+  }
+}
+
+static unsigned fourier_plan_flags(void)
+{
+  switch (fvals.rigor)
+  {
+  case RIGOR_MEASURE:
+    return FFTW_MEASURE;
+  case RIGOR_PATIENT:
+    return FFTW_PATIENT;
+  case RIGOR_EXHAUSTIVE:
+    return FFTW_EXHAUSTIVE;
+  default:
+    return FFTW_ESTIMATE;
+  }
+}
+
+#define fourier_alloc_real(n) FFTW(alloc_real)(n)
+#define fourier_alloc_complex(n) FFTW(alloc_complex)(n)
+#define fourier_free(p) FFTW(free)(p)
+#else
+// The built-in FFT needs no particular alignment
+#define fourier_alloc_real(n) g_new(fourier_real, n)
+#define fourier_alloc_complex(n) g_new(fourier_complex, n)
+#define fourier_free(p) g_free(p)
+#endif
+
+/* Only plan execution is thread safe in FFTW, the rest of its API is locked */
+G_LOCK_DEFINE_STATIC(fourier_planner);
+
+/* Must surround each plan creation, plans then run on threads threads */
+static void fourier_plan_begin(gint threads)
+{
+  FOURIER_TRACE_BEGIN("plan");
+  G_LOCK(fourier_planner);
+#ifndef FOURIER_WITHOUT_FFTW
+  fourier_wisdom_load();
+  fourier_plan_with_threads(threads);
+#endif
+}
+
+static void fourier_plan_end(void)
+{
+#ifndef FOURIER_WITHOUT_FFTW
+  if (fvals.rigor != RIGOR_ESTIMATE)
+    fourier_wisdom_save();
+#endif
+  G_UNLOCK(fourier_planner);
+  FOURIER_TRACE_END();
+}
+
+static const gchar *fourier_backend_names[] = { "fftw", "builtin", "auto" };
+
+gint fourier_backend_from_name(const gchar *name)
+{
+  guint i;
+
+  for (i = 0; name && i < G_N_ELEMENTS(fourier_backend_names); i++)
+    if (!g_ascii_strcasecmp(name, fourier_backend_names[i]))
+    {
+#ifdef FOURIER_WITHOUT_FFTW
+      if (i == BACKEND_FFTW)
+        return -1;
+#endif
+      return i;
+    }
+  return -1;
+}
+
+void fourier_backend_init(void)
+{
+  const gchar *name = g_getenv("FOURIER_BACKEND");
+  gint backend;
+
+  if (!name || !*name)
+    return;
+  backend = fourier_backend_from_name(name);
+  if (backend < 0)
+    g_warning("Ignoring unknown FOURIER_BACKEND '%s'", name);
+  else
+    fvals.backend = backend;
+}
+
+/* Backend of plans without a choice of their own, auto being left to fourier_plan_batch() */
+static gint fourier_backend_get(void)
+{
+#ifdef FOURIER_WITHOUT_FFTW
+  return BACKEND_BUILTIN;
+#else
+  return (fvals.backend == BACKEND_BUILTIN) ? BACKEND_BUILTIN : BACKEND_FFTW;
+#endif
+}
+
+/* The choices of auto are read once, under the planner lock */
+static gchar *fourier_backends_file(void)
+{
+  return fourier_wisdom_file ? g_strconcat(fourier_wisdom_file, "-backends", NULL) : NULL;
+}
+
+static gint fourier_backends_lookup(const gchar *key)
+{
+  gchar *filename, *name;
+  gint backend;
+
+  if (!fourier_backends)
+  {
+    fourier_backends = g_key_file_new();
+    if ((filename = fourier_backends_file()))
+      g_key_file_load_from_file(fourier_backends, filename, G_KEY_FILE_NONE, NULL);
+    g_free(filename);
+  }
+  name = g_key_file_get_string(fourier_backends, "backends", key, NULL);
+  backend = fourier_backend_from_name(name);
+  g_free(name);
+  return (backend == BACKEND_AUTO) ? -1 : backend;
+}
+
+static void fourier_backends_store(const gchar *key, gint backend)
+{
+  gchar *filename, *data;
+  gsize length;
+
+  G_LOCK(fourier_planner);
+  g_key_file_set_string(fourier_backends, "backends", key, fourier_backend_names[backend]);
+  if ((filename = fourier_backends_file()))
+  {
+    // Written atomically as several plugin instances may run at once
+    data = g_key_file_to_data(fourier_backends, &length, NULL);
+    g_file_set_contents(filename, data, length, NULL);
+    g_free(data);
+    g_free(filename);
+  }
+  G_UNLOCK(fourier_planner);
+}
+
+/*
+ * A plan transforms in place howmany real arrays of height rows of width
+ * values, stride values from one row to the next and dist from one array to
+ * the next, or, for the column strips of the separable transform, howmany
+ * interleaved complex columns of height values. The built-in backend runs 2D
+ * transforms as a pass over the rows then one over the columns, the other
+ * way round for the inverse.
+ */
+struct _FourierPlan
+{
+  gint backend;
+  gboolean inverse;
+#ifndef FOURIER_WITHOUT_FFTW
+  FFTW(plan) fftw;
+#endif
+  gint width, height, howmany; /* width is 0 for column strips */
+  gint stride;
+  gsize dist;
+  gint threads;
+  fourier_real *data;
+  FourierRFFT *rows;          /* built-in, of real arrays */
+  FourierFFT *columns;        /* built-in, of 2D arrays and column strips */
+};
+
+#ifndef FOURIER_WITHOUT_FFTW
+/*
+ * Arrays more than G_MAXINT values apart, beyond the int distances of the
+ * plan_many interface, are planned with the 64-bit strides of the guru one.
+ */
+static FFTW(plan) fourier_plan_guru64(gboolean inverse, fourier_real *data,
+                                      gint width, gint height, gint howmany, gint stride, gsize dist,
+                                      unsigned flags)
+{
+  FFTW(iodim64) dims[2], howmany_dims[1];
+
+  dims[0].n = height;
+  dims[0].is = inverse ? stride / 2 : stride;
+  dims[0].os = inverse ? stride : stride / 2;
+  dims[1].n = width;
+  dims[1].is = 1;
+  dims[1].os = 1;
+  howmany_dims[0].n = howmany;
+  howmany_dims[0].is = inverse ? dist / 2 : dist;
+  howmany_dims[0].os = inverse ? dist : dist / 2;
+  if (!inverse)
+    return FFTW(plan_guru64_dft_r2c)(2, dims, 1, howmany_dims, data, (FFTW(complex) *)data, flags);
+  return FFTW(plan_guru64_dft_c2r)(2, dims, 1, howmany_dims, (FFTW(complex) *)data, data, flags);
+}
+#endif
+
+/* Must be called between fourier_plan_begin() and fourier_plan_end() */
+static FourierPlan *fourier_plan_real(gint backend, gboolean inverse, fourier_real *data,
+                                      gint width, gint height, gint howmany, gint stride, gsize dist,
+                                      gint threads, gboolean unaligned)
+{
+  FourierPlan *plan = g_new0(FourierPlan, 1);
+#ifndef FOURIER_WITHOUT_FFTW
+  int n[2] = { height, width };
+  int real_embed[2] = { height, stride };
+  int complex_embed[2] = { height, stride / 2 };
+  unsigned flags = fourier_plan_flags() | (unaligned ? FFTW_UNALIGNED : 0);
+#endif
+
+  plan->backend = backend;
+  plan->inverse = inverse;
+  plan->width = width;
+  plan->height = height;
+  plan->howmany = howmany;
+  plan->stride = stride;
+  plan->dist = dist;
+  plan->threads = threads;
+  plan->data = data;
+  if (backend == BACKEND_BUILTIN)
+  {
+    plan->rows = fourier_rfft_new(width, inverse);
+    if (height > 1)
+      plan->columns = fourier_fft_new(height, inverse);
+    return plan;
+  }
+
+#ifndef FOURIER_WITHOUT_FFTW
+  // Arrays of one row are planned as such, with no layout of their rows
+  if (height == 1 && !inverse)
+    plan->fftw = FFTW(plan_many_dft_r2c)(1, &n[1], howmany,
+                                         data, NULL, 1, (int)dist,
+                                         (FFTW(complex) *)data, NULL, 1, (int)(dist / 2),
+                                         flags);
+  else if (height == 1)
+    plan->fftw = FFTW(plan_many_dft_c2r)(1, &n[1], howmany,
+                                         (FFTW(complex) *)data, NULL, 1, (int)(dist / 2),
+                                         data, NULL, 1, (int)dist,
+                                         flags);
+  else if (dist > G_MAXINT)
+    plan->fftw = fourier_plan_guru64(inverse, data, width, height, howmany, stride, dist, flags);
+  else if (!inverse)
+    plan->fftw = FFTW(plan_many_dft_r2c)(2, n, howmany,
+                                         data, real_embed, 1, (int)dist,
+                                         (FFTW(complex) *)data, complex_embed, 1, (int)(dist / 2),
+                                         flags);
+  else
+    plan->fftw = FFTW(plan_many_dft_c2r)(2, n, howmany,
+                                         (FFTW(complex) *)data, complex_embed, 1, (int)(dist / 2),
+                                         data, real_embed, 1, (int)dist,
+                                         flags);
+#endif
+  return plan;
+}
+
+/* Must be called between fourier_plan_begin() and fourier_plan_end() */
+static FourierPlan *fourier_plan_columns(gint backend, gboolean inverse, fourier_complex *data,
+                                         gint height, gint columns, gint threads)
+{
+  FourierPlan *plan = g_new0(FourierPlan, 1);
+#ifndef FOURIER_WITHOUT_FFTW
+  int n = height;
+#endif
+
+  plan->backend = backend;
+  plan->inverse = inverse;
+  plan->height = height;
+  plan->howmany = columns;
+  plan->threads = threads;
+  plan->data = (fourier_real *)data;
+  if (backend == BACKEND_BUILTIN)
+  {
+    plan->columns = fourier_fft_new(height, inverse);
+    return plan;
+  }
+
+#ifndef FOURIER_WITHOUT_FFTW
+  plan->fftw = FFTW(plan_many_dft)(1, &n, columns,
+                                   data, NULL, columns, 1,
+                                   data, NULL, columns, 1,
+                                   inverse ? FFTW_BACKWARD : FFTW_FORWARD,
+                                   fourier_plan_flags());
+#endif
+  return plan;
+}
+
+static void fourier_plan_free(FourierPlan *plan)
+{
+  if (!plan)
+    return;
+#ifndef FOURIER_WITHOUT_FFTW
+  if (plan->fftw)
+  {
+    G_LOCK(fourier_planner);
+    FFTW(destroy_plan)(plan->fftw);
+    G_UNLOCK(fourier_planner);
+  }
+#endif
+  if (plan->rows)
+    fourier_rfft_free(plan->rows);
+  if (plan->columns)
+    fourier_fft_free(plan->columns);
+  g_free(plan);
+}
+
+/* Columns of the built-in backend are transformed by blocks, copied to contiguous columns */
+#define FOURIER_BUILTIN_BLOCK 8
+
+/* The count complex columns of data, rows row_stride values apart, in chunks for threads */
+static void fourier_builtin_columns(const FourierPlan *plan, fourier_complex *data, gint count, gint row_stride)
+{
+  const FourierFFT *fft = plan->columns;
+  gint height = plan->height;
+  gint blocks = (count + FOURIER_BUILTIN_BLOCK - 1) / FOURIER_BUILTIN_BLOCK;
+  gint chunks = MAX(1, MIN(plan->threads, blocks));
+  gint chunk;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(chunks)
+#endif
+  for (chunk = 0; chunk < chunks; chunk++)
+  {
+    fourier_complex *block = g_new(fourier_complex, (gsize)(FOURIER_BUILTIN_BLOCK + 1) * height +
+                                                    fourier_fft_work_size(fft));
+    fourier_complex *column = block + (gsize)FOURIER_BUILTIN_BLOCK * height;
+    fourier_complex *work = column + height;
+    gint b, first, columns, row, col;
+
+    for (b = chunk * blocks / chunks; b < (chunk + 1) * blocks / chunks; b++)
+    {
+      first = b * FOURIER_BUILTIN_BLOCK;
+      columns = MIN(FOURIER_BUILTIN_BLOCK, count - first);
+      for (row = 0; row < height; row++)
+        for (col = 0; col < columns; col++)
+        {
+          block[(gsize)col * height + row][0] = data[(gsize)row * row_stride + first + col][0];
+          block[(gsize)col * height + row][1] = data[(gsize)row * row_stride + first + col][1];
+        }
+      for (col = 0; col < columns; col++)
+      {
+        fourier_fft_execute(fft, block + (gsize)col * height, 1, column, work);
+        memcpy(block + (gsize)col * height, column, sizeof(fourier_complex) * height);
+      }
+      for (row = 0; row < height; row++)
+        for (col = 0; col < columns; col++)
+        {
+          data[(gsize)row * row_stride + first + col][0] = block[(gsize)col * height + row][0];
+          data[(gsize)row * row_stride + first + col][1] = block[(gsize)col * height + row][1];
+        }
+    }
+    g_free(block);
+  }
+}
+
+/* The rows of all arrays of data, in chunks for threads */
+static void fourier_builtin_rows(const FourierPlan *plan, fourier_real *data)
+{
+  gint rows = plan->height * plan->howmany;
+  gint chunks = MAX(1, MIN(plan->threads, rows));
+  gint chunk;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(chunks)
+#endif
+  for (chunk = 0; chunk < chunks; chunk++)
+  {
+    fourier_complex *work = g_new(fourier_complex, fourier_rfft_work_size(plan->rows));
+    gint row;
+
+    for (row = chunk * rows / chunks; row < (chunk + 1) * rows / chunks; row++)
+      fourier_rfft_execute(plan->rows,
+                           data + (gsize)(row / plan->height) * plan->dist + (gsize)(row % plan->height) * plan->stride,
+                           work);
+    g_free(work);
+  }
+}
+
+/* Transform the data of the plan, or data of the same layout */
+static void fourier_plan_execute_on(const FourierPlan *plan, fourier_real *data)
+{
+  gint i;
+
+#ifndef FOURIER_WITHOUT_FFTW
+  if (plan->fftw)
+  {
+    if (!plan->width)
+      FFTW(execute_dft)(plan->fftw, (FFTW(complex) *)data, (FFTW(complex) *)data);
+    else if (!plan->inverse)
+      FFTW(execute_dft_r2c)(plan->fftw, data, (FFTW(complex) *)data);
+    else
+      FFTW(execute_dft_c2r)(plan->fftw, (FFTW(complex) *)data, data);
+    return;
+  }
+#endif
+
+  if (!plan->width)
+    fourier_builtin_columns(plan, (fourier_complex *)data, plan->howmany, plan->howmany);
+  else if (!plan->inverse)
+  {
+    fourier_builtin_rows(plan, data);
+    for (i = 0; plan->columns && i < plan->howmany; i++)
+      fourier_builtin_columns(plan, (fourier_complex *)(data + (gsize)i * plan->dist),
+                              plan->width / 2 + 1, plan->stride / 2);
+  }
+  else
+  {
+    for (i = 0; plan->columns && i < plan->howmany; i++)
+      fourier_builtin_columns(plan, (fourier_complex *)(data + (gsize)i * plan->dist),
+                              plan->width / 2 + 1, plan->stride / 2);
+    fourier_builtin_rows(plan, data);
+  }
+}
+
+static void fourier_plan_execute(const FourierPlan *plan)
+{
+#ifndef FOURIER_WITHOUT_FFTW
+  if (plan->fftw)
+  {
+    FFTW(execute)(plan->fftw);
+    return;
+  }
+#endif
+  fourier_plan_execute_on(plan, plan->data);
+}
+
+/*
+ * Auto backend: the faster of two plans of the same data, best of two runs
+ * each, on zeros as the data is about to be filled. The other one is freed.
+ */
+static FourierPlan *fourier_plan_fastest(FourierPlan *fftw_plan, FourierPlan *builtin_plan, gsize count)
+{
+  FourierPlan *plans[2] = { fftw_plan, builtin_plan };
+  gint64 times[2] = { G_MAXINT64, G_MAXINT64 }, start;
+  gint run, i, fastest;
+
+  FOURIER_TRACE_BEGIN("backend");
+  for (run = 0; run < 2; run++)
+    for (i = 0; i < 2; i++)
+    {
+      memset(plans[i]->data, 0, count * sizeof(fourier_real));
+      start = g_get_monotonic_time();
+      fourier_plan_execute(plans[i]);
+      times[i] = MIN(times[i], g_get_monotonic_time() - start);
+    }
+  fastest = (times[1] < times[0]) ? 1 : 0;
+  fourier_plan_free(plans[1 - fastest]);
+  FOURIER_TRACE_END();
+  return plans[fastest];
+}
+
+/*
+ * All channels are transformed by one batched plan: each channel is stored
+ * in its own padded plane of (sel_width + padding) * sel_height values,
+ * planes are contiguous in fft_real, which may be more than G_MAXINT values
+ * apart.
+ * Planning with a rigor other than estimate, or with the auto backend,
+ * overwrites fft_real.
+ */
+static FourierPlan *fourier_plan_batch(gboolean inverse, fourier_real *fft_real,
+                                       gint sel_width, gint sel_height, gint planes, gint threads)
+{
+  gint padding = (sel_width & 1) ? 1 : 2;
+  gsize plane_size = (gsize)(sel_width + padding) * sel_height;
+  gint backend = fourier_backend_get();
+  FourierPlan *plans[2] = { NULL, NULL };
+  gchar *key = NULL;
+
+  fourier_plan_begin(threads);
+  // Without FFTW, auto has no choice
+  if (fvals.backend == BACKEND_AUTO && backend == BACKEND_FFTW)
+  {
+    key = g_strdup_printf("%s-%dx%dx%d-%d", inverse ? "inverse" : "forward",
+                          sel_width, sel_height, planes, threads);
+    backend = fourier_backends_lookup(key);
+  }
+  if (backend != BACKEND_BUILTIN)
+    plans[BACKEND_FFTW] = fourier_plan_real(BACKEND_FFTW, inverse, fft_real, sel_width, sel_height, planes,
+                                            sel_width + padding, plane_size, threads, FALSE);
+  if (backend != BACKEND_FFTW)
+    plans[BACKEND_BUILTIN] = fourier_plan_real(BACKEND_BUILTIN, inverse, fft_real, sel_width, sel_height, planes,
+                                               sel_width + padding, plane_size, threads, FALSE);
+  fourier_plan_end();
+
+  if (backend < 0)
+  {
+    // First transform of this size: the faster backend is kept for the next ones
+    plans[0] = fourier_plan_fastest(plans[BACKEND_FFTW], plans[BACKEND_BUILTIN], plane_size * planes);
+    fourier_backends_store(key, plans[0]->backend);
+  }
+  g_free(key);
+  return plans[0] ? plans[0] : plans[1];
+}
+
+/** FFT scratch **************************************************************/
+
+static gsize fourier_memory_limit(void)
+{
+  return (gsize)fvals.memory_limit * 1024 * 1024;
+}
+
+#ifdef FOURIER_HAVE_MMAP
+/* The scratch is mapped after offset bytes of the file fd, which is resized */
+static gboolean fourier_scratch_map(FourierScratch *scratch, gint fd, gsize offset, gsize bytes)
+{
+  void *data = MAP_FAILED;
+
+  if (ftruncate(fd, offset + bytes) == 0)
+    data = mmap(NULL, offset + bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    g_warning("Cannot map FFT scratch file of %" G_GSIZE_FORMAT " bytes", offset + bytes);
+    return FALSE;
+  }
+  scratch->mapped = data;
+  scratch->mapped_size = offset + bytes;
+  scratch->fft_real = (fourier_real *)((guchar *)data + offset);
+  return TRUE;
+}
+
+/* The temporary file is unlinked at once, it only lives as long as the mapping */
+static gboolean fourier_scratch_map_temporary(FourierScratch *scratch, gsize bytes)
+{
+  gchar *filename = NULL;
+  GError *error = NULL;
+  gboolean mapped;
+  gint fd;
+
+  fd = g_file_open_tmp("fourier-XXXXXX", &filename, &error);
+  if (fd < 0)
+  {
+    g_warning("Cannot create FFT scratch file: %s", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+  unlink(filename);
+  g_free(filename);
+
+  mapped = fourier_scratch_map(scratch, fd, 0, bytes);
+  close(fd);
+  return mapped;
+}
+#endif
+
+/*
+ * Drop count values from offset out of memory, once processed. They are
+ * written back to the file and read again when next touched.
+ */
+void fourier_scratch_release(FourierScratch *scratch, gsize offset, gsize count)
+{
+#ifdef FOURIER_HAVE_MMAP
+  guintptr page = sysconf(_SC_PAGESIZE);
+  guintptr start = (guintptr)(scratch->fft_real + offset);
+  guintptr end = start + count * sizeof(fourier_real);
+
+  if (!scratch->mapped)
+    return;
+  start = (start + page - 1) / page * page;
+  end = end / page * page;
+  if (end > start)
+    madvise((void *)start, end - start, MADV_DONTNEED);
+#endif
+}
+
+/*
+ * Passes of the separable transform are planned once per scratch: rows are
+ * transformed in place by blocks of block_rows (across all planes), columns
+ * by strips of strip_columns complex values copied to a contiguous buffer.
+ */
+static FourierPlan *fourier_plan_rows(FourierScratch *scratch, gint rows)
+{
+  fourier_real *buffer;
+  FourierPlan *p;
+
+  // Planned on a buffer of its own as the mapped rows may not be aligned
+  buffer = fourier_alloc_real((gsize)scratch->stride * rows);
+  p = fourier_plan_real(fourier_backend_get(), scratch->inverse, buffer, scratch->width, 1, rows,
+                        scratch->stride, scratch->stride, fourier_get_threads(scratch->width, scratch->height),
+                        TRUE);
+  fourier_free(buffer);
+  p->data = NULL;
+  return p;
+}
+
+static void fourier_scratch_plan_separable(FourierScratch *scratch)
+{
+  // Each pass keeps a quarter of the memory limit in use
+  gsize budget = MAX(fourier_memory_limit() / 4, 1 << 20);
+  gint rows = scratch->height * scratch->planes;
+  gint half = scratch->stride / 2;
+  gint threads = fourier_get_threads(scratch->width, scratch->height);
+
+  // A round trip scratch plans its second direction on the same strip
+  if (!scratch->strip)
+  {
+    scratch->block_rows = CLAMP(budget / (scratch->stride * sizeof(fourier_real)), 1, rows);
+    scratch->strip_columns = CLAMP(budget / (scratch->height * sizeof(fourier_complex)), 1, half);
+    scratch->strip = fourier_alloc_complex((gsize)scratch->height * scratch->strip_columns);
+    FOURIER_TRACE_MEMORY((gsize)scratch->height * scratch->strip_columns * sizeof(fourier_complex));
+  }
+
+  fourier_plan_begin(threads);
+  scratch->rows_plan = fourier_plan_rows(scratch, scratch->block_rows);
+  if (rows % scratch->block_rows)
+    scratch->last_rows_plan = fourier_plan_rows(scratch, rows % scratch->block_rows);
+  scratch->columns_plan = fourier_plan_columns(fourier_backend_get(), scratch->inverse, scratch->strip,
+                                               scratch->height, scratch->strip_columns, threads);
+  fourier_plan_end();
+}
+
+/* Plans of the scratch direction, separable when mapped above the memory limit */
+static void fourier_scratch_plan(FourierScratch *scratch)
+{
+  gsize bytes = scratch->plane_size * scratch->planes * sizeof(fourier_real);
+
+  if (scratch->mapped && fvals.memory_limit > 0 && bytes > fourier_memory_limit())
+    fourier_scratch_plan_separable(scratch);
+  else
+    scratch->plan = fourier_plan_batch(scratch->inverse, scratch->fft_real,
+                                       scratch->width, scratch->height, scratch->planes,
+                                       fourier_get_threads(scratch->width, scratch->height));
+}
+
+/* Memory of the planes and column strip, in memory or mapped */
+static gsize fourier_scratch_bytes(FourierScratch *scratch)
+{
+  gsize bytes = scratch->plane_size * scratch->planes * sizeof(fourier_real);
+
+  if (scratch->strip)
+    bytes += (gsize)scratch->height * scratch->strip_columns * sizeof(fourier_complex);
+  return bytes;
+}
+
+gboolean fourier_scratch_in_memory(gint width, gint height, gint planes)
+{
+#ifdef FOURIER_HAVE_MMAP
+  gsize bytes = (gsize)(width + ((width & 1) ? 1 : 2)) * height * planes * sizeof(fourier_real);
+
+  return !(fvals.memory_limit > 0 && bytes > fourier_memory_limit());
+#else
+  return TRUE;
+#endif
+}
+
+/*
+ * Get a scratch for a width * height selection of planes channels. With
+ * fd >= 0, the scratch is mapped on that file after offset bytes, NULL is
+ * returned if it cannot be. Plans are made here, before the scratch is
+ * filled, as planning may overwrite it.
+ */
+FourierScratch *fourier_scratch_new_full(gint width, gint height, gint planes, gboolean inverse,
+                                         gint fd, gsize offset)
+{
+  FourierScratch *scratch = g_new0(FourierScratch, 1);
+  gsize bytes;
+
+  scratch->width = width;
+  scratch->height = height;
+  scratch->image_width = width;
+  scratch->image_height = height;
+  scratch->planes = planes;
+  scratch->stride = width + ((width & 1) ? 1 : 2);
+  scratch->plane_size = (gsize)scratch->stride * height;
+  scratch->inverse = inverse;
+  bytes = scratch->plane_size * planes * sizeof(fourier_real);
+
+#ifdef FOURIER_HAVE_MMAP
+  if (fd >= 0)
+  {
+    if (!fourier_scratch_map(scratch, fd, offset, bytes))
+    {
+      g_free(scratch);
+      return NULL;
+    }
+  }
+  else if (!fourier_scratch_in_memory(width, height, planes))
+    fourier_scratch_map_temporary(scratch, bytes);
+#else
+  if (fd >= 0)
+  {
+    g_free(scratch);
+    return NULL;
+  }
+#endif
+  if (!scratch->fft_real)
+    scratch->fft_real = g_new(fourier_real, scratch->plane_size * planes);
+  FOURIER_TRACE_MEMORY(bytes);
+
+  fourier_scratch_plan(scratch);
+
+  scratch->geo = fourier_geometry_get(width, height);
+  scratch->index = g_new(gint, width);
+  scratch->norm = g_new(double, width);
+  scratch->values = g_new(double, width);
+  scratch->dc = g_new0(double, planes);
+  scratch->changed = g_new0(gint, planes);
+  fourier_kernels_init();
+
+  return scratch;
+}
+
+FourierScratch *fourier_scratch_new(gint width, gint height, gint planes, gboolean inverse)
+{
+  return fourier_scratch_new_full(width, height, planes, inverse, -1, 0);
+}
+
+/*
+ * A round trip scratch is transformed forward then back in place, as a
+ * filter: the plans of both directions are made before it is filled, the
+ * inverse ones are kept aside until fourier_scratch_reverse().
+ */
+FourierScratch *fourier_scratch_new_roundtrip(gint width, gint height, gint planes)
+{
+  FourierScratch *scratch = fourier_scratch_new(width, height, planes, TRUE);
+
+  fourier_scratch_reverse(scratch);
+  fourier_scratch_plan(scratch);
+  return scratch;
+}
+
+/* Swap the plans of a round trip scratch, and its direction */
+void fourier_scratch_reverse(FourierScratch *scratch)
+{
+  FourierPlan **plans[4] = { &scratch->plan, &scratch->rows_plan,
+                             &scratch->last_rows_plan, &scratch->columns_plan };
+  FourierPlan *plan;
+  gint i;
+
+  for (i = 0; i < 4; i++)
+  {
+    plan = *plans[i];
+    *plans[i] = scratch->reverse_plans[i];
+    scratch->reverse_plans[i] = plan;
+  }
+  scratch->inverse = !scratch->inverse;
+}
+
+/*
+ * The pixels of a padded scratch are an image_width * image_height selection
+ * at its top left, extended to the scratch size by fourier_scratch_extend().
+ * The spectrum keeps the scratch size.
+ */
+void fourier_scratch_set_image(FourierScratch *scratch, gint image_width, gint image_height,
+                               gint extension)
+{
+  scratch->image_width = CLAMP(image_width, 1, scratch->width);
+  scratch->image_height = CLAMP(image_height, 1, scratch->height);
+  scratch->extension = extension;
+}
+
+/*
+ * Forget the record and the values kept from the previous selection, so that
+ * the scratch, with its plans, is used again for another one of its size.
+ */
+void fourier_scratch_reset(FourierScratch *scratch)
+{
+  // A round trip starts forward again
+  if (scratch->inverse && (scratch->reverse_plans[0] || scratch->reverse_plans[1]))
+    fourier_scratch_reverse(scratch);
+  scratch->record = NULL;
+  scratch->recorded = NULL;
+  memset(scratch->dc, 0, sizeof(double) * scratch->planes);
+  memset(scratch->changed, 0, sizeof(gint) * scratch->planes);
+}
+
+void fourier_scratch_free(FourierScratch *scratch)
+{
+  gint i;
+
+  FOURIER_TRACE_MEMORY(-(gssize)fourier_scratch_bytes(scratch));
+  fourier_plan_free(scratch->plan);
+  fourier_plan_free(scratch->rows_plan);
+  fourier_plan_free(scratch->last_rows_plan);
+  fourier_plan_free(scratch->columns_plan);
+  for (i = 0; i < 4; i++)
+    fourier_plan_free(scratch->reverse_plans[i]);
+  if (scratch->strip)
+    fourier_free(scratch->strip);
+#ifdef FOURIER_HAVE_MMAP
+  if (scratch->mapped)
+    munmap(scratch->mapped, scratch->mapped_size);
+  else
+#endif
+    g_free(scratch->fft_real);
+  fourier_geometry_unref(scratch->geo);
+  g_free(scratch->index);
+  g_free(scratch->norm);
+  g_free(scratch->values);
+  g_free(scratch->dc);
+  g_free(scratch->changed);
+  g_free(scratch);
+}
+
+gint fourier_pixels_colors(gint bpp)
+{
+  return (bpp == 2 || bpp == 4) ? bpp - 1 : bpp;
+}
+
+gboolean fourier_pixels_gray(const guchar *pixels, gsize count, gint bpp, gint colors)
+{
+  gsize i;
+  gint channel;
+
+  for (i = 0; i < count; i++, pixels += bpp)
+    for (channel = 1; channel < colors; channel++)
+      if (pixels[channel] != pixels[0])
+        return FALSE;
+  return TRUE;
+}
+
+gint fourier_pixels_planes(const guchar *pixels, gsize count, gint bpp)
+{
+  gint colors = fourier_pixels_colors(bpp);
+  gboolean gray;
+
+  if (colors == 1)
+    return colors;
+  FOURIER_TRACE_BEGIN("gray_check");
+  gray = fourier_pixels_gray(pixels, count, bpp, colors);
+  FOURIER_TRACE_END();
+  return gray ? 1 : colors;
+}
+
+void fourier_pixels_replicate(guchar *pixels, gsize count, gint bpp, gint planes, gint colors)
+{
+  gsize i;
+  gint channel;
+
+  if (planes >= colors)
+    return;
+  for (i = 0; i < count; i++, pixels += bpp)
+    for (channel = planes; channel < colors; channel++)
+      pixels[channel] = pixels[0];
+}
+
+/* Channels of dst_pixels the planes were not stored to, alpha from src_pixels */
+static void fourier_pixels_complete(const guchar *src_pixels, guchar *dst_pixels, gsize count,
+                                    gint bpp, gint planes)
+{
+  gint colors = fourier_pixels_colors(bpp);
+  gsize i;
+  gint channel;
+
+  if (planes >= bpp)
+    return;
+  fourier_pixels_replicate(dst_pixels, count, bpp, planes, colors);
+  for (i = 0; i < count; i++, src_pixels += bpp, dst_pixels += bpp)
+    for (channel = MAX(planes, colors); channel < bpp; channel++)
+      dst_pixels[channel] = src_pixels[channel];
+}
+
+gboolean fourier_scratch_process(FourierScratch *scratch, const guchar *src_pixels,
+                                 guchar *dst_pixels, gint bpp)
+{
+  if (!scratch->inverse)
+  {
+    FOURIER_TRACE_BEGIN("deinterleave");
+    fourier_scratch_load_pixels(scratch, 0, 0, scratch->image_width, scratch->image_height,
+                                src_pixels, scratch->image_width * bpp, bpp);
+    FOURIER_TRACE_END();
+    FOURIER_TRACE_BEGIN("execute");
+    fourier_scratch_execute(scratch);
+    FOURIER_TRACE_END();
+    if (fourier_cancelled())
+      return FALSE;
+    FOURIER_TRACE_BEGIN("quantize");
+    fourier_scratch_store_spectrum(scratch, 0, 0, scratch->width, scratch->height,
+                                   dst_pixels, scratch->width * bpp, bpp);
+    fourier_pixels_complete(src_pixels, dst_pixels, (gsize)scratch->width * scratch->height,
+                            bpp, scratch->planes);
+    FOURIER_TRACE_END();
+  }
+  else
+  {
+    FOURIER_TRACE_BEGIN("unquantize");
+    fourier_scratch_load_spectrum(scratch, 0, 0, scratch->width, scratch->height,
+                                  src_pixels, scratch->width * bpp, bpp);
+    fourier_scratch_restore_redundancy(scratch);
+    FOURIER_TRACE_END();
+    FOURIER_TRACE_BEGIN("execute");
+    fourier_scratch_execute(scratch);
+    FOURIER_TRACE_END();
+    if (fourier_cancelled())
+      return FALSE;
+    FOURIER_TRACE_BEGIN("interleave");
+    fourier_scratch_store_pixels(scratch, 0, 0, scratch->image_width, scratch->image_height,
+                                 dst_pixels, scratch->image_width * bpp, bpp);
+    fourier_pixels_complete(src_pixels, dst_pixels, (gsize)scratch->image_width * scratch->image_height,
+                            bpp, scratch->planes);
+    FOURIER_TRACE_END();
+  }
+  return TRUE;
+}
+
+/* Forward input: rectangle (x, y, width, height) of the selection */
+void fourier_scratch_load_pixels(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                 const guchar *pixels, gint rowstride, gint bpp)
+{
+  if (scratch->luma)
+  {
+    fourier_deinterleave_luma(pixels, rowstride, bpp, x, y, width, height,
+                              scratch->fft_real, scratch->stride);
+    return;
+  }
+  fourier_deinterleave(pixels, rowstride, bpp, scratch->planes,
+                       x, y, width, height,
+                       scratch->fft_real, scratch->stride, scratch->plane_size);
+}
+
+/*
+ * Inverse output of a luma scratch: its luma, the change of luma when
+ * recorded, is added to each of the three channels of the recorded pixels,
+ * which keeps their Cb and Cr as they were.
+ */
+static void fourier_scratch_store_luma(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                       guchar *pixels, gint rowstride, gint bpp)
+{
+  double values[FOURIER_BLOCK_COLS];
+  gint cur_row, block, block_cols, col, channel;
+  const fourier_real *src;
+  const guchar *rec;
+
+  for (cur_row = 0; cur_row < height; cur_row++)
+  {
+    src = scratch->fft_real + (gsize)(y + cur_row) * scratch->stride + x;
+    rec = scratch->recorded ? scratch->recorded + ((gsize)(y + cur_row) * scratch->image_width + x) * bpp : NULL;
+    for (block = 0; block < width; block += FOURIER_BLOCK_COLS)
+    {
+      block_cols = MIN(FOURIER_BLOCK_COLS, width - block);
+      for (channel = 0; channel < 3; channel++)
+      {
+        for (col = 0; col < block_cols; col++)
+          values[col] = src[block + col] + (rec ? rec[(gsize)(block + col) * bpp + channel] : 0);
+        fourier_quantize_pixels(values, pixels + (gsize)cur_row * rowstride + block * bpp + channel,
+                                block_cols, bpp);
+      }
+    }
+  }
+}
+
+/* Inverse output: rectangle (x, y, width, height) of the selection */
+void fourier_scratch_store_pixels(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                  guchar *pixels, gint rowstride, gint bpp)
+{
+  if (scratch->luma)
+  {
+    fourier_scratch_store_luma(scratch, x, y, width, height, pixels, rowstride, bpp);
+    return;
+  }
+  fourier_interleave(scratch->fft_real, scratch->stride, scratch->plane_size,
+                     x, y, width, height,
+                     pixels, rowstride, bpp, scratch->planes);
+}
+
+/*
+ * Inverse output of a record: add the recorded pixels to the transformed
+ * delta. Luma scratches add them per channel in fourier_scratch_store_pixels().
+ */
+void fourier_scratch_add_recorded(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                  gint bpp)
+{
+  gint cur_row, col, cur_bpp;
+  fourier_real *dst;
+  const guchar *src;
+
+  if (scratch->luma)
+    return;
+
+  for (cur_row = y; cur_row < y + height; cur_row++)
+    for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+    {
+      dst = scratch->fft_real + cur_bpp * scratch->plane_size + (gsize)cur_row * scratch->stride + x;
+      src = scratch->recorded + ((gsize)cur_row * scratch->image_width + x) * bpp + cur_bpp;
+      for (col = 0; col < width; col++)
+        dst[col] += src[col * bpp];
+    }
+}
+
+/* Forward output: rectangle (x, y, width, height) of the spectrum image */
+void fourier_scratch_store_spectrum(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                    guchar *pixels, gint rowstride, gint bpp)
+{
+  double size = (double)scratch->width * scratch->height;
+  gint cur_row, col, cur_bpp, bounded;
+  fourier_real *plane;
+  guchar *dst;
+
+  for (cur_row = 0; cur_row < height; cur_row++)
+  {
+    fourier_geometry_row(scratch->geo, y + cur_row, x, width, scratch->index, scratch->norm);
+    for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+    {
+      plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+      dst = pixels + (gsize)cur_row * rowstride + cur_bpp;
+      for (col = 0; col < width; col++)
+        scratch->values[col] = (plane[scratch->index[col]] / size) * scratch->norm[col];
+      fourier_quantize_spectrum(scratch->values, dst, width, bpp);
+    }
+  }
+
+  cur_row = scratch->height / 2;
+  col = scratch->width / 2;
+  if (cur_row < y || cur_row >= y + height || col < x || col >= x + width)
+    return;
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+  {
+    // do not boost (0, 0), just offset it
+    plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+    bounded = round_gint((plane[0] / size) - 128.0);
+    pixels[(gsize)(cur_row - y) * rowstride + (col - x) * bpp + cur_bpp] = get_gchar128(col, cur_row, bounded);
+  }
+}
+
+/*
+ * Inverse input: rectangle (x, y, width, height) of the spectrum image. Once
+ * the whole image is loaded, fourier_scratch_restore_redundancy() must be
+ * called.
+ */
+void fourier_scratch_load_spectrum(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                   const guchar *pixels, gint rowstride, gint bpp)
+{
+  gint cur_row, col, cur_bpp;
+  fourier_real *plane;
+  const guchar *src;
+
+  for (cur_row = 0; cur_row < height; cur_row++)
+  {
+    fourier_geometry_row(scratch->geo, y + cur_row, x, width, scratch->index, scratch->norm);
+    for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+    {
+      plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+      src = pixels + (gsize)cur_row * rowstride + cur_bpp;
+      for (col = 0; col < width; col++)
+        plane[scratch->index[col]] = fourier_unboost_table[src[col * bpp]] / scratch->norm[col];
+    }
+  }
+
+  cur_row = scratch->height / 2;
+  col = scratch->width / 2;
+  if (cur_row < y || cur_row >= y + height || col < x || col >= x + width)
+    return;
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+  {
+    // do not unboost (0, 0), just offset it
+    scratch->dc[cur_bpp] = get_double128(cur_row, col,
+                                         pixels[(gsize)(cur_row - y) * rowstride + (col - x) * bpp + cur_bpp]) + 128.0;
+  }
+}
+
+/*
+ * Inverse input of a record: the difference between the rectangle
+ * (x, y, width, height) of the spectrum image and of the recorded one.
+ * Changed pixels are counted.
+ */
+void fourier_scratch_load_delta(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                const guchar *pixels, gint rowstride, gint bpp)
+{
+  const guchar *recorded = scratch->recorded + (gsize)scratch->image_width * scratch->image_height * bpp;
+  gint cur_row, col, cur_bpp, changed;
+  fourier_real *plane;
+  const guchar *src, *rec;
+
+  for (cur_row = 0; cur_row < height; cur_row++)
+  {
+    fourier_geometry_row(scratch->geo, y + cur_row, x, width, scratch->index, scratch->norm);
+    for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+    {
+      plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+      src = pixels + (gsize)cur_row * rowstride + cur_bpp;
+      rec = recorded + ((gsize)(y + cur_row) * scratch->width + x) * bpp + cur_bpp;
+      changed = 0;
+      for (col = 0; col < width; col++)
+      {
+        changed += (src[col * bpp] != rec[col * bpp]);
+        plane[scratch->index[col]] = (fourier_unboost_table[src[col * bpp]] -
+                                      fourier_unboost_table[rec[col * bpp]]) / scratch->norm[col];
+      }
+      scratch->changed[cur_bpp] += changed;
+    }
+  }
+
+  cur_row = scratch->height / 2;
+  col = scratch->width / 2;
+  if (cur_row < y || cur_row >= y + height || col < x || col >= x + width)
+    return;
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+    scratch->dc[cur_bpp] = (double)pixels[(gsize)(cur_row - y) * rowstride + (col - x) * bpp + cur_bpp] -
+                           (double)recorded[((gsize)cur_row * scratch->width + col) * bpp + cur_bpp];
+}
+
+void fourier_scratch_restore_redundancy(FourierScratch *scratch)
+{
+  gint sel_width = scratch->width;
+  gint sel_height = scratch->height;
+  gint stride = scratch->stride;
+  gint row2, col2, cur_bpp;
+  fourier_real *plane;
+
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+  {
+    plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+    // restore redundancy
+    for (col2 = 0; col2 < stride; col2 += (sel_width + 1) / 2 * 2)
+    {
+      for (row2 = 1; row2 < (sel_height + 1) / 2; row2++)
+      {
+        plane[(gsize)(sel_height - row2) * stride + col2 + 1] = -plane[(gsize)row2 * stride + col2 + 1];
+        plane[(gsize)row2 * stride + col2] = plane[(gsize)(sel_height - row2) * stride + col2];
+      }
+      plane[col2 + 1] = 0;
+      if (sel_height % 2 == 0)
+        plane[(gsize)sel_height / 2 * stride + col2 + 1] = 0;
+    }
+    plane[0] = scratch->dc[cur_bpp];
+    fourier_scratch_release(scratch, cur_bpp * scratch->plane_size, scratch->plane_size);
+  }
+}
+
+/* Source of pixel i of a padded line of n pixels */
+static gint fourier_extend_index(gint i, gint n, gint extension)
+{
+  gint period = 2 * (n - 1);
+
+  if (extension != PADDING_MIRROR || n == 1)
+    return MIN(i, n - 1);
+  // Mirrored without repeating the edge pixel, folded again if needed
+  i %= period;
+  return (i < n) ? i : period - i;
+}
+
+/* Once the pixels are loaded, fill the padding of the scratch from them */
+void fourier_scratch_extend(FourierScratch *scratch)
+{
+  gint row, col, cur_bpp;
+  fourier_real *plane, *dst;
+
+  if (scratch->image_width == scratch->width && scratch->image_height == scratch->height)
+    return;
+
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+  {
+    plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+    for (row = 0; row < scratch->image_height; row++)
+    {
+      dst = plane + (gsize)row * scratch->stride;
+      for (col = scratch->image_width; col < scratch->width; col++)
+        dst[col] = dst[fourier_extend_index(col, scratch->image_width, scratch->extension)];
+    }
+    for (row = scratch->image_height; row < scratch->height; row++)
+      memcpy(plane + (gsize)row * scratch->stride,
+             plane + (gsize)fourier_extend_index(row, scratch->image_height, scratch->extension) * scratch->stride,
+             scratch->width * sizeof(fourier_real));
+    fourier_scratch_release(scratch, cur_bpp * scratch->plane_size, scratch->plane_size);
+  }
+}
+
+/*
+ * Progress of the separable transform, pass 0 or 1 done to fraction, within
+ * the third of the transform taken by the execute phase.
+ */
+static void fourier_scratch_pass_progress(gint pass, gdouble fraction)
+{
+  fourier_progress_update((1.0 + (pass + fraction) / 2) / 3);
+}
+
+static void fourier_scratch_rows_pass(FourierScratch *scratch, gint pass)
+{
+  gint rows = scratch->height * scratch->planes;
+  gint row;
+  FourierPlan *p;
+
+  for (row = 0; row < rows && !fourier_cancelled(); row += scratch->block_rows)
+  {
+    p = (row + scratch->block_rows <= rows) ? scratch->rows_plan : scratch->last_rows_plan;
+    fourier_plan_execute_on(p, scratch->fft_real + (gsize)row * scratch->stride);
+    fourier_scratch_release(scratch, (gsize)row * scratch->stride,
+                            (gsize)MIN(scratch->block_rows, rows - row) * scratch->stride);
+    fourier_scratch_pass_progress(pass, (double)MIN(row + scratch->block_rows, rows) / rows);
+  }
+}
+
+static void fourier_scratch_columns_pass(FourierScratch *scratch, gint pass)
+{
+  gint half = scratch->stride / 2;
+  gint cur_bpp, row, col, columns;
+  fourier_complex *plane;
+
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+  {
+    plane = (fourier_complex *)(scratch->fft_real + cur_bpp * scratch->plane_size);
+    for (col = 0; col < half && !fourier_cancelled(); col += scratch->strip_columns)
+    {
+      // The last strip may be narrower, the end of the buffer is then left unused
+      columns = MIN(scratch->strip_columns, half - col);
+      for (row = 0; row < scratch->height; row++)
+        memcpy(scratch->strip + (gsize)row * scratch->strip_columns, plane + (gsize)row * half + col,
+               columns * sizeof(fourier_complex));
+      fourier_plan_execute(scratch->columns_plan);
+      for (row = 0; row < scratch->height; row++)
+        memcpy(plane + (gsize)row * half + col, scratch->strip + (gsize)row * scratch->strip_columns,
+               columns * sizeof(fourier_complex));
+      fourier_scratch_release(scratch, cur_bpp * scratch->plane_size, scratch->plane_size);
+      fourier_scratch_pass_progress(pass, (cur_bpp + (double)(col + columns) / half) / scratch->planes);
+    }
+  }
+}
+
+/*
+ * Inverse transform of a spectrum with a few non zero values only, as the sum
+ * of their waves. c2r gives the real part of the full hermitian spectrum, so
+ * values but those of the first and last columns stand for two waves.
+ */
+static void fourier_scratch_synthesize(FourierScratch *scratch)
+{
+  gint half = scratch->stride / 2;
+  GArray *positions = g_array_new(FALSE, FALSE, sizeof(gsize));
+  GArray *values = g_array_new(FALSE, FALSE, sizeof(double) * 2);
+  double *wave_x = g_new(double, 2 * scratch->width);
+  double *wave_y = g_new(double, 2 * scratch->height);
+  gint cur_bpp, k, l, n, row;
+  guint i;
+  gsize pos;
+  double weight, value[2];
+  fourier_real *plane;
+
+  for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+  {
+    plane = scratch->fft_real + cur_bpp * scratch->plane_size;
+    g_array_set_size(positions, 0);
+    g_array_set_size(values, 0);
+    for (pos = 0; pos < scratch->plane_size / 2; pos++)
+      if (plane[2 * pos] != 0 || plane[2 * pos + 1] != 0)
+      {
+        value[0] = plane[2 * pos];
+        value[1] = plane[2 * pos + 1];
+        g_array_append_val(positions, pos);
+        g_array_append_val(values, value);
+      }
+    memset(plane, 0, scratch->plane_size * sizeof(fourier_real));
+
+    for (i = 0; i < positions->len && !fourier_cancelled(); i++)
+    {
+      pos = g_array_index(positions, gsize, i);
+      memcpy(value, values->data + i * sizeof(value), sizeof(value));
+      k = pos / half;
+      l = pos % half;
+      weight = (l == 0 || 2 * l == scratch->width) ? 1.0 : 2.0;
+      for (n = 0; n < scratch->width; n++)
+      {
+        wave_x[2 * n] = cos(2 * G_PI * (((gint64)l * n) % scratch->width) / scratch->width);
+        wave_x[2 * n + 1] = sin(2 * G_PI * (((gint64)l * n) % scratch->width) / scratch->width);
+      }
+      for (n = 0; n < scratch->height; n++)
+      {
+        wave_y[2 * n] = cos(2 * G_PI * (((gint64)k * n) % scratch->height) / scratch->height);
+        wave_y[2 * n + 1] = sin(2 * G_PI * (((gint64)k * n) % scratch->height) / scratch->height);
+      }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      // Only the pixels of the image are stored, not those of the padding
+      for (row = 0; row < scratch->image_height; row++)
+      {
+        fourier_real *dst = plane + (gsize)row * scratch->stride;
+        double re = weight * (value[0] * wave_y[2 * row] - value[1] * wave_y[2 * row + 1]);
+        double im = weight * (value[0] * wave_y[2 * row + 1] + value[1] * wave_y[2 * row]);
+        gint col;
+
+        for (col = 0; col < scratch->image_width; col++)
+          dst[col] += re * wave_x[2 * col] - im * wave_x[2 * col + 1];
+      }
+    }
+    fourier_scratch_release(scratch, cur_bpp * scratch->plane_size, scratch->plane_size);
+  }
+
+  g_array_free(positions, TRUE);
+  g_array_free(values, TRUE);
+  g_free(wave_x);
+  g_free(wave_y);
+}
+
+void fourier_scratch_execute(FourierScratch *scratch)
+{
+  gint cur_bpp, changed = 0;
+
+  if (scratch->recorded)
+  {
+    // Each wave costs about as much as a pass of the FFT over the selection
+    for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+      changed = MAX(changed, scratch->changed[cur_bpp]);
+    if (2 * changed < log2((double)scratch->width * scratch->height))
+    {
+      fourier_scratch_synthesize(scratch);
+      return;
+    }
+  }
+
+  if (scratch->plan)
+    fourier_plan_execute(scratch->plan);
+  else if (!scratch->inverse)
+  {
+    fourier_scratch_rows_pass(scratch, 0);
+    fourier_scratch_columns_pass(scratch, 1);
+  }
+  else
+  {
+    fourier_scratch_columns_pass(scratch, 0);
+    fourier_scratch_rows_pass(scratch, 1);
+  }
+}
+
+/** Filters ******************************************************************/
+
+/* Low-pass response at distance d from the center, for a cutoff distance */
+static double fourier_filter_low(const FourierFilter *filter, double d, double cutoff)
+{
+  if (cutoff <= 0)
+    return d <= 0;
+  switch (filter->shape)
+  {
+  case FILTER_BUTTERWORTH:
+    return 1.0 / (1.0 + pow(d / cutoff, 2 * MAX(filter->order, 1)));
+  case FILTER_GAUSSIAN:
+    return exp(-d * d / (2 * cutoff * cutoff));
+  default:
+    return d <= cutoff;
+  }
+}
+
+/* Distance in pixels of the spectrum image between two frequencies */
+static double fourier_filter_distance(double fx, double fy, double notch_fx, double notch_fy,
+                                      gint width, gint height)
+{
+  double dx = fx - notch_fx, dy = fy - notch_fy;
+
+  // frequencies wrap around
+  dx = (dx - floor(dx + 0.5)) * width;
+  dy = (dy - floor(dy + 0.5)) * height;
+  return sqrt(dx * dx + dy * dy);
+}
+
+/*
+ * Response of the filter at the frequency (fx, fy), in cycles per pixel.
+ * Pass bands are round in cycles per pixel, notches in pixels of the
+ * spectrum image of the width * height selection. The mean is always kept.
+ */
+static double fourier_filter_response(const FourierFilter *filter, double fx, double fy,
+                                      gint width, gint height)
+{
+  double r = 2 * sqrt(fx * fx + fy * fy), response = 1.0;
+  double notch_fx, notch_fy;
+  gint i;
+
+  if (fx == 0 && fy == 0)
+    return 1.0;
+
+  switch (filter->type)
+  {
+  case FILTER_LOW_PASS:
+    response = fourier_filter_low(filter, r, filter->cutoff);
+    break;
+  case FILTER_HIGH_PASS:
+    response = 1.0 - fourier_filter_low(filter, r, filter->cutoff);
+    break;
+  case FILTER_BAND_PASS:
+    response = fourier_filter_low(filter, r, filter->cutoff_high) *
+               (1.0 - fourier_filter_low(filter, r, filter->cutoff));
+    break;
+  }
+
+  // A notch also rejects its symmetric, the other half of a real wave
+  for (i = 0; i < filter->notches && response != 0; i++)
+  {
+    notch_fx = (filter->notch_xy[2 * i] - width / 2) / width;
+    notch_fy = (filter->notch_xy[2 * i + 1] - height / 2) / height;
+    response *= 1.0 - fourier_filter_low(filter,
+                                         fourier_filter_distance(fx, fy, notch_fx, notch_fy, width, height),
+                                         filter->notch_radius);
+    response *= 1.0 - fourier_filter_low(filter,
+                                         fourier_filter_distance(fx, fy, -notch_fx, -notch_fy, width, height),
+                                         filter->notch_radius);
+  }
+  return response;
+}
+
+/*
+ * Multiply the spectrum of a forward transformed scratch by the filter, and
+ * by 1 / size, so that the inverse transform gives back pixels.
+ */
+void fourier_scratch_filter(FourierScratch *scratch, const FourierFilter *filter)
+{
+  gint half = scratch->stride / 2;
+  double size = (double)scratch->width * scratch->height;
+  double *gain = scratch->values;
+  gint row, col, cur_bpp;
+  fourier_real *line;
+
+  for (row = 0; row < scratch->height && !fourier_cancelled(); row++)
+  {
+    for (col = 0; col < half; col++)
+      gain[col] = fourier_filter_response(filter, (double)col / scratch->width,
+                                          (double)(row <= scratch->height / 2 ? row : row - scratch->height) /
+                                          scratch->height,
+                                          scratch->image_width, scratch->image_height) / size;
+    for (cur_bpp = 0; cur_bpp < scratch->planes; cur_bpp++)
+    {
+      line = scratch->fft_real + cur_bpp * scratch->plane_size + (gsize)row * scratch->stride;
+      for (col = 0; col < half; col++)
+      {
+        line[2 * col] *= gain[col];
+        line[2 * col + 1] *= gain[col];
+      }
+    }
+    fourier_scratch_release(scratch, 0, scratch->plane_size * scratch->planes);
+  }
+}
+
+/* Forward transform, filter and inverse transform of a round trip scratch */
+void fourier_scratch_execute_filter(FourierScratch *scratch, const FourierFilter *filter)
+{
+  fourier_scratch_execute(scratch);
+  if (fourier_cancelled())
+    return;
+  FOURIER_TRACE_BEGIN("filter");
+  fourier_scratch_filter(scratch, filter);
+  FOURIER_TRACE_END();
+  fourier_scratch_reverse(scratch);
+  if (!fourier_cancelled())
+    fourier_scratch_execute(scratch);
+}
+
+/** Padding ******************************************************************/
+
+/* Sizes with no prime factor above 7 take FFTW's fast codelets */
+static gboolean fourier_is_smooth(gint n)
+{
+  static const gint primes[] = { 2, 3, 5, 7 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(primes); i++)
+    while (n % primes[i] == 0)
+      n /= primes[i];
+  return n == 1;
+}
+
+/* Sizes tried for n pixels: n, then the first smooth sizes above it */
+#define FOURIER_PADDING_CANDIDATES 4
+
+static gint fourier_padding_candidates(gint n, gint *sizes)
+{
+  gint count = 1, m;
+
+  sizes[0] = n;
+  for (m = n + 1; m <= 2 * n && count < FOURIER_PADDING_CANDIDATES; m++)
+    if (fourier_is_smooth(m))
+      sizes[count++] = m;
+  return count;
+}
+
+/*
+ * FFTW estimates of a row (real) and a column (complex) transform of n
+ * values, the 2D transform costs height rows and width / 2 + 1 columns.
+ * The built-in backend has a cost model of its own.
+ */
+static void fourier_padding_costs(gint n, double *row_cost, double *column_cost)
+{
+#ifndef FOURIER_WITHOUT_FFTW
+  fourier_real *real;
+  FFTW(complex) *complex;
+  FFTW(plan) p;
+#endif
+
+  if (fourier_backend_get() == BACKEND_BUILTIN)
+  {
+    *row_cost = (n % 2) ? fourier_fft_cost(n) : fourier_fft_cost(n / 2) + n;
+    *column_cost = fourier_fft_cost(n);
+    return;
+  }
+
+#ifndef FOURIER_WITHOUT_FFTW
+  real = FFTW(alloc_real)(n + 2);
+  complex = FFTW(alloc_complex)(n);
+  p = FFTW(plan_dft_r2c_1d)(n, real, (FFTW(complex) *)real, FFTW_ESTIMATE);
+  *row_cost = FFTW(estimate_cost)(p);
+  FFTW(destroy_plan)(p);
+  p = FFTW(plan_dft_1d)(n, complex, complex, FFTW_FORWARD, FFTW_ESTIMATE);
+  *column_cost = FFTW(estimate_cost)(p);
+  FFTW(destroy_plan)(p);
+  FFTW(free)(real);
+  FFTW(free)(complex);
+#endif
+}
+
+/*
+ * Cheapest size to transform a width * height selection: the selection size
+ * or a larger one made of factors 2, 3, 5 and 7 only, as estimated by the
+ * backend.
+ */
+void fourier_padded_size(gint width, gint height, gint *padded_width, gint *padded_height)
+{
+  gint widths[FOURIER_PADDING_CANDIDATES], heights[FOURIER_PADDING_CANDIDATES];
+  double row_costs[FOURIER_PADDING_CANDIDATES], column_costs[FOURIER_PADDING_CANDIDATES];
+  double unused, cost, best = G_MAXDOUBLE;
+  gint n_widths, n_heights, i, j;
+
+  *padded_width = width;
+  *padded_height = height;
+  if (fourier_is_smooth(width) && fourier_is_smooth(height))
+    return;
+
+  n_widths = fourier_padding_candidates(width, widths);
+  n_heights = fourier_padding_candidates(height, heights);
+  G_LOCK(fourier_planner);
+  for (i = 0; i < n_widths; i++)
+    fourier_padding_costs(widths[i], &row_costs[i], &unused);
+  for (j = 0; j < n_heights; j++)
+    fourier_padding_costs(heights[j], &unused, &column_costs[j]);
+  G_UNLOCK(fourier_planner);
+
+  for (i = 0; i < n_widths; i++)
+    for (j = 0; j < n_heights; j++)
+    {
+      cost = heights[j] * row_costs[i] + (widths[i] / 2 + 1) * column_costs[j];
+      if (cost < best)
+      {
+        best = cost;
+        *padded_width = widths[i];
+        *padded_height = heights[j];
+      }
+    }
+}
+
+/** Convolution **************************************************************/
+
+/*
+ * Overlap-save: the output is cut into tiles of an FFT size made of small
+ * factors, each read with the kernel size minus one more pixels around it,
+ * transformed, multiplied by the spectrum of the kernel and transformed
+ * back. Its pixels that wrapped around are dropped, the others are the
+ * convolution. Tiles are independent: they run on several threads, each
+ * with a buffer of its own, through the same single threaded plans.
+ */
+struct _FourierConvolution
+{
+  gint kernel_width, kernel_height;
+  gint kernel_x, kernel_y;      /* origin of the kernel, its center */
+  gint width, height, planes;   /* output */
+  gint tile_width, tile_height; /* FFT size */
+  gint step_x, step_y;          /* output pixels of a tile */
+  gint tiles_x, tiles;
+  gint stride;                  /* values per row of a tile, as a scratch */
+  gsize plane_size;
+  gint threads;                 /* tiles transformed at once */
+  FourierPlan *forward_plan;
+  FourierPlan *inverse_plan;
+  fourier_complex *spectrum;    /* of the kernel, one per plane, divided by the tile size */
+};
+
+/* Smaller tiles cost more in reading and planning than they save in FFT */
+#define FOURIER_CONVOLUTION_MIN_TILE 64
+
+/*
+ * FFT size of the tiles along n output pixels, for a kernel of k pixels: the
+ * smooth size with the lowest total cost, up to a single tile.
+ */
+static gint fourier_convolution_tile_size(gint n, gint k)
+{
+  gint whole = n + k - 1, best_size = whole, size, tiles;
+  double cost, best = G_MAXDOUBLE;
+
+  for (size = MIN(MAX(k, FOURIER_CONVOLUTION_MIN_TILE), whole); ; size++)
+  {
+    if (size < whole && !fourier_is_smooth(size))
+      continue;
+    tiles = (n + size - k) / (size - k + 1);
+    cost = (double)tiles * size * log2(MAX(size, 2));
+    if (cost < best)
+    {
+      best = cost;
+      best_size = size;
+    }
+    if (size >= whole)
+      break;
+  }
+  return best_size;
+}
+
+/*
+ * Get the convolution of width * height arrays of planes channels by a
+ * kernel of kernel_planes planes of kernel_width * kernel_height values, one
+ * for all channels or one per channel. Its origin is its center, it is
+ * transformed here, once for all tiles.
+ */
+FourierConvolution *fourier_convolution_new(const double *kernel, gint kernel_width, gint kernel_height,
+                                            gint kernel_planes, gint width, gint height, gint planes)
+{
+  FourierConvolution *conv = g_new0(FourierConvolution, 1);
+  fourier_real *buffer, *plane;
+  const double *values;
+  double scale;
+  gint plan_threads, row, col, cur_bpp;
+
+  conv->kernel_width = kernel_width;
+  conv->kernel_height = kernel_height;
+  conv->kernel_x = kernel_width / 2;
+  conv->kernel_y = kernel_height / 2;
+  conv->width = width;
+  conv->height = height;
+  conv->planes = planes;
+  conv->tile_width = fourier_convolution_tile_size(width, kernel_width);
+  conv->tile_height = fourier_convolution_tile_size(height, kernel_height);
+  conv->step_x = conv->tile_width - kernel_width + 1;
+  conv->step_y = conv->tile_height - kernel_height + 1;
+  conv->tiles_x = (width + conv->step_x - 1) / conv->step_x;
+  conv->tiles = conv->tiles_x * ((height + conv->step_y - 1) / conv->step_y);
+  conv->stride = conv->tile_width + ((conv->tile_width & 1) ? 1 : 2);
+  conv->plane_size = (gsize)conv->stride * conv->tile_height;
+  conv->threads = CLAMP((fvals.threads > 0) ? fvals.threads : (gint)g_get_num_processors(), 1, conv->tiles);
+  fourier_kernels_init();
+
+  // A single tile uses the FFT threads instead
+  plan_threads = (conv->threads > 1) ? 1 : fourier_get_threads(conv->tile_width, conv->tile_height);
+  buffer = fourier_alloc_real(conv->plane_size * planes);
+  conv->forward_plan = fourier_plan_batch(FALSE, buffer, conv->tile_width, conv->tile_height, planes,
+                                          plan_threads);
+  conv->inverse_plan = fourier_plan_batch(TRUE, buffer, conv->tile_width, conv->tile_height, planes,
+                                          plan_threads);
+  FOURIER_TRACE_MEMORY(conv->plane_size * planes * sizeof(fourier_real) * (conv->threads + 1));
+
+  // Circular convolution by the kernel at the top left of the tile
+  scale = 1.0 / ((double)conv->tile_width * conv->tile_height);
+  memset(buffer, 0, conv->plane_size * planes * sizeof(fourier_real));
+  for (cur_bpp = 0; cur_bpp < planes; cur_bpp++)
+  {
+    plane = buffer + cur_bpp * conv->plane_size;
+    values = kernel + (gsize)(kernel_planes == 1 ? 0 : cur_bpp) * kernel_width * kernel_height;
+    for (row = 0; row < kernel_height; row++)
+      for (col = 0; col < kernel_width; col++)
+        plane[(gsize)row * conv->stride + col] = (fourier_real)(values[row * kernel_width + col] * scale);
+  }
+  fourier_plan_execute(conv->forward_plan);
+  conv->spectrum = (fourier_complex *)buffer;
+
+  return conv;
+}
+
+void fourier_convolution_free(FourierConvolution *conv)
+{
+  FOURIER_TRACE_MEMORY(-(gssize)(conv->plane_size * conv->planes * sizeof(fourier_real) * (conv->threads + 1)));
+  fourier_plan_free(conv->forward_plan);
+  fourier_plan_free(conv->inverse_plan);
+  fourier_free(conv->spectrum);
+  g_free(conv);
+}
+
+typedef struct
+{
+  const FourierConvolution *conv;
+  const guchar *src;
+  gint src_width, src_height;
+  gint x, y;                    /* of the output in src */
+  guchar *dst;
+  gint bpp;
+  gint extension;
+  gint next;                    /* next tile to take, atomic */
+  gint done;                    /* tiles done, atomic */
+} FourierConvolutionJob;
+
+/* Source of pixel i of a line of n pixels, extended on both sides */
+static gint fourier_convolution_index(gint i, gint n, gint extension)
+{
+  if (i < 0)
+    i = (extension == PADDING_MIRROR) ? -i : 0;
+  return fourier_extend_index(i, n, extension);
+}
+
+static void fourier_convolution_tile(FourierConvolutionJob *job, gint tile,
+                                     fourier_real *buffer, gint *columns)
+{
+  const FourierConvolution *conv = job->conv;
+  gint out_x = (tile % conv->tiles_x) * conv->step_x;
+  gint out_y = (tile / conv->tiles_x) * conv->step_y;
+  gint left = job->x + out_x - (conv->kernel_width - 1) + conv->kernel_x;
+  gint top = job->y + out_y - (conv->kernel_height - 1) + conv->kernel_y;
+  gint width = MIN(conv->step_x, conv->width - out_x);
+  gint height = MIN(conv->step_y, conv->height - out_y);
+  fourier_complex *values = (fourier_complex *)buffer;
+  gsize i, count = conv->plane_size / 2 * conv->planes;
+  gint row, col, cur_bpp;
+  const guchar *src;
+  fourier_real *dst, re, im;
+
+  for (col = 0; col < conv->tile_width; col++)
+    columns[col] = fourier_convolution_index(left + col, job->src_width, job->extension) * job->bpp;
+  for (row = 0; row < conv->tile_height; row++)
+  {
+    src = job->src + (gsize)fourier_convolution_index(top + row, job->src_height, job->extension) *
+                     job->src_width * job->bpp;
+    for (cur_bpp = 0; cur_bpp < conv->planes; cur_bpp++)
+    {
+      dst = buffer + cur_bpp * conv->plane_size + (gsize)row * conv->stride;
+      for (col = 0; col < conv->tile_width; col++)
+        dst[col] = (fourier_real)src[columns[col] + cur_bpp];
+    }
+  }
+
+  fourier_plan_execute_on(conv->forward_plan, buffer);
+  for (i = 0; i < count; i++)
+  {
+    re = values[i][0] * conv->spectrum[i][0] - values[i][1] * conv->spectrum[i][1];
+    im = values[i][0] * conv->spectrum[i][1] + values[i][1] * conv->spectrum[i][0];
+    values[i][0] = re;
+    values[i][1] = im;
+  }
+  fourier_plan_execute_on(conv->inverse_plan, buffer);
+
+  // The first kernel size minus one pixels wrapped around
+  for (row = 0; row < height; row++)
+    fourier_interleave_row(buffer + (gsize)(conv->kernel_height - 1 + row) * conv->stride + conv->kernel_width - 1,
+                           conv->plane_size, width,
+                           job->dst + ((gsize)(out_y + row) * conv->width + out_x) * job->bpp,
+                           job->bpp, conv->planes);
+}
+
+/* Tiles are taken in turn by all threads, the calling one reports progress */
+static void fourier_convolution_run(FourierConvolutionJob *job, gboolean report)
+{
+  const FourierConvolution *conv = job->conv;
+  fourier_real *buffer = fourier_alloc_real(conv->plane_size * conv->planes);
+  gint *columns = g_new(gint, conv->tile_width);
+  gint tile, done;
+
+  while (!fourier_cancelled() && (tile = g_atomic_int_add(&job->next, 1)) < conv->tiles)
+  {
+    fourier_convolution_tile(job, tile, buffer, columns);
+    done = g_atomic_int_add(&job->done, 1) + 1;
+    if (report)
+      fourier_progress_update((double)done / conv->tiles);
+  }
+  fourier_free(buffer);
+  g_free(columns);
+}
+
+static gpointer fourier_convolution_thread(gpointer data)
+{
+  fourier_convolution_run(data, FALSE);
+  return NULL;
+}
+
+gboolean fourier_convolution_process(const FourierConvolution *conv, const guchar *src_pixels,
+                                     gint src_width, gint src_height, gint x, gint y,
+                                     guchar *dst_pixels, gint bpp, gint extension)
+{
+  FourierConvolutionJob job = { conv, src_pixels, src_width, src_height, x, y, dst_pixels, bpp,
+                                extension, 0, 0 };
+  GThread **threads = g_new(GThread *, conv->threads);
+  gint i;
+
+  FOURIER_TRACE_BEGIN("convolve");
+  for (i = 1; i < conv->threads; i++)
+    threads[i] = g_thread_new("fourier-convolve", fourier_convolution_thread, &job);
+  fourier_convolution_run(&job, TRUE);
+  for (i = 1; i < conv->threads; i++)
+    g_thread_join(threads[i]);
+  FOURIER_TRACE_END();
+  g_free(threads);
+
+  return !fourier_cancelled();
+}
+
+/** Registration *************************************************************/
+
+/*
+ * Phase correlation: the spectra of both images are multiplied, one by the
+ * conjugate of the other, and only the phase of the product is kept. Its
+ * inverse transform is a peak at the translation between the images, its
+ * height the fraction of the images that match.
+ */
+
+/* Luma, or the only channel, of the pixels minus its mean, tapered to zero at the edges */
+static void fourier_register_load(const guchar *pixels, gint width, gint height, gint bpp, gint planes,
+                                  fourier_real *plane, gint stride, const double *window_x,
+                                  const double *window_y)
+{
+  double sum = 0.0, mean;
+  gint row, col;
+
+  if (planes >= 3)
+    fourier_deinterleave_luma(pixels, width * bpp, bpp, 0, 0, width, height, plane, stride);
+  else
+    fourier_deinterleave(pixels, width * bpp, bpp, 1, 0, 0, width, height, plane, stride, 0);
+
+  for (row = 0; row < height; row++)
+    for (col = 0; col < width; col++)
+      sum += plane[(gsize)row * stride + col];
+  mean = sum / ((double)width * height);
+
+  // Without the taper, the edges of the images correlate as a peak at (0, 0)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) private(col)
+#endif
+  for (row = 0; row < height; row++)
+    for (col = 0; col < width; col++)
+      plane[(gsize)row * stride + col] =
+        (fourier_real)((plane[(gsize)row * stride + col] - mean) * window_x[col] * window_y[row]);
+}
+
+/* Hann window of n values */
+static double *fourier_register_window(gint n)
+{
+  double *window = g_new(double, n);
+  gint i;
+
+  for (i = 0; i < n; i++)
+    window[i] = (n > 1) ? 0.5 - 0.5 * cos(2.0 * G_PI * i / (n - 1)) : 1.0;
+  return window;
+}
+
+/*
+ * Offset of the peak from its highest value c0 and its neighbours cm and cp,
+ * between -0.5 and 0.5. The peak of a sub-pixel translation is a sampled
+ * sinc, whose ratio of the two highest samples gives the offset exactly.
+ */
+static double fourier_register_refine(double cm, double c0, double cp)
+{
+  double c1 = MAX(cm, cp);
+
+  if (c0 <= 0.0 || c1 <= 0.0)
+    return 0.0;
+  return (cp > cm ? 1.0 : -1.0) * MIN(c1 / (c1 + c0), 0.5);
+}
+
+gboolean fourier_phase_correlate(const guchar *reference, const guchar *pixels, gint width, gint height,
+                                 gint bpp, gint planes, double *dx, double *dy, double *peak)
+{
+  gint fft_width, fft_height, stride, threads, row, col, peak_x = 0, peak_y = 0;
+  double *window_x, *window_y, scale, norm, best, re, im;
+  FourierPlan *forward_plan, *inverse_plan;
+  fourier_complex *values, *other;
+  fourier_real *buffer, *surface;
+  gsize i, plane_size, count;
+
+  *dx = *dy = *peak = 0.0;
+  FOURIER_TRACE_BEGIN("phase_correlate");
+  fourier_progress_update(0.0);
+
+  // The tapered images are zero padded to a fast size, the translation is modulo that size
+  fourier_padded_size(width, height, &fft_width, &fft_height);
+  stride = fft_width + ((fft_width & 1) ? 1 : 2);
+  plane_size = (gsize)stride * fft_height;
+  count = plane_size / 2;
+  threads = fourier_get_threads(fft_width, fft_height);
+
+  buffer = fourier_alloc_real(plane_size * 2);
+  FOURIER_TRACE_MEMORY(plane_size * 2 * sizeof(fourier_real));
+  forward_plan = fourier_plan_batch(FALSE, buffer, fft_width, fft_height, 2, threads);
+  inverse_plan = fourier_plan_batch(TRUE, buffer, fft_width, fft_height, 1, threads);
+
+  memset(buffer, 0, plane_size * 2 * sizeof(fourier_real));
+  window_x = fourier_register_window(width);
+  window_y = fourier_register_window(height);
+  fourier_register_load(reference, width, height, bpp, planes, buffer, stride, window_x, window_y);
+  fourier_register_load(pixels, width, height, bpp, planes, buffer + plane_size, stride, window_x, window_y);
+  g_free(window_x);
+  g_free(window_y);
+
+  if (!fourier_cancelled())
+  {
+    fourier_plan_execute(forward_plan);
+    fourier_progress_update(1.0 / 3);
+  }
+
+  if (!fourier_cancelled())
+  {
+    // Normalized cross power spectrum, scaled for the peak of identical images to be 1
+    values = (fourier_complex *)buffer;
+    other = values + count;
+    scale = 1.0 / ((double)fft_width * fft_height);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) private(re, im, norm)
+#endif
+    for (i = 0; i < count; i++)
+    {
+      re = values[i][0] * other[i][0] + values[i][1] * other[i][1];
+      im = values[i][0] * other[i][1] - values[i][1] * other[i][0];
+      norm = sqrt(re * re + im * im);
+      norm = (norm > 1e-12) ? scale / norm : 0.0;
+      values[i][0] = (fourier_real)(re * norm);
+      values[i][1] = (fourier_real)(im * norm);
+    }
+    fourier_plan_execute(inverse_plan);
+    fourier_progress_update(2.0 / 3);
+  }
+
+  if (!fourier_cancelled())
+  {
+    surface = buffer;
+    best = -G_MAXDOUBLE;
+    for (row = 0; row < fft_height; row++)
+      for (col = 0; col < fft_width; col++)
+        if (surface[(gsize)row * stride + col] > best)
+        {
+          best = surface[(gsize)row * stride + col];
+          peak_x = col;
+          peak_y = row;
+        }
+
+    *peak = CLAMP(best, 0.0, 1.0);
+    *dx = peak_x + fourier_register_refine(surface[(gsize)peak_y * stride + (peak_x + fft_width - 1) % fft_width],
+                                           best,
+                                           surface[(gsize)peak_y * stride + (peak_x + 1) % fft_width]);
+    *dy = peak_y + fourier_register_refine(surface[(gsize)((peak_y + fft_height - 1) % fft_height) * stride + peak_x],
+                                           best,
+                                           surface[(gsize)((peak_y + 1) % fft_height) * stride + peak_x]);
+    // Peaks past the middle are negative translations
+    if (*dx > fft_width / 2)
+      *dx -= fft_width;
+    if (*dy > fft_height / 2)
+      *dy -= fft_height;
+    fourier_progress_update(1.0);
+  }
+
+  fourier_plan_free(forward_plan);
+  fourier_plan_free(inverse_plan);
+  fourier_free(buffer);
+  FOURIER_TRACE_MEMORY(-(gssize)(plane_size * 2 * sizeof(fourier_real)));
+  FOURIER_TRACE_END();
+
+  return !fourier_cancelled();
+}
+
+/** Process Functions ********************************************************/
+
+/* Plan both directions for this size, only to record their wisdom */
+void process_fft_tune(gint sel_width, gint sel_height, gint bpp)
+{
+  fourier_scratch_free(fourier_scratch_new(sel_width, sel_height, bpp, FALSE));
+  fourier_progress_update(0.5);
+  fourier_scratch_free(fourier_scratch_new(sel_width, sel_height, bpp, TRUE));
+  fourier_progress_update(1.0);
+}
+
+gboolean process_fft_forward(guchar *src_pixels, guchar *dst_pixels, gint sel_width, gint sel_height, gint src_bpp, gint dst_bpp)
+{
+  FourierScratch *scratch;
+  gboolean done = FALSE;
+
+  scratch = fourier_scratch_new(sel_width, sel_height, src_bpp, FALSE);
+  fourier_progress_update(0.0);
+  FOURIER_TRACE_BEGIN("deinterleave");
+  fourier_scratch_load_pixels(scratch, 0, 0, sel_width, sel_height, src_pixels, sel_width * src_bpp, src_bpp);
+  FOURIER_TRACE_END();
+  fourier_progress_update(1.0 / 3);
+  FOURIER_TRACE_BEGIN("execute");
+  fourier_scratch_execute(scratch);
+  FOURIER_TRACE_END();
+  fourier_progress_update(2.0 / 3);
+  if (!fourier_cancelled())
+  {
+    FOURIER_TRACE_BEGIN("quantize");
+    fourier_scratch_store_spectrum(scratch, 0, 0, sel_width, sel_height, dst_pixels, sel_width * dst_bpp, dst_bpp);
+    FOURIER_TRACE_END();
+    fourier_progress_update(1.0);
+    done = TRUE;
+  }
+  fourier_scratch_free(scratch);
+  return done;
+}
+
+gboolean process_fft_inverse(guchar *src_pixels, guchar *dst_pixels, gint sel_width, gint sel_height, gint src_bpp, gint dst_bpp)
+{
+  FourierScratch *scratch;
+  gboolean done = FALSE;
+
+  scratch = fourier_scratch_new(sel_width, sel_height, src_bpp, TRUE);
+  fourier_progress_update(0.0);
+  FOURIER_TRACE_BEGIN("unquantize");
+  fourier_scratch_load_spectrum(scratch, 0, 0, sel_width, sel_height, src_pixels, sel_width * src_bpp, src_bpp);
+  fourier_scratch_restore_redundancy(scratch);
+  FOURIER_TRACE_END();
+  fourier_progress_update(1.0 / 3);
+  FOURIER_TRACE_BEGIN("execute");
+  fourier_scratch_execute(scratch);
+  FOURIER_TRACE_END();
+  fourier_progress_update(2.0 / 3);
+  if (!fourier_cancelled())
+  {
+    FOURIER_TRACE_BEGIN("interleave");
+    fourier_scratch_store_pixels(scratch, 0, 0, sel_width, sel_height, dst_pixels, sel_width * dst_bpp, dst_bpp);
+    FOURIER_TRACE_END();
+    fourier_progress_update(1.0);
+    done = TRUE;
+  }
+  fourier_scratch_free(scratch);
+  return done;
+}
+
+/* Scratches of the last proxy size, one per direction */
+static FourierScratch *fourier_proxy_scratch[2] = { NULL, NULL };
+
+/*
+ * Transform a small array for a preview, without progress. Plans are kept
+ * between calls of the same size, so that a refresh only executes them.
+ */
+void fourier_proxy_process(const guchar *src_pixels, guchar *dst_pixels,
+                           gint width, gint height, gint bpp, gboolean inverse)
+{
+  FourierScratch *scratch = fourier_proxy_scratch[inverse ? 1 : 0];
+
+  if (scratch && (scratch->width != width || scratch->height != height || scratch->planes != bpp))
+  {
+    fourier_scratch_free(scratch);
+    scratch = NULL;
+  }
+  if (!scratch)
+    scratch = fourier_proxy_scratch[inverse ? 1 : 0] = fourier_scratch_new(width, height, bpp, inverse);
+  fourier_scratch_process(scratch, src_pixels, dst_pixels, bpp);
+}
+
+/* Proxy plans are released once the preview is closed */
+void fourier_proxy_free(void)
+{
+  gint i;
+
+  for (i = 0; i < 2; i++)
+  {
+    if (fourier_proxy_scratch[i])
+      fourier_scratch_free(fourier_proxy_scratch[i]);
+    fourier_proxy_scratch[i] = NULL;
+  }
+}
@@ -0,0 +1,349 @@
+/**
+ *  (c) 2002-2024 - Remi Peyronnet  (see README.md for contributors and changelog)
+ *
+ *  Fourier Transform core, shared by the GIMP plugin and fourier-cli
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ *  The core only depends on glib, and fftw unless built without it: it works
+ *  on arrays of 8 bits interleaved pixels, of any number of channels, and
+ *  encodes spectra the same way for all its users.
+ */
+
+#ifndef FOURIER_CORE_H
+#define FOURIER_CORE_H
+
+#include <stdio.h>
+#include <glib.h>
+
+// Plugin Config
+#if __has_include("fourier-config.h")
+#include "fourier-config.h"
+#endif
+
+// Uses the brillant fftw lib, or the built-in FFT of fourier-fft.h only
+#ifndef FOURIER_WITHOUT_FFTW
+#include <fftw3.h>
+#endif
+
+// Large selections can keep their FFT scratch in a memory mapped file
+#ifndef _WIN32
+#define FOURIER_HAVE_MMAP
+#endif
+
+// FFT precision, single precision (fftw3f) halves the FFT memory
+#ifdef FOURIER_SINGLE_PRECISION
+typedef float fourier_real;
+#define FFTW(name) fftwf_##name
+#define FOURIER_WISDOM_FILE "fourier-wisdom-float"
+#else
+typedef double fourier_real;
+#define FFTW(name) fftw_##name
+#define FOURIER_WISDOM_FILE "fourier-wisdom"
+#endif
+
+// Same layout as fftw_complex
+typedef fourier_real fourier_complex[2];
+
+/** Options ******************************************************************/
+
+typedef enum
+{
+  RIGOR_ESTIMATE,
+  RIGOR_MEASURE,
+  RIGOR_PATIENT,
+  RIGOR_EXHAUSTIVE
+} fourierRigors;
+
+typedef enum
+{
+  BACKEND_FFTW,
+  BACKEND_BUILTIN,
+  BACKEND_AUTO
+} fourierBackends;
+
+typedef enum
+{
+  PADDING_NONE,
+  PADDING_EDGE,
+  PADDING_MIRROR
+} fourierPaddings;
+
+typedef enum
+{
+  FILTER_NONE,
+  FILTER_LOW_PASS,
+  FILTER_HIGH_PASS,
+  FILTER_BAND_PASS
+} fourierFilterTypes;
+
+typedef enum
+{
+  FILTER_IDEAL,
+  FILTER_BUTTERWORTH,
+  FILTER_GAUSSIAN
+} fourierFilterShapes;
+
+/*
+ * Filter of fourier_scratch_filter(). Cutoffs are fractions of the Nyquist
+ * frequency, notches are (x, y) pairs in the spectrum image of the selection
+ * as FFT Forward shows it, their radius in pixels of that image.
+ */
+typedef struct
+{
+  gint type;            /* fourierFilterTypes, FILTER_NONE for notches only */
+  gint shape;           /* fourierFilterShapes, of the pass band and notches */
+  gint order;           /* of the Butterworth shape */
+  double cutoff;        /* low and high pass, low edge of band pass */
+  double cutoff_high;   /* high edge of band pass */
+  gint notches;
+  const double *notch_xy;
+  double notch_radius;
+} FourierFilter;
+
+typedef struct
+{
+  gint threads;   /* FFT threads, 0 = one per processor */
+  gint rigor;     /* fourierRigors, planning effort */
+  gint memory_limit; /* MB of FFT scratch in memory, 0 = unlimited */
+  gint padding;   /* fourierPaddings, extension of padded selections */
+  gint luma;      /* forward of RGB selections as their luma only */
+  gint backend;   /* fourierBackends, FFT engine */
+  gint record_limit; /* MB of a FFT Forward record on disk, 0 = no record */
+} FourierVals;
+
+/* Set before any transform, read only while transforms run */
+extern FourierVals fvals;
+
+typedef void (*FourierProgressFunc)(gdouble fraction);
+
+/* Wisdom is loaded from and saved to filename, none is kept when NULL */
+void fourier_set_wisdom_file(const gchar *filename);
+
+/*
+ * FFT engine of fvals.backend: FFTW, the built-in one, which needs no other
+ * library, or auto, which times both on the first transform of each size and
+ * keeps the faster one, remembered next to the wisdom file. The backend is
+ * set from FOURIER_BACKEND (fftw, builtin or auto) by fourier_backend_init().
+ * fourier_backend_from_name() returns -1 for an unknown name, or for fftw
+ * when built without it.
+ */
+gint fourier_backend_from_name(const gchar *name);
+void fourier_backend_init(void);
+
+/*
+ * Progress of process_fft_*(), and of fourier_scratch_execute() when the
+ * scratch is mapped, none is reported when NULL. It is called from the thread
+ * that runs the transform.
+ */
+void fourier_set_progress_func(FourierProgressFunc func);
+
+/*
+ * Transforms are cancelled from any thread, or from a signal handler, by
+ * fourier_cancel(). It is checked between phases and inside the passes of the
+ * transform, which then stops as soon as it can, its output left as is, until
+ * fourier_cancel_reset().
+ */
+void fourier_cancel(void);
+void fourier_cancel_reset(void);
+gboolean fourier_cancelled(void);
+
+/** Instrumentation **********************************************************/
+
+/*
+ * With FOURIER_TRACE=log, the time and peak scratch memory of each phase are
+ * printed on the standard error by fourier_trace_finish(), with
+ * FOURIER_TRACE=file.json they are written to that file as Chrome trace
+ * events. Phase names must be static strings. Without FOURIER_TRACE, phases
+ * only cost the test of fourier_tracing.
+ */
+extern gboolean fourier_tracing;
+
+void fourier_trace_init(void);
+void fourier_trace_finish(void);
+void fourier_trace_push(const gchar *phase);
+void fourier_trace_pop(void);
+void fourier_trace_memory(gssize bytes);
+
+#define FOURIER_TRACE_BEGIN(phase) \
+  G_STMT_START { if (G_UNLIKELY(fourier_tracing)) fourier_trace_push(phase); } G_STMT_END
+#define FOURIER_TRACE_END() \
+  G_STMT_START { if (G_UNLIKELY(fourier_tracing)) fourier_trace_pop(); } G_STMT_END
+#define FOURIER_TRACE_MEMORY(bytes) \
+  G_STMT_START { if (G_UNLIKELY(fourier_tracing)) fourier_trace_memory(bytes); } G_STMT_END
+
+/** FFT scratch **************************************************************/
+
+typedef struct _FourierGeometry FourierGeometry;
+typedef struct _FourierPlan FourierPlan;
+
+/*
+ * The spectrum of a selection is computed in a scratch of one plane per
+ * channel, each of (width + padding) * height values. It is kept in memory
+ * and transformed by one batched 2D plan, or, when it is larger than the
+ * memory limit, kept in a temporary file and transformed by separable row and
+ * column passes that only bring a bounded part of it into memory.
+ *
+ * A scratch is used by one thread at a time, different scratches may be
+ * created, used and freed from several threads at once.
+ */
+typedef struct
+{
+  gint width, height, planes;
+  gint image_width;           /* pixels at the top left of the planes, */
+  gint image_height;          /* less than width and height when padded */
+  gint extension;             /* fourierPaddings, extension of the pixels */
+  gint stride;                /* values per row, width + padding */
+  gsize plane_size;           /* values per plane, stride * height */
+  gboolean inverse;
+  gboolean luma;              /* one plane of Rec. 601 luma of RGB pixels */
+  fourier_real *fft_real;
+  void *mapped;               /* start of the file mapping, NULL when in memory */
+  gsize mapped_size;
+  FourierPlan *plan;          /* 2D plan, in memory only */
+  FourierPlan *rows_plan;     /* separable passes, mapped only */
+  FourierPlan *last_rows_plan;
+  FourierPlan *columns_plan;
+  FourierPlan *reverse_plans[4]; /* round trip only, plans of the other direction */
+  gint block_rows;
+  gint strip_columns;
+  fourier_complex *strip;
+  FourierGeometry *geo;
+  gint *index;                /* one row of geometry */
+  double *norm;
+  double *values;
+  double *dc;                 /* inverse only, (0, 0) value of each plane */
+  FILE *record;               /* forward only, pixels and spectrum are written to it */
+  const guchar *recorded;     /* inverse only, pixels then spectrum of a record */
+  gint *changed;              /* inverse of a record, changed pixels of each plane */
+} FourierScratch;
+
+/* FALSE when a scratch of these sizes is mapped on a temporary file */
+gboolean fourier_scratch_in_memory(gint width, gint height, gint planes);
+FourierScratch *fourier_scratch_new_full(gint width, gint height, gint planes, gboolean inverse,
+                                         gint fd, gsize offset);
+FourierScratch *fourier_scratch_new(gint width, gint height, gint planes, gboolean inverse);
+FourierScratch *fourier_scratch_new_roundtrip(gint width, gint height, gint planes);
+void fourier_scratch_reverse(FourierScratch *scratch);
+void fourier_scratch_set_image(FourierScratch *scratch, gint image_width, gint image_height,
+                               gint extension);
+void fourier_scratch_reset(FourierScratch *scratch);
+void fourier_scratch_free(FourierScratch *scratch);
+void fourier_scratch_release(FourierScratch *scratch, gsize offset, gsize count);
+
+/*
+ * The rectangle (x, y, width, height) of the selection is loaded to or stored
+ * from the scratch, as pixels or as spectrum image, from rows of rowstride
+ * bytes of bpp bytes per pixel, so that tiles can be used in place.
+ */
+void fourier_scratch_load_pixels(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                 const guchar *pixels, gint rowstride, gint bpp);
+void fourier_scratch_store_pixels(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                  guchar *pixels, gint rowstride, gint bpp);
+void fourier_scratch_add_recorded(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                  gint bpp);
+void fourier_scratch_store_spectrum(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                    guchar *pixels, gint rowstride, gint bpp);
+void fourier_scratch_load_spectrum(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                   const guchar *pixels, gint rowstride, gint bpp);
+void fourier_scratch_load_delta(FourierScratch *scratch, gint x, gint y, gint width, gint height,
+                                const guchar *pixels, gint rowstride, gint bpp);
+void fourier_scratch_restore_redundancy(FourierScratch *scratch);
+void fourier_scratch_extend(FourierScratch *scratch);
+void fourier_scratch_execute(FourierScratch *scratch);
+
+/*
+ * Filter in one pass: the pixels loaded in a round trip scratch are
+ * transformed, filtered and transformed back in double precision, then
+ * stored as pixels, its direction being inverse.
+ */
+void fourier_scratch_filter(FourierScratch *scratch, const FourierFilter *filter);
+void fourier_scratch_execute_filter(FourierScratch *scratch, const FourierFilter *filter);
+
+/*
+ * Pixels of bpp channels, alpha being the last of 2 and 4: the colors are
+ * transformed, alpha is passed through as is. The colors of gray pixels,
+ * all equal, are transformed as a single plane copied to the other ones by
+ * fourier_pixels_replicate().
+ */
+gint fourier_pixels_colors(gint bpp);
+gboolean fourier_pixels_gray(const guchar *pixels, gsize count, gint bpp, gint colors);
+/* Planes to transform count pixels with, 1 when they are gray */
+gint fourier_pixels_planes(const guchar *pixels, gsize count, gint bpp);
+void fourier_pixels_replicate(guchar *pixels, gsize count, gint bpp, gint planes, gint colors);
+
+/*
+ * Transform a whole array of pixels of bpp channels, pixels or spectrum
+ * image as the scratch direction, of the same size as its spectrum. Its
+ * planes are usually fourier_pixels_planes() of src_pixels: alpha is copied
+ * from src_pixels, and the colors that were not transformed from the first
+ * one. FALSE is returned when cancelled, dst_pixels is then left as is.
+ */
+gboolean fourier_scratch_process(FourierScratch *scratch, const guchar *src_pixels,
+                                 guchar *dst_pixels, gint bpp);
+
+/** Convolution **************************************************************/
+
+typedef struct _FourierConvolution FourierConvolution;
+
+/*
+ * Convolution of arrays of pixels by a kernel, in tiles of FFT friendly
+ * sizes, at a cost per pixel in the logarithm of the kernel size. The kernel
+ * is kernel_planes planes of kernel_width * kernel_height weights, one for
+ * all channels or one per channel, centered on the output pixel.
+ */
+FourierConvolution *fourier_convolution_new(const double *kernel, gint kernel_width, gint kernel_height,
+                                            gint kernel_planes, gint width, gint height, gint planes);
+void fourier_convolution_free(FourierConvolution *conv);
+
+/*
+ * The width * height output at (x, y) of a src_width * src_height array of
+ * pixels is convolved into dst_pixels, pixels outside the array extended
+ * as extension (PADDING_EDGE or PADDING_MIRROR). Only the first planes
+ * channels of the bpp of the pixels are written. FALSE is returned when
+ * cancelled, dst_pixels is then partly written.
+ */
+gboolean fourier_convolution_process(const FourierConvolution *conv, const guchar *src_pixels,
+                                     gint src_width, gint src_height, gint x, gint y,
+                                     guchar *dst_pixels, gint bpp, gint extension);
+
+/** Registration *************************************************************/
+
+/*
+ * Translation of pixels relative to reference, two width * height arrays of
+ * pixels of bpp bytes, by phase correlation of their luma, or of their only
+ * channel when planes is 1. The content of reference at (x, y) is found in
+ * pixels at (x + dx, y + dy), to a fraction of a pixel. peak is the height
+ * of the correlation peak, near 1 for the same image translated, near 0 for
+ * unrelated ones. FALSE is returned when cancelled.
+ */
+gboolean fourier_phase_correlate(const guchar *reference, const guchar *pixels, gint width, gint height,
+                                 gint bpp, gint planes, double *dx, double *dy, double *peak);
+
+/** Process Functions ********************************************************/
+
+void fourier_padded_size(gint width, gint height, gint *padded_width, gint *padded_height);
+void process_fft_tune(gint sel_width, gint sel_height, gint bpp);
+/* FALSE is returned when cancelled, dst_pixels is then left as is */
+gboolean process_fft_forward(guchar *src_pixels, guchar *dst_pixels, gint sel_width, gint sel_height, gint src_bpp, gint dst_bpp);
+gboolean process_fft_inverse(guchar *src_pixels, guchar *dst_pixels, gint sel_width, gint sel_height, gint src_bpp, gint dst_bpp);
+
+void fourier_proxy_process(const guchar *src_pixels, guchar *dst_pixels,
+                           gint width, gint height, gint bpp, gboolean inverse);
+void fourier_proxy_free(void);
+
+/* Tables kept for the next transform of the same size, freed by long running users when idle */
+void fourier_geometry_cache_free(void);
+
+#endif
@@ -0,0 +1,513 @@
+/**
+ *  (c) 2002-2024 - Remi Peyronnet  (see README.md for contributors and changelog)
+ *
+ *  Built-in FFT engine of the core, used without FFTW
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ *  Header only, included by fourier-core.c after fourier-core.h: mixed
+ *  radix transforms of any size (radix 4, 2 and 3 butterflies, generic
+ *  ones for other small primes, Bluestein's chirp z for large primes), and
+ *  real transforms on top of them. Their conventions are those of FFTW:
+ *  unnormalized, n / 2 + 1 complex values for n real ones, the imaginary
+ *  parts of the first and, for even n, last value ignored by the inverse.
+ */
+
+#ifndef FOURIER_FFT_H
+#define FOURIER_FFT_H
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+/* Larger prime factors go through Bluestein, generic butterflies cost p * p */
+#define FOURIER_FFT_MAX_RADIX 31
+#define FOURIER_FFT_MAX_FACTORS 32
+
+typedef struct _FourierFFT FourierFFT;
+
+/* Complex transform of n values, forward (exp(-2 pi i jk / n)) or inverse */
+struct _FourierFFT
+{
+  gint n;
+  gboolean inverse;
+  gint factors[2 * FOURIER_FFT_MAX_FACTORS]; /* radix p, then size m left, from first to last stage */
+  fourier_complex *twiddles;                 /* n values, exp(-+2 pi i k / n) */
+  gint m;                                    /* Bluestein only, smooth size of its transforms */
+  FourierFFT *forward, *backward;
+  fourier_complex *chirp;                    /* n values, exp(-+i pi k^2 / n) */
+  fourier_complex *filter;                   /* m values, spectrum of the conjugate chirp, divided by m */
+};
+
+/* Real transform of n values, through a complex one of n / 2 when n is even */
+typedef struct
+{
+  gint n;
+  gboolean inverse;
+  FourierFFT *fft;
+  fourier_complex *twiddles;                 /* even n only, n / 2 values, exp(-+2 pi i k / n) */
+} FourierRFFT;
+
+static inline void fourier_fft_mul(fourier_complex out, const fourier_complex a, const fourier_complex b)
+{
+  fourier_real re = a[0] * b[0] - a[1] * b[1];
+  fourier_real im = a[0] * b[1] + a[1] * b[0];
+  out[0] = re;
+  out[1] = im;
+}
+
+/* Radix 4 first, as in most FFTs, then 2, 3 and other primes in increasing order */
+static gint fourier_fft_factor(gint n, gint *factors)
+{
+  gint p = 4, count = 0, largest = 1;
+
+  while (n > 1)
+  {
+    while (n % p)
+    {
+      p = (p == 4) ? 2 : (p == 2) ? 3 : p + 2;
+      if ((gint64)p * p > n)
+        p = n;
+    }
+    n /= p;
+    factors[2 * count] = p;
+    factors[2 * count + 1] = n;
+    count++;
+    largest = MAX(largest, p);
+  }
+  return largest;
+}
+
+/* Size with no prime factor above 5, at least n, for Bluestein transforms */
+static gint fourier_fft_smooth_size(gint n)
+{
+  gint m, k;
+
+  for (m = n; ; m++)
+  {
+    k = m;
+    while (k % 2 == 0)
+      k /= 2;
+    while (k % 3 == 0)
+      k /= 3;
+    while (k % 5 == 0)
+      k /= 5;
+    if (k == 1)
+      return m;
+  }
+}
+
+static void fourier_fft_execute(const FourierFFT *fft, const fourier_complex *in, gsize in_stride,
+                                fourier_complex *out, fourier_complex *work);
+
+static FourierFFT *fourier_fft_new(gint n, gboolean inverse)
+{
+  FourierFFT *fft = g_new0(FourierFFT, 1);
+  double sign = inverse ? 1.0 : -1.0;
+  fourier_complex *b;
+  gint k;
+
+  fft->n = n;
+  fft->inverse = inverse;
+  if (fourier_fft_factor(n, fft->factors) <= FOURIER_FFT_MAX_RADIX)
+  {
+    fft->twiddles = g_new(fourier_complex, n);
+    for (k = 0; k < n; k++)
+    {
+      fft->twiddles[k][0] = (fourier_real)cos(2.0 * G_PI * k / n);
+      fft->twiddles[k][1] = (fourier_real)(sign * sin(2.0 * G_PI * k / n));
+    }
+    return fft;
+  }
+
+  // Bluestein: the transform is a convolution by a chirp, of a smooth size
+  fft->m = fourier_fft_smooth_size(2 * n - 1);
+  fft->forward = fourier_fft_new(fft->m, FALSE);
+  fft->backward = fourier_fft_new(fft->m, TRUE);
+  fft->chirp = g_new(fourier_complex, n);
+  for (k = 0; k < n; k++)
+  {
+    // k * k modulo 2n keeps the angle exact for large k
+    double angle = G_PI * (double)(((gint64)k * k) % (2 * (gint64)n)) / n;
+    fft->chirp[k][0] = (fourier_real)cos(angle);
+    fft->chirp[k][1] = (fourier_real)(sign * sin(angle));
+  }
+  b = g_new0(fourier_complex, fft->m);
+  for (k = 0; k < n; k++)
+  {
+    b[k][0] = fft->chirp[k][0] / fft->m;
+    b[k][1] = -fft->chirp[k][1] / fft->m;
+    if (k > 0)
+    {
+      b[fft->m - k][0] = b[k][0];
+      b[fft->m - k][1] = b[k][1];
+    }
+  }
+  fft->filter = g_new(fourier_complex, fft->m);
+  fourier_fft_execute(fft->forward, b, 1, fft->filter, NULL);
+  g_free(b);
+  return fft;
+}
+
+static void fourier_fft_free(FourierFFT *fft)
+{
+  if (fft->forward)
+  {
+    fourier_fft_free(fft->forward);
+    fourier_fft_free(fft->backward);
+  }
+  g_free(fft->twiddles);
+  g_free(fft->chirp);
+  g_free(fft->filter);
+  g_free(fft);
+}
+
+/* Complex values of work needed by fourier_fft_execute() */
+static gsize fourier_fft_work_size(const FourierFFT *fft)
+{
+  return fft->m ? 2 * (gsize)fft->m : 0;
+}
+
+/** Butterflies **************************************************************/
+
+/*
+ * Each butterfly combines p transforms of m values, stored one after the
+ * other in out, into one of p * m. Their twiddles are every fstride-th of
+ * the transform.
+ */
+static void fourier_fft_butterfly2(const FourierFFT *fft, fourier_complex *out, gint fstride, gint m)
+{
+  const fourier_complex *tw = fft->twiddles;
+  fourier_complex t;
+  gint k;
+
+  for (k = 0; k < m; k++, tw += fstride)
+  {
+    fourier_fft_mul(t, out[k + m], *tw);
+    out[k + m][0] = out[k][0] - t[0];
+    out[k + m][1] = out[k][1] - t[1];
+    out[k][0] += t[0];
+    out[k][1] += t[1];
+  }
+}
+
+static void fourier_fft_butterfly3(const FourierFFT *fft, fourier_complex *out, gint fstride, gint m)
+{
+  const fourier_complex *tw1 = fft->twiddles, *tw2 = fft->twiddles;
+  fourier_real epi3 = fft->twiddles[(gsize)fstride * m][1];
+  fourier_complex s0, s1, s2, s3;
+  gint k;
+
+  for (k = 0; k < m; k++, tw1 += fstride, tw2 += 2 * fstride)
+  {
+    fourier_fft_mul(s1, out[k + m], *tw1);
+    fourier_fft_mul(s2, out[k + 2 * m], *tw2);
+    s3[0] = s1[0] + s2[0];
+    s3[1] = s1[1] + s2[1];
+    s0[0] = (s1[0] - s2[0]) * epi3;
+    s0[1] = (s1[1] - s2[1]) * epi3;
+    out[k + m][0] = out[k][0] - s3[0] * (fourier_real)0.5;
+    out[k + m][1] = out[k][1] - s3[1] * (fourier_real)0.5;
+    out[k][0] += s3[0];
+    out[k][1] += s3[1];
+    out[k + 2 * m][0] = out[k + m][0] + s0[1];
+    out[k + 2 * m][1] = out[k + m][1] - s0[0];
+    out[k + m][0] -= s0[1];
+    out[k + m][1] += s0[0];
+  }
+}
+
+static void fourier_fft_butterfly4(const FourierFFT *fft, fourier_complex *out, gint fstride, gint m)
+{
+  const fourier_complex *tw1 = fft->twiddles, *tw2 = fft->twiddles, *tw3 = fft->twiddles;
+  fourier_complex s0, s1, s2, s3, s4, s5;
+  gint k;
+
+  for (k = 0; k < m; k++, tw1 += fstride, tw2 += 2 * fstride, tw3 += 3 * fstride)
+  {
+    fourier_fft_mul(s0, out[k + m], *tw1);
+    fourier_fft_mul(s1, out[k + 2 * m], *tw2);
+    fourier_fft_mul(s2, out[k + 3 * m], *tw3);
+    s5[0] = out[k][0] - s1[0];
+    s5[1] = out[k][1] - s1[1];
+    out[k][0] += s1[0];
+    out[k][1] += s1[1];
+    s3[0] = s0[0] + s2[0];
+    s3[1] = s0[1] + s2[1];
+    s4[0] = s0[0] - s2[0];
+    s4[1] = s0[1] - s2[1];
+    out[k + 2 * m][0] = out[k][0] - s3[0];
+    out[k + 2 * m][1] = out[k][1] - s3[1];
+    out[k][0] += s3[0];
+    out[k][1] += s3[1];
+    if (fft->inverse)
+    {
+      out[k + m][0] = s5[0] - s4[1];
+      out[k + m][1] = s5[1] + s4[0];
+      out[k + 3 * m][0] = s5[0] + s4[1];
+      out[k + 3 * m][1] = s5[1] - s4[0];
+    }
+    else
+    {
+      out[k + m][0] = s5[0] + s4[1];
+      out[k + m][1] = s5[1] - s4[0];
+      out[k + 3 * m][0] = s5[0] - s4[1];
+      out[k + 3 * m][1] = s5[1] + s4[0];
+    }
+  }
+}
+
+static void fourier_fft_butterfly(const FourierFFT *fft, fourier_complex *out, gint fstride, gint m, gint p)
+{
+  fourier_complex scratch[FOURIER_FFT_MAX_RADIX], t;
+  gint u, q, q1, k, twiddle;
+
+  for (u = 0; u < m; u++)
+  {
+    for (q1 = 0, k = u; q1 < p; q1++, k += m)
+    {
+      scratch[q1][0] = out[k][0];
+      scratch[q1][1] = out[k][1];
+    }
+    for (q1 = 0, k = u; q1 < p; q1++, k += m)
+    {
+      out[k][0] = scratch[0][0];
+      out[k][1] = scratch[0][1];
+      twiddle = 0;
+      for (q = 1; q < p; q++)
+      {
+        twiddle += fstride * k;
+        if (twiddle >= fft->n)
+          twiddle -= fft->n;
+        fourier_fft_mul(t, scratch[q], fft->twiddles[twiddle]);
+        out[k][0] += t[0];
+        out[k][1] += t[1];
+      }
+    }
+  }
+}
+
+/* Decimation in time: p interleaved transforms of m values, then their butterflies */
+static void fourier_fft_stage(const FourierFFT *fft, fourier_complex *out, const fourier_complex *in,
+                              gsize in_stride, gint fstride, const gint *factors)
+{
+  gint p = factors[0], m = factors[1], k;
+
+  if (m == 1)
+    for (k = 0; k < p; k++)
+    {
+      out[k][0] = in[(gsize)k * fstride * in_stride][0];
+      out[k][1] = in[(gsize)k * fstride * in_stride][1];
+    }
+  else
+    for (k = 0; k < p; k++)
+      fourier_fft_stage(fft, out + (gsize)k * m, in + (gsize)k * fstride * in_stride, in_stride,
+                        fstride * p, factors + 2);
+
+  switch (p)
+  {
+  case 2:
+    fourier_fft_butterfly2(fft, out, fstride, m);
+    break;
+  case 3:
+    fourier_fft_butterfly3(fft, out, fstride, m);
+    break;
+  case 4:
+    fourier_fft_butterfly4(fft, out, fstride, m);
+    break;
+  default:
+    fourier_fft_butterfly(fft, out, fstride, m, p);
+    break;
+  }
+}
+
+/*
+ * Transform the n values of in, every in_stride-th, into out, which must not
+ * overlap in. work holds fourier_fft_work_size() values, NULL when none.
+ */
+static void fourier_fft_execute(const FourierFFT *fft, const fourier_complex *in, gsize in_stride,
+                                fourier_complex *out, fourier_complex *work)
+{
+  fourier_complex *a = work, *spectrum = work + (fft->m ? fft->m : 0);
+  gint k;
+
+  if (fft->n == 1)
+  {
+    out[0][0] = in[0][0];
+    out[0][1] = in[0][1];
+    return;
+  }
+  if (!fft->m)
+  {
+    fourier_fft_stage(fft, out, in, in_stride, 1, fft->factors);
+    return;
+  }
+
+  for (k = 0; k < fft->n; k++)
+    fourier_fft_mul(a[k], in[(gsize)k * in_stride], fft->chirp[k]);
+  memset(a + fft->n, 0, sizeof(fourier_complex) * (fft->m - fft->n));
+  fourier_fft_execute(fft->forward, a, 1, spectrum, NULL);
+  for (k = 0; k < fft->m; k++)
+    fourier_fft_mul(spectrum[k], spectrum[k], fft->filter[k]);
+  fourier_fft_execute(fft->backward, spectrum, 1, a, NULL);
+  for (k = 0; k < fft->n; k++)
+    fourier_fft_mul(out[k], a[k], fft->chirp[k]);
+}
+
+/** Real transforms **********************************************************/
+
+static FourierRFFT *fourier_rfft_new(gint n, gboolean inverse)
+{
+  FourierRFFT *rfft = g_new0(FourierRFFT, 1);
+  double sign = inverse ? 1.0 : -1.0;
+  gint k;
+
+  rfft->n = n;
+  rfft->inverse = inverse;
+  if (n % 2)
+  {
+    rfft->fft = fourier_fft_new(n, inverse);
+    return rfft;
+  }
+
+  // The even and odd values are the real and imaginary parts of a transform of n / 2
+  rfft->fft = fourier_fft_new(n / 2, inverse);
+  rfft->twiddles = g_new(fourier_complex, n / 2);
+  for (k = 0; k < n / 2; k++)
+  {
+    rfft->twiddles[k][0] = (fourier_real)cos(2.0 * G_PI * k / n);
+    rfft->twiddles[k][1] = (fourier_real)(sign * sin(2.0 * G_PI * k / n));
+  }
+  return rfft;
+}
+
+static void fourier_rfft_free(FourierRFFT *rfft)
+{
+  fourier_fft_free(rfft->fft);
+  g_free(rfft->twiddles);
+  g_free(rfft);
+}
+
+/* Complex values of work needed by fourier_rfft_execute() */
+static gsize fourier_rfft_work_size(const FourierRFFT *rfft)
+{
+  gsize own = (rfft->n % 2) ? 2 * (gsize)rfft->n : (gsize)rfft->n / 2;
+  return own + fourier_fft_work_size(rfft->fft);
+}
+
+/*
+ * Transform in place the n real values of data, into its n / 2 + 1 complex
+ * values, or back when inverse: data holds 2 * (n / 2 + 1) values.
+ */
+static void fourier_rfft_execute(const FourierRFFT *rfft, fourier_real *data, fourier_complex *work)
+{
+  fourier_complex *values = (fourier_complex *)data;
+  gint n = rfft->n, half = n / 2, k;
+  fourier_complex *sub_work;
+  fourier_real a[2], b[2];
+
+  if (n % 2)
+  {
+    // Odd sizes go through a complex transform of n
+    sub_work = work + 2 * (gsize)n;
+    if (!rfft->inverse)
+    {
+      for (k = 0; k < n; k++)
+      {
+        work[k][0] = data[k];
+        work[k][1] = 0;
+      }
+      fourier_fft_execute(rfft->fft, work, 1, work + n, sub_work);
+      memcpy(data, work + n, sizeof(fourier_complex) * (half + 1));
+    }
+    else
+    {
+      work[0][0] = values[0][0];
+      work[0][1] = 0;
+      for (k = 1; k <= half; k++)
+      {
+        work[k][0] = work[n - k][0] = values[k][0];
+        work[k][1] = values[k][1];
+        work[n - k][1] = -values[k][1];
+      }
+      fourier_fft_execute(rfft->fft, work, 1, work + n, sub_work);
+      for (k = 0; k < n; k++)
+        data[k] = work[n + k][0];
+    }
+    return;
+  }
+
+  sub_work = work + half;
+  if (!rfft->inverse)
+  {
+    fourier_fft_execute(rfft->fft, values, 1, work, sub_work);
+    // X[k] = E[k] + w^k O[k], E and O the transforms of the even and odd values
+    values[0][0] = work[0][0] + work[0][1];
+    values[0][1] = 0;
+    values[half][0] = work[0][0] - work[0][1];
+    values[half][1] = 0;
+    for (k = 1; k < half; k++)
+    {
+      a[0] = (work[k][0] + work[half - k][0]) * (fourier_real)0.5;
+      a[1] = (work[k][1] - work[half - k][1]) * (fourier_real)0.5;
+      b[0] = (work[k][1] + work[half - k][1]) * (fourier_real)0.5;
+      b[1] = (work[half - k][0] - work[k][0]) * (fourier_real)0.5;
+      fourier_fft_mul(b, b, rfft->twiddles[k]);
+      values[k][0] = a[0] + b[0];
+      values[k][1] = a[1] + b[1];
+    }
+  }
+  else
+  {
+    // Z[k] = 2 E[k] + 2i O[k], whose inverse is n times the even and odd values
+    work[0][0] = values[0][0] + values[half][0];
+    work[0][1] = values[0][0] - values[half][0];
+    for (k = 1; k < half; k++)
+    {
+      a[0] = values[k][0] + values[half - k][0];
+      a[1] = values[k][1] - values[half - k][1];
+      b[0] = values[k][0] - values[half - k][0];
+      b[1] = values[k][1] + values[half - k][1];
+      fourier_fft_mul(b, b, rfft->twiddles[k]);
+      work[k][0] = a[0] - b[1];
+      work[k][1] = a[1] + b[0];
+    }
+    fourier_fft_execute(rfft->fft, work, 1, values, sub_work);
+  }
+}
+
+/* Relative cost of a transform of n values, to compare sizes */
+static double fourier_fft_cost(gint n)
+{
+  gint factors[2 * FOURIER_FFT_MAX_FACTORS];
+  gint largest;
+  double cost = 0.0;
+  gint i;
+
+  if (n < 2)
+    return 0.0;
+  largest = fourier_fft_factor(n, factors);
+  if (largest > FOURIER_FFT_MAX_RADIX)
+    return 2.0 * fourier_fft_cost(fourier_fft_smooth_size(2 * n - 1)) + 3.0 * n;
+  // A stage costs a pass over the values, generic butterflies about p / 2 more
+  for (i = 0; ; i += 2)
+  {
+    cost += (double)n * ((factors[i] <= 4) ? 1.0 : factors[i] / 2.0);
+    if (factors[i + 1] == 1)
+      break;
+  }
+  return cost;
+}
+
+#endif
@@ -18,25 +18,24 @@
  *
  *  You'll need to install fftw version 3
  *
- *  Minimal install command:
+ *  Minimal build command (then copy fourier in your plug-ins directory):
  *
- *  CFLAGS="-O2" LIBS="-L/usr/local/lib -lfftw3" gimptool --install fourier.c
+ *  echo $(gimptool -n --build fourier.c) fourier-core.c -lfftw3 -O2 | sh
  *
  */
 
-// msys2 -mingw64 -c 'echo $(gimptool-2.99 -n --build fourier.c) -lfftw3 -O3 | sh'
+// msys2 -mingw64 -c 'echo $(gimptool-2.99 -n --build fourier.c) fourier-core.c -lfftw3 -O3 | sh'
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
 
 // GIMP headers
 #include <libgimp/gimp.h>
-
-// Uses the brillant fftw lib
-#include <fftw3.h>
+#include <glib/gstdio.h>
 
 // Plugin Config
 #if __has_include("fourier-config.h")
@@ -46,6 +45,9 @@
 #define GETTEXT_PACKAGE3 "gimp30-fourier"
 #endif
 
+// Transform core, also used by fourier-cli
+#include "fourier-core.h"
+
 /**
  * Note about translation strings:
  *
@@ -130,454 +132,2040 @@ static char *PLUG_IN_INV_MENU_LABEL = d_("FFT Inverse");
 static char *PLUG_IN_INV_DESC = d_("Apply an inverse FFT to the image, effectively restoring the original image (plus changes).");
 static char *PLUG_IN_INV_SHORT_DESC = d_("This plug-in applies a FFT to the image, for educationnal or effects purpose.");
 
+static char *PLUG_IN_TUNE_PROC = "plug-in-fourier-tune";
+static char *PLUG_IN_TUNE_MENU_LABEL = d_("FFT Tune for this Size");
+static char *PLUG_IN_TUNE_DESC = d_("Measure the fastest FFT plans for the size of the current selection and store them, so that later FFT Forward and FFT Inverse of the same size run faster.");
+static char *PLUG_IN_TUNE_SHORT_DESC = d_("This plug-in prepares fast FFT plans for the current selection size.");
+
+static char *PLUG_IN_EXPORT_PROC = "plug-in-fourier-export";
+static char *PLUG_IN_EXPORT_MENU_LABEL = d_("FFT Export Spectrum...");
+static char *PLUG_IN_EXPORT_DESC = d_("Write the full precision complex spectrum of the selection to a NPY file of shape (channels, height, width / 2 + 1), as computed or as quantized by FFT Forward. Values are the FFT divided by the number of pixels, as numpy.fft.rfft2(..., norm=\"forward\") gives.");
+static char *PLUG_IN_EXPORT_SHORT_DESC = d_("This plug-in exports the FFT of the image to a NPY file.");
+
+static char *PLUG_IN_IMPORT_PROC = "plug-in-fourier-import";
+static char *PLUG_IN_IMPORT_MENU_LABEL = d_("FFT Import Spectrum...");
+static char *PLUG_IN_IMPORT_DESC = d_("Apply an inverse FFT to the complex spectrum of a NPY file, as written by FFT Export Spectrum, and replace the selection with the result.");
+static char *PLUG_IN_IMPORT_SHORT_DESC = d_("This plug-in imports a FFT from a NPY file.");
+
+static char *PLUG_IN_FILTER_PROC = "plug-in-fourier-filter";
+static char *PLUG_IN_FILTER_MENU_LABEL = d_("FFT Filter...");
+static char *PLUG_IN_FILTER_DESC = d_("Filter the selection in the frequency domain in one pass: the FFT, the filter and the inverse FFT are computed at full precision, without the quantized spectrum of FFT Forward. Low, high and band pass filters are ideal, Butterworth or Gaussian, and notches remove peaks of the spectrum, such as moire patterns, given at their position in the FFT Forward image. The mean of the image is kept.");
+static char *PLUG_IN_FILTER_SHORT_DESC = d_("This plug-in filters the image in the frequency domain.");
+
+static char *PLUG_IN_CONVOLVE_PROC = "plug-in-fourier-convolve";
+static char *PLUG_IN_CONVOLVE_MENU_LABEL = d_("FFT Convolve...");
+static char *PLUG_IN_CONVOLVE_DESC = d_("Convolve the selection with a kernel taken from another drawable, through the FFT of tiles of the selection: the time per pixel only grows with the logarithm of the kernel size, so that blurs and point spread functions of hundreds of pixels take about as long as small ones. The kernel is centered on each pixel, a gray kernel applies to all channels and a colored one to each of its channels. The kernel drawable itself is left as is.");
+static char *PLUG_IN_CONVOLVE_SHORT_DESC = d_("This plug-in convolves the image with a kernel drawable in the frequency domain.");
+
+static char *PLUG_IN_REGISTER_PROC = "plug-in-fourier-register";
+static char *PLUG_IN_REGISTER_MENU_LABEL = d_("FFT Register...");
+static char *PLUG_IN_REGISTER_DESC = d_("Find the translation of the selection of the drawable relative to a reference drawable, such as another pass of a scan or another shot of a bracket, by phase correlation: both are transformed once, so that it takes about as long as three FFTs of the selection whatever the translation. The translation is found to a fraction of a pixel, and the layer can be moved by it to match the reference.");
+static char *PLUG_IN_REGISTER_SHORT_DESC = d_("This plug-in aligns a layer with a reference by phase correlation.");
+
+static char *PLUG_IN_SERVICE_PROC = "plug-in-fourier-service";
+static char *PLUG_IN_SERVICE_DESC = d_("Keep a resident Fourier process, started once, that runs FFT Forward, FFT Inverse and FFT Filter from the FFT Resident menu with their plans, geometry tables and FFT threads kept from one run to the next. What is kept is released when the service has been idle for the idle timeout.");
+static char *PLUG_IN_SERVICE_SHORT_DESC = d_("This plug-in keeps the Fourier transforms warm between runs.");
+// Temporary procedures of the service are named after the procedure they run
+#define PLUG_IN_RESIDENT_SUFFIX "-resident"
+static char *PLUG_IN_RESIDENT_MENU_LOCATION = "<Image>/Filters/Generic/FFT Resident";
+
+#define PLUG_IN_THREADS_DESC "Number of threads used by the FFT (0 = one per processor)"
+#define PLUG_IN_RIGOR_DESC "FFT planning rigor { Estimate (0), Measure (1), Patient (2), Exhaustive (3) }"
+#define PLUG_IN_MEMORY_LIMIT_DESC "Memory used by the FFT in MB, larger selections are processed in a temporary file (0 = unlimited)"
+#define PLUG_IN_PADDING_DESC "Grow whole layers of a slow FFT size to the fastest larger size, extending the edges or mirroring the pixels { None (0), Edge (1), Mirror (2) }, FFT Inverse crops them back"
+#define PLUG_IN_ALL_LAYERS_DESC "Transform all layers of the image instead of the selected drawables, the next layer is read while one is transformed"
+#define PLUG_IN_LUMA_DESC "Transform the luma of RGB selections only, one spectrum instead of three, FFT Inverse adds its changes to the original colors"
+#define PLUG_IN_RECORD_LIMIT_DESC "Largest record of the pixels and spectrum of FFT Forward kept on disk in MB, about twice the selection, for FFT Inverse to only transform the changes (0 = no record)"
+#define PLUG_IN_FILTER_TYPE_DESC "Pass band { None, notches only (0), Low pass (1), High pass (2), Band pass (3) }"
+#define PLUG_IN_FILTER_SHAPE_DESC "Shape of the pass band and notches { Ideal (0), Butterworth (1), Gaussian (2) }"
+#define PLUG_IN_FILTER_CUTOFF_DESC "Cutoff frequency, as a fraction of the highest frequency (1.0), low edge of the band pass"
+#define PLUG_IN_FILTER_CUTOFF_HIGH_DESC "High edge of the band pass, as a fraction of the highest frequency"
+#define PLUG_IN_FILTER_ORDER_DESC "Order of the Butterworth shape, the higher the sharper"
+#define PLUG_IN_FILTER_NOTCHES_DESC "Notches as \"x,y\" positions in the FFT Forward image of the selection, separated by spaces or semicolons, the symmetric peak is removed too"
+#define PLUG_IN_FILTER_NOTCH_RADIUS_DESC "Radius of the notches in pixels of the FFT Forward image"
+#define PLUG_IN_CONVOLVE_KERNEL_DESC "Drawable whose pixels are the weights of the kernel, its center on each pixel"
+#define PLUG_IN_CONVOLVE_NORMALIZE_DESC "Scale each channel of the kernel to a sum of one, instead of weighing its pixels by their value / 255"
+#define PLUG_IN_CONVOLVE_EDGES_DESC "Pixels outside the drawable, extending the edges or mirroring the pixels { Edge (1), Mirror (2) }"
+#define PLUG_IN_REGISTER_REFERENCE_DESC "Drawable to align with, compared where it overlaps the selection in the image"
+#define PLUG_IN_REGISTER_APPLY_DESC "Move the layer by the nearest whole number of pixels to match the reference"
+#define PLUG_IN_REGISTER_OFFSET_X_DESC "Horizontal translation of the drawable content relative to the reference, in pixels"
+#define PLUG_IN_REGISTER_OFFSET_Y_DESC "Vertical translation of the drawable content relative to the reference, in pixels"
+#define PLUG_IN_REGISTER_PEAK_DESC "Height of the correlation peak, near 1 for a good match, near 0 for unrelated images"
+#define PLUG_IN_SERVICE_IDLE_TIMEOUT_DESC "Seconds without any transform after which plans and tables are released (0 = never)"
 
 /** Fourier Functions ===================================================== **/
 
-/** Conversion functions *****************************************************/
+/** Progress *****************************************************************/
 
-inline gint round_gint(double value)
-{
-  double floored = floor(value);
-  if (value - floored > 0.5)
-  {
-    return (gint)(floored + 1);
-  }
-  return (gint)floored;
-}
+/*
+ * GIMP is only called from the plug-in thread: transforms report their
+ * progress from any thread to fourier_progress(), the plug-in thread forwards
+ * it to GIMP at most FOURIER_PROGRESS_RATE times per second, and only when
+ * it goes forward. When GIMP does not take it anymore, the transform is
+ * cancelled.
+ */
+#define FOURIER_PROGRESS_RATE 10
 
-inline gint boost(double value)
+static GThread *fourier_plugin_thread = NULL;
+static gint fourier_progress_permille = 0;
+static gint fourier_progress_sent = -1;
+static gint64 fourier_progress_time = 0;
+static gdouble fourier_progress_start = 0.0;   /* part of a batch, see fourier_batch_process() */
+static gdouble fourier_progress_span = 1.0;
+
+static void fourier_progress_flush(void)
 {
-  double bounded = fabs(value / 160.0);
-  gint boosted = round_gint(128.0 * sqrt(bounded));
-  boosted = (value > 0) ? boosted : -boosted;
-  return boosted;
+  gint permille = g_atomic_int_get(&fourier_progress_permille);
+  gint64 now = g_get_monotonic_time();
+
+  if (permille <= fourier_progress_sent ||
+      (permille < 1000 && now - fourier_progress_time < G_USEC_PER_SEC / FOURIER_PROGRESS_RATE))
+    return;
+  fourier_progress_sent = permille;
+  fourier_progress_time = now;
+  if (!gimp_progress_update(permille / 1000.0))
+    fourier_cancel();
 }
 
-inline double unboost(double value)
+static void fourier_progress(gdouble fraction)
 {
-  double bounded = fabs(value / 128.0);
-  double unboosted = 160.0 * bounded * bounded;
-  unboosted = (value > 0) ? unboosted : -unboosted;
-  return unboosted;
+  fraction = fourier_progress_start + fourier_progress_span * CLAMP(fraction, 0.0, 1.0);
+  g_atomic_int_set(&fourier_progress_permille, (gint)(fraction * 1000));
+  if (g_thread_self() == fourier_plugin_thread)
+    fourier_progress_flush();
 }
 
-inline guchar get_guchar(gint x, gint y, double d)
+/* A new transform starts, after gimp_progress_init() */
+static void fourier_progress_reset(void)
 {
-  gint i = round_gint(d);
-  // if (i > 255 || i < 0) { printf(" (%d, %d: %d) ", x, y, i); }
-  return (guchar)(i >= 255) ? 255 : ((i < 0) ? 0 : i);
+  fourier_progress_sent = -1;
+  fourier_progress_time = 0;
+  fourier_progress_start = 0.0;
+  fourier_progress_span = 1.0;
+  fourier_cancel_reset();
 }
 
-inline guchar get_gchar128(gint x, gint y, gint i)
+/** Process Functions ********************************************************/
+
+/* Rows of pixels read or written at once through GEGL, when not by tiles */
+#define FOURIER_STRIP_BYTES (4 << 20)
+
+static gint fourier_strip_rows(gint width, gint bpp)
 {
-  // if (i > 127 || i < -128) { printf(" (%d, %d: %d) ", x, y, i); }
-  return (guchar)(i >= (gint)128) ? 255 : ((i <= (gint)-128) ? 0 : i + 128);
+  return MAX(1, FOURIER_STRIP_BYTES / (width * bpp));
 }
 
-inline double get_double128(gint x, gint y, guchar c)
+/* Pixel format of a drawable, gray drawables are transformed as one channel */
+static const Babl *fourier_format(gboolean gray, gboolean alpha)
 {
-  return (double)(c)-128.0;
+  if (gray)
+    return babl_format(alpha ? "Y'A u8" : "Y' u8");
+  return babl_format(alpha ? "R'G'B'A u8" : "R'G'B' u8");
 }
 
-/* Should pixel store imaginary part? */
-static inline gint pixel_imag(gint row, gint col, gint h, gint w)
+/* Channels of the format that are transformed, alpha is passed through as is */
+static gint fourier_format_colors(const Babl *format)
 {
-  if (row == 0 && h % 2 == 0 || row == h / 2)
-    return col > w / 2;
-  else
-    return row > h / 2;
+  return babl_format_get_n_components(format) - (babl_format_has_alpha(format) ? 1 : 0);
 }
 
 /*
- * Map images coordinates (row, col) into Fourier array indices (row2, col2).
+ * Channels of the rect of src_buffer to transform: only the first one when
+ * all pixels are gray, as RGB scans of text often are, so that a single FFT
+ * is computed and copied to the other channels. The pixels of a record must
+ * be gray too, since the inverse adds the changes to them.
  */
-static inline void map(gint row, gint col, gint h, gint w,
-                       gint *row2, gint *col2)
+static gint fourier_buffer_planes(GeglBuffer *src_buffer, const GeglRectangle *rect,
+                                  const Babl *format, const guchar *recorded, gsize recorded_count)
 {
-  *row2 = (row + (h + 1) / 2) % h; /* shift origin */
-  *col2 = (col + (w + 1) / 2) % w;
-  if (*col2 > w / 2)
-  { /* wrap */
-    *row2 = (h - *row2) % h;
-    *col2 = w - *col2;
-  }
-  *col2 *= 2; /* unit = real number */
-  if (pixel_imag(row, col, h, w))
-    (*col2)++; /* take imaginary part */
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  gint colors = fourier_format_colors(format);
+  gboolean gray;
+  GeglBufferIterator *iter;
+
+  if (colors == 1 || (recorded && !fourier_pixels_gray(recorded, recorded_count, bpp, colors)))
+    return colors;
+
+  FOURIER_TRACE_BEGIN("gray_check");
+  gray = TRUE;
+  iter = gegl_buffer_iterator_new(src_buffer, rect, 0, format,
+                                  GEGL_ACCESS_READ, GEGL_ABYSS_NONE, 1);
+  while (gegl_buffer_iterator_next(iter))
+    if (!fourier_pixels_gray(iter->items[0].data, iter->length, bpp, colors))
+    {
+      gray = FALSE;
+      gegl_buffer_iterator_stop(iter);
+      break;
+    }
+  FOURIER_TRACE_END();
+  return gray ? 1 : colors;
 }
 
-inline double normalize(gint x, gint y, gint width, gint height)
+/* Load a rectangle of pixels, relative to the roi origin, to the scratch */
+static void fourier_scratch_load_rect(FourierScratch *scratch, const GeglRectangle *rect,
+                                      const guchar *pixels, gint bpp)
 {
-  double cx = (double)abs(x - width / 2);
-  double cy = (double)abs(y - height / 2);
-  double energy = (sqrt(cx) + sqrt(cy));
-  return energy * energy;
+  gint rowstride = rect->width * bpp;
+
+  if (!scratch->inverse)
+    fourier_scratch_load_pixels(scratch, rect->x, rect->y, rect->width, rect->height,
+                                pixels, rowstride, bpp);
+  else if (scratch->recorded)
+    fourier_scratch_load_delta(scratch, rect->x, rect->y, rect->width, rect->height,
+                               pixels, rowstride, bpp);
+  else
+    fourier_scratch_load_spectrum(scratch, rect->x, rect->y, rect->width, rect->height,
+                                  pixels, rowstride, bpp);
 }
 
-/** Process Functions ********************************************************/
-
-void process_fft_forward(guchar *src_pixels, guchar *dst_pixels, gint sel_width, gint sel_height, gint src_bpp, gint dst_bpp)
+/* Reverse of fourier_scratch_load_rect() */
+static void fourier_scratch_store_rect(FourierScratch *scratch, const GeglRectangle *rect,
+                                       guchar *pixels, gint bpp)
 {
+  gint rowstride = rect->width * bpp;
 
-  gint row, col, row2, col2, cur_bpp, bounded, padding;
-  gint progress, max_progress;
-  fftw_plan p;
-  double v, norm;
-  double *fft_real;
-
-  padding = (sel_width & 1) ? 1 : 2;
-
-  fft_real = g_new(double, (sel_width + padding) * sel_height);
-
-  progress = 0;
-  max_progress = src_bpp * 3;
+  if (!scratch->inverse)
+    fourier_scratch_store_spectrum(scratch, rect->x, rect->y, rect->width, rect->height,
+                                   pixels, rowstride, bpp);
+  else
+  {
+    if (scratch->recorded)
+      fourier_scratch_add_recorded(scratch, rect->x, rect->y, rect->width, rect->height, bpp);
+    fourier_scratch_store_pixels(scratch, rect->x, rect->y, rect->width, rect->height,
+                                 pixels, rowstride, bpp);
+  }
+}
 
-  p = fftw_plan_dft_r2c_2d(sel_height, sel_width, fft_real, (fftw_complex *)fft_real, FFTW_ESTIMATE);
+/*
+ * Tiles written to a record are copied to a band of the rows across them,
+ * written once the last tile of the band is done, so that the record is
+ * written in order from the tiles of the iterator.
+ */
+static void fourier_record_write_tile(FILE *record, guchar **band, const GeglRectangle *rect,
+                                      const guchar *pixels, gint width, gint bpp)
+{
+  gint row;
+
+  if (rect->x == 0)
+    *band = g_renew(guchar, *band, (gsize)rect->height * width * bpp);
+  for (row = 0; row < rect->height; row++)
+    memcpy(*band + ((gsize)row * width + rect->x) * bpp,
+           pixels + (gsize)row * rect->width * bpp, (gsize)rect->width * bpp);
+  if (rect->x + rect->width == width)
+    fwrite(*band, bpp, (gsize)rect->height * width, record);
+}
 
-  for (cur_bpp = 0; cur_bpp < src_bpp; cur_bpp++)
+/*
+ * Fill the scratch from src_buffer at the roi origin, pixels of the roi for
+ * the forward transform, spectrum of the scratch size for the inverse one.
+ * Tiles are read in place through a GEGL iterator, straight into the planes
+ * of the scratch, so that no copy of the selection is made. The pixels of a
+ * recorded forward transform are written to the record from the same tiles.
+ */
+static void fourier_scratch_load_buffer(FourierScratch *scratch, GeglBuffer *src_buffer,
+                                        const GeglRectangle *roi, const Babl *format)
+{
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  gint width = scratch->inverse ? scratch->width : scratch->image_width;
+  gint height = scratch->inverse ? scratch->height : scratch->image_height;
+  GeglBufferIterator *iter;
+  GeglRectangle rect;
+  guchar *band = NULL;
+
+  iter = gegl_buffer_iterator_new(src_buffer, GEGL_RECTANGLE(roi->x, roi->y, width, height), 0,
+                                  format, GEGL_ACCESS_READ, GEGL_ABYSS_NONE, 1);
+  FOURIER_TRACE_BEGIN("gegl_buffer_get");
+  while (gegl_buffer_iterator_next(iter))
   {
-    for (col = 0; col < sel_width; col++)
+    FOURIER_TRACE_END();
+    rect = iter->items[0].roi;
+    rect.x -= roi->x;
+    rect.y -= roi->y;
+    FOURIER_TRACE_BEGIN(scratch->inverse ? "unquantize" : "deinterleave");
+    fourier_scratch_load_rect(scratch, &rect, iter->items[0].data, bpp);
+    if (scratch->record)
+      fourier_record_write_tile(scratch->record, &band, &rect, iter->items[0].data, width, bpp);
+    // rows of the scratch are dropped once the last tile across them is done
+    if (rect.x + rect.width == width)
     {
-      for (row = 0; row < sel_height; row++)
-      {
-        v = (double)src_pixels[(row * sel_width + col) * src_bpp + cur_bpp];
-        fft_real[row * (sel_width + padding) + col] = v;
-      }
+      fourier_scratch_release(scratch, 0, scratch->plane_size * scratch->planes);
+      fourier_progress((double)(rect.y + rect.height) / height / 3);
     }
-    gimp_progress_update((double)++progress / max_progress);
-    fftw_execute(p);
-    gimp_progress_update((double)++progress / max_progress);
-
-    for (row = 0; row < sel_height; row++)
+    FOURIER_TRACE_END();
+    FOURIER_TRACE_BEGIN("gegl_buffer_get");
+    if (fourier_cancelled())
     {
-      for (col = 0; col < sel_width; col++)
-      {
-        map(row, col, sel_height, sel_width, &row2, &col2);
-        v = fft_real[row2 * (sel_width + padding) + col2] / (double)(sel_width * sel_height);
-        norm = normalize(col, row, sel_width, sel_height);
-        bounded = boost(v * norm);
-        dst_pixels[(row * sel_width + col) * dst_bpp + cur_bpp] = get_gchar128(col, row, bounded);
-      }
+      gegl_buffer_iterator_stop(iter);
+      break;
     }
-    // do not boost (0, 0), just offset it
-    row = sel_height / 2;
-    col = sel_width / 2;
-    bounded = round_gint((fft_real[0] / (double)(sel_width * sel_height)) - 128.0);
-    dst_pixels[(row * sel_width + col) * dst_bpp + cur_bpp] = get_gchar128(col, row, bounded);
-    gimp_progress_update((double)++progress / max_progress);
   }
+  FOURIER_TRACE_END();
+  g_free(band);
 
-  fftw_destroy_plan(p);
-  g_free(fft_real);
+  if (fourier_cancelled())
+    return;
+  if (scratch->inverse)
+  {
+    FOURIER_TRACE_BEGIN("unquantize");
+    fourier_scratch_restore_redundancy(scratch);
+    FOURIER_TRACE_END();
+  }
+  else
+  {
+    FOURIER_TRACE_BEGIN("deinterleave");
+    fourier_scratch_extend(scratch);
+    FOURIER_TRACE_END();
+  }
 }
 
-void process_fft_inverse(guchar *src_pixels, guchar *dst_pixels, gint sel_width, gint sel_height, gint src_bpp, gint dst_bpp)
+/*
+ * Reverse of fourier_scratch_load_buffer(), once the scratch is transformed.
+ * The alpha channel of the format is copied from the same pixels of
+ * src_buffer, color channels that were not transformed from the first one.
+ */
+static void fourier_scratch_store_buffer(FourierScratch *scratch, GeglBuffer *dest_buffer,
+                                         GeglBuffer *src_buffer, const GeglRectangle *roi,
+                                         const Babl *format)
 {
-
-  gint row, col, row2, col2, cur_bpp, bounded, padding;
-  gint progress, max_progress;
-  fftw_plan p;
-  double v, norm;
-  double *fft_real;
-
-  padding = (sel_width & 1) ? 1 : 2;
-
-  fft_real = g_new(double, (sel_width + padding) * sel_height);
-
-  progress = 0;
-  max_progress = src_bpp * 3;
-
-  p = fftw_plan_dft_c2r_2d(sel_height, sel_width, (fftw_complex *)fft_real, fft_real, FFTW_ESTIMATE);
-
-  for (cur_bpp = 0; cur_bpp < src_bpp; cur_bpp++)
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  gint colors = fourier_format_colors(format);
+  gboolean alpha = (colors < bpp);
+  // pixels of a luma inverse have all their channels, its spectrum only one
+  gint planes = (scratch->luma && scratch->inverse) ? colors : scratch->planes;
+  gint width = scratch->inverse ? scratch->image_width : scratch->width;
+  gint height = scratch->inverse ? scratch->image_height : scratch->height;
+  GeglBufferIterator *iter;
+  GeglRectangle rect;
+  guchar *band = NULL;
+
+  iter = gegl_buffer_iterator_new(dest_buffer, GEGL_RECTANGLE(roi->x, roi->y, width, height), 0,
+                                  format, GEGL_ACCESS_WRITE, GEGL_ABYSS_NONE, 2);
+  if (alpha)
+    gegl_buffer_iterator_add(iter, src_buffer, GEGL_RECTANGLE(roi->x, roi->y, width, height), 0,
+                             format, GEGL_ACCESS_READ, GEGL_ABYSS_NONE);
+  FOURIER_TRACE_BEGIN("gegl_buffer_set");
+  while (gegl_buffer_iterator_next(iter))
   {
-    for (row = 0; row < sel_height; row++)
-    {
-      for (col = 0; col < sel_width; col++)
-      {
-        map(row, col, sel_height, sel_width, &row2, &col2);
-        norm = normalize(col, row, sel_width, sel_height);
-        v = get_double128(row, col, src_pixels[(row * sel_width + col) * src_bpp + cur_bpp]);
-        fft_real[row2 * (sel_width + padding) + col2] = unboost(v) / norm;
-      }
-    }
-    // restore redundancy
-    for (col2 = 0; col2 < sel_width + padding; col2 += (sel_width + 1) / 2 * 2)
+    FOURIER_TRACE_END();
+    rect = iter->items[0].roi;
+    rect.x -= roi->x;
+    rect.y -= roi->y;
+    FOURIER_TRACE_BEGIN(scratch->inverse ? "interleave" : "quantize");
+    if (alpha)
+      memcpy(iter->items[0].data, iter->items[1].data, (gsize)iter->length * bpp);
+    fourier_scratch_store_rect(scratch, &rect, iter->items[0].data, bpp);
+    fourier_pixels_replicate(iter->items[0].data, iter->length, bpp, planes, colors);
+    if (scratch->record)
+      fourier_record_write_tile(scratch->record, &band, &rect, iter->items[0].data, width, bpp);
+    if (rect.x + rect.width == width)
     {
-      for (row2 = 1; row2 < (sel_height + 1) / 2; row2++)
-      {
-        fft_real[(sel_height - row2) * (sel_width + padding) + col2 + 1] = -fft_real[row2 * (sel_width + padding) + col2 + 1];
-        fft_real[row2 * (sel_width + padding) + col2] = fft_real[(sel_height - row2) * (sel_width + padding) + col2];
-      }
-      fft_real[col2 + 1] = 0;
-      if (sel_height % 2 == 0)
-        fft_real[sel_height / 2 * (sel_width + padding) + col2 + 1] = 0;
+      fourier_scratch_release(scratch, 0, scratch->plane_size * scratch->planes);
+      fourier_progress((2.0 + (double)(rect.y + rect.height) / height) / 3);
     }
-    // do not unboost (0, 0), just offset it
-    row = sel_height / 2;
-    col = sel_width / 2;
-    v = get_double128(row, col, src_pixels[(row * sel_width + col) * src_bpp + cur_bpp]);
-    fft_real[0] = v + 128.0;
-
-    gimp_progress_update((double)++progress / max_progress);
-    fftw_execute(p);
-    gimp_progress_update((double)++progress / max_progress);
-    for (col = 0; col < sel_width; col++)
+    FOURIER_TRACE_END();
+    FOURIER_TRACE_BEGIN("gegl_buffer_set");
+    if (fourier_cancelled())
     {
-      for (row = 0; row < sel_height; row++)
-      {
-        v = fft_real[row * (sel_width + padding) + col];
-        dst_pixels[(row * sel_width + col) * dst_bpp + cur_bpp] = get_guchar(col, row, v);
-      }
+      gegl_buffer_iterator_stop(iter);
+      break;
     }
-    gimp_progress_update((double)++progress / max_progress);
   }
-
-  fftw_destroy_plan(p);
-  g_free(fft_real);
+  FOURIER_TRACE_END();
+  g_free(band);
 }
 
+/*
+ * The FFT of a scratch runs on a worker thread, while the plug-in thread
+ * forwards its progress. GEGL buffers are only read and written from the
+ * plug-in thread, their tiles come from GIMP.
+ */
+typedef struct
+{
+  FourierScratch *scratch;
+  const FourierFilter *filter;      /* round trip scratch only */
+  GThread *thread;
+  GMutex mutex;
+  GCond cond;
+  gboolean done;
+} FourierWorker;
+
+static gpointer fourier_worker_execute(gpointer data)
+{
+  FourierWorker *worker = data;
+
+  FOURIER_TRACE_BEGIN("execute");
+  if (worker->filter)
+    fourier_scratch_execute_filter(worker->scratch, worker->filter);
+  else
+    fourier_scratch_execute(worker->scratch);
+  FOURIER_TRACE_END();
+  g_mutex_lock(&worker->mutex);
+  worker->done = TRUE;
+  g_cond_signal(&worker->cond);
+  g_mutex_unlock(&worker->mutex);
+  return NULL;
+}
 
-/** GIMP Plugin Part ====================================================== **/
+/* The plug-in thread is free until fourier_worker_wait() */
+static void fourier_worker_start(FourierWorker *worker, FourierScratch *scratch,
+                                 const FourierFilter *filter)
+{
+  worker->scratch = scratch;
+  worker->filter = filter;
+  worker->done = FALSE;
+  g_mutex_init(&worker->mutex);
+  g_cond_init(&worker->cond);
+  worker->thread = g_thread_new("fourier-execute", fourier_worker_execute, worker);
+}
 
-#if (GIMP_MAJOR_VERSION == 3) || ((GIMP_MAJOR_VERSION == 2) && (GIMP_MINOR_VERSION >= 99))
-/** GIMP 3 *******************************************************************/
+static void fourier_worker_wait(FourierWorker *worker)
+{
+  g_mutex_lock(&worker->mutex);
+  while (!worker->done)
+    if (!g_cond_wait_until(&worker->cond, &worker->mutex,
+                           g_get_monotonic_time() + G_USEC_PER_SEC / FOURIER_PROGRESS_RATE))
+    {
+      g_mutex_unlock(&worker->mutex);
+      fourier_progress_flush();
+      g_mutex_lock(&worker->mutex);
+    }
+  g_mutex_unlock(&worker->mutex);
+  g_thread_join(worker->thread);
+  g_mutex_clear(&worker->mutex);
+  g_cond_clear(&worker->cond);
+}
 
-// based on hot.c bundled GIMP plugin
+static void fourier_scratch_execute_worker(FourierScratch *scratch)
+{
+  FourierWorker worker;
 
-#include <libgimp/gimpui.h>
+  fourier_worker_start(&worker, scratch, NULL);
+  fourier_worker_wait(&worker);
+}
 
-//#define FOURIER_USE_DIALOG  false
+/** NPY files ****************************************************************/
 
-typedef struct _Fourier Fourier;
-typedef struct _FourierClass FourierClass;
+/*
+ * Spectra are exchanged as NPY arrays of complex values of shape
+ * (channels, height, width / 2 + 1), which is the layout of the scratch, so
+ * that the scratch can be mapped right on the file. Values are those fed to
+ * the inverse transform: the forward FFT divided by width * height, as
+ * numpy.fft.rfft2(..., norm="forward") gives.
+ */
+#define FOURIER_NPY_MAGIC "\x93NUMPY"
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define FOURIER_NPY_ORDER '<'
+#else
+#define FOURIER_NPY_ORDER '>'
+#endif
 
-struct _Fourier
+/* Version 1.0 header, padded so that data is aligned on 64 bytes */
+static GString *fourier_npy_header(gint planes, gint height, gint columns)
 {
-  GimpPlugIn parent_instance;
-};
+  GString *header = g_string_new(FOURIER_NPY_MAGIC "\x01");
+  gsize length;
+
+  g_string_append_c(header, '\0');
+  g_string_append(header, "..");
+  g_string_append_printf(header, "{'descr': '%cc%d', 'fortran_order': False, 'shape': (%d, %d, %d), }",
+                         FOURIER_NPY_ORDER, (gint)(2 * sizeof(fourier_real)),
+                         planes, height, columns);
+  while ((header->len + 1) % 64)
+    g_string_append_c(header, ' ');
+  g_string_append_c(header, '\n');
+
+  length = header->len - 10;
+  header->str[8] = (gchar)(length & 0xff);
+  header->str[9] = (gchar)(length >> 8);
+  return header;
+}
 
-struct _FourierClass
+/*
+ * Check the header of a NPY file of length bytes and get the offset, size of
+ * values (8 or 16 bytes for complex64 or complex128) and shape of its data.
+ */
+static gboolean fourier_npy_parse(const gchar *data, gsize length,
+                                  gsize *offset, gint *value_size, gint shape[3],
+                                  GError **error)
 {
-  GimpPlugInClass parent_class;
-};
+  gchar *header, *descr, *fortran, *dims;
+  gsize header_length;
+  gboolean valid;
 
-#define FOURIER_TYPE (fourier_get_type())
-#define FOURIER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), FOURIER_TYPE, Fourier))
+  if (length < 12 || memcmp(data, FOURIER_NPY_MAGIC, 6) != 0)
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, _("Not a NPY file"));
+    return FALSE;
+  }
+  if (data[6] == 1)
+  {
+    header_length = (guchar)data[8] | ((guchar)data[9] << 8);
+    *offset = 10 + header_length;
+  }
+  else
+  {
+    header_length = (guchar)data[8] | ((guchar)data[9] << 8) |
+                    ((gsize)(guchar)data[10] << 16) | ((gsize)(guchar)data[11] << 24);
+    *offset = 12 + header_length;
+  }
+  if (*offset > length)
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, _("Truncated NPY file"));
+    return FALSE;
+  }
 
-#define FOURIER_DATA_DIR    (gpointer) 0x01
-#define FOURIER_DATA_INV    (gpointer) 0x02
+  // The header is a python dict, such as {'descr': '<c16', 'fortran_order': False, 'shape': (3, 6, 5), }
+  header = g_strndup(data + *offset - header_length, header_length);
+  descr = strstr(header, "'descr':");
+  fortran = strstr(header, "'fortran_order':");
+  dims = strstr(header, "'shape':");
+  if (descr)
+    descr = strchr(descr + 8, '\'');
+  if (fortran)
+    fortran += 16 + strspn(fortran + 16, " ");
+  if (dims)
+    dims = strchr(dims + 8, '(');
+  valid = descr && fortran && dims &&
+          strncmp(fortran, "False", 5) == 0 &&
+          descr[1] == FOURIER_NPY_ORDER && descr[2] == 'c' &&
+          sscanf(descr + 3, "%d", value_size) == 1 &&
+          (*value_size == 8 || *value_size == 16) &&
+          sscanf(dims, "(%d, %d, %d)", &shape[0], &shape[1], &shape[2]) == 3;
+  g_free(header);
+
+  if (!valid)
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                _("NPY file is not a native complex64 or complex128 array of shape (channels, height, width / 2 + 1)"));
+    return FALSE;
+  }
+  return TRUE;
+}
 
-GType fourier_get_type(void) G_GNUC_CONST;
+/* Scale the forward spectrum the way the inverse transform expects it */
+static void fourier_scratch_normalize(FourierScratch *scratch)
+{
+  fourier_real scale = (fourier_real)(1.0 / ((double)scratch->width * scratch->height));
+  gsize row, col;
+  fourier_real *data;
 
-static GList *fourier_query_procedures(GimpPlugIn *plug_in);
-static GimpProcedure *fourier_create_procedure(GimpPlugIn *plug_in,
-                                               const gchar *name);
-gboolean fourier_set_i18n ( GimpPlugIn* plug_in, const gchar* procedure_name,
-                            gchar** gettext_domain, gchar** catalog_dir);
+  for (row = 0; row < (gsize)scratch->height * scratch->planes; row++)
+  {
+    data = scratch->fft_real + row * scratch->stride;
+    for (col = 0; col < (gsize)scratch->stride; col++)
+      data[col] *= scale;
+    fourier_scratch_release(scratch, row * scratch->stride, scratch->stride);
+  }
+}
 
-static GimpValueArray *fourier_run(GimpProcedure *procedure,
-                                   GimpRunMode run_mode,
-                                   GimpImage *image,
-                                   GimpDrawable **drawables,
-                                   GimpProcedureConfig *config,
-                                   gpointer run_data);
+/*
+ * Fill the inverse scratch spectrum with the transformed forward scratch as
+ * it is read back once quantized to pixels.
+ */
+static void fourier_scratch_requantize(FourierScratch *forward, FourierScratch *spectrum)
+{
+  gint bpp = forward->planes;
+  gint strip_rows = fourier_strip_rows(forward->width, bpp);
+  gint row, rows;
+  guchar *pixels;
 
-#if FOURIER_USE_DIALOG
-static gboolean plugin_dialog(GimpProcedure *procedure,
-                              GObject *config);
+  pixels = g_new(guchar, (gsize)strip_rows * forward->width * bpp);
+  for (row = 0; row < forward->height; row += strip_rows)
+  {
+    rows = MIN(strip_rows, forward->height - row);
+    fourier_scratch_store_spectrum(forward, 0, row, forward->width, rows,
+                                   pixels, forward->width * bpp, bpp);
+    fourier_scratch_load_spectrum(spectrum, 0, row, spectrum->width, rows,
+                                  pixels, spectrum->width * bpp, bpp);
+    fourier_scratch_release(forward, 0, forward->plane_size * forward->planes);
+    fourier_scratch_release(spectrum, 0, spectrum->plane_size * spectrum->planes);
+  }
+  fourier_scratch_restore_redundancy(spectrum);
+  g_free(pixels);
+}
+
+/*
+ * Write the spectrum of the roi of src_buffer to a NPY file, as computed or
+ * as quantized by the forward transform. Where possible the file is mapped
+ * and used as the scratch itself.
+ */
+static gboolean fourier_npy_export(GeglBuffer *src_buffer, const GeglRectangle *roi,
+                                   const Babl *format, const gchar *filename,
+                                   gboolean quantized, GError **error)
+{
+  gint planes = fourier_format_colors(format);
+  FourierScratch *spectrum = NULL, *forward;
+  gboolean in_file = FALSE, success = TRUE;
+  GString *header;
+  gsize bytes;
+  FILE *file;
+
+  file = g_fopen(filename, "w+b");
+  if (!file)
+  {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                _("Could not open '%s' for writing: %s"), filename, g_strerror(errno));
+    return FALSE;
+  }
+  header = fourier_npy_header(planes, roi->height, roi->width / 2 + 1);
+  fwrite(header->str, 1, header->len, file);
+  fflush(file);
+  fourier_progress_reset();
+
+#ifdef FOURIER_HAVE_MMAP
+  spectrum = fourier_scratch_new_full(roi->width, roi->height, planes, quantized,
+                                      fileno(file), header->len);
+  in_file = (spectrum != NULL);
 #endif
+  if (!spectrum)
+    spectrum = fourier_scratch_new(roi->width, roi->height, planes, quantized);
 
-G_DEFINE_TYPE(Fourier, fourier, GIMP_TYPE_PLUG_IN)
+  if (!quantized)
+  {
+    fourier_scratch_load_buffer(spectrum, src_buffer, roi, format);
+    fourier_scratch_execute_worker(spectrum);
+    fourier_progress(2.0 / 3);
+    fourier_scratch_normalize(spectrum);
+  }
+  else
+  {
+    forward = fourier_scratch_new(roi->width, roi->height, planes, FALSE);
+    fourier_scratch_load_buffer(forward, src_buffer, roi, format);
+    fourier_scratch_execute_worker(forward);
+    fourier_progress(2.0 / 3);
+    fourier_scratch_requantize(forward, spectrum);
+    fourier_scratch_free(forward);
+  }
 
-GIMP_MAIN(FOURIER_TYPE)
+  if (fourier_cancelled())
+  {
+    fourier_scratch_free(spectrum);
+    fclose(file);
+    g_unlink(filename);
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INTR, _("Fourier transform cancelled"));
+    g_string_free(header, TRUE);
+    return FALSE;
+  }
+  if (!in_file)
+  {
+    bytes = spectrum->plane_size * planes * sizeof(fourier_real);
+    success = (fwrite(spectrum->fft_real, 1, bytes, file) == bytes);
+  }
+  fourier_scratch_free(spectrum);
+  if (fclose(file) != 0 || !success)
+  {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                _("Could not write '%s': %s"), filename, g_strerror(errno));
+    success = FALSE;
+  }
+  fourier_progress(1.0);
 
-typedef enum
-{
-  MODE_FORWARD,
-  MODE_INVERSE
-} fourierModes;
+  g_string_free(header, TRUE);
+  return success;
+}
 
-static void
-fourier_class_init(FourierClass *klass)
+/*
+ * Inverse transform the spectrum of a NPY file into the roi of dest_buffer,
+ * alpha being copied from src_buffer. The file is mapped and copied to the
+ * scratch, which is transformed in place and must not alter the file.
+ */
+static gboolean fourier_npy_import(GeglBuffer *dest_buffer, GeglBuffer *src_buffer,
+                                   const GeglRectangle *roi, const Babl *format,
+                                   const gchar *filename, GError **error)
 {
-  GimpPlugInClass *plug_in_class = GIMP_PLUG_IN_CLASS(klass);
+  gint planes = fourier_format_colors(format);
+  gint half = roi->width / 2 + 1;
+  gint shape[3], value_size;
+  gsize offset, length, row, col;
+  const gchar *data;
+  GMappedFile *file;
+  FourierScratch *scratch;
+  fourier_real *dst;
+
+  file = g_mapped_file_new(filename, FALSE, error);
+  if (!file)
+    return FALSE;
+  data = g_mapped_file_get_contents(file);
+  length = g_mapped_file_get_length(file);
+
+  if (!fourier_npy_parse(data, length, &offset, &value_size, shape, error))
+  {
+    g_mapped_file_unref(file);
+    return FALSE;
+  }
+  if (shape[0] != planes || shape[1] != roi->height || shape[2] != half ||
+      offset + (gsize)planes * roi->height * half * value_size > length)
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                _("NPY spectrum of shape (%d, %d, %d) does not match the selection, (%d, %d, %d) expected"),
+                shape[0], shape[1], shape[2], planes, roi->height, half);
+    g_mapped_file_unref(file);
+    return FALSE;
+  }
 
-  plug_in_class->query_procedures = fourier_query_procedures;
-  plug_in_class->create_procedure = fourier_create_procedure;
-  plug_in_class->set_i18n = fourier_set_i18n;
+  fourier_progress_reset();
+  scratch = fourier_scratch_new(roi->width, roi->height, planes, TRUE);
+  for (row = 0; row < (gsize)roi->height * planes; row++)
+  {
+    dst = scratch->fft_real + row * scratch->stride;
+    if (value_size == 2 * sizeof(fourier_real))
+      memcpy(dst, data + offset + row * half * value_size, half * value_size);
+    else if (value_size == 16)
+      for (col = 0; col < (gsize)scratch->stride; col++)
+        dst[col] = (fourier_real)((const double *)(data + offset))[row * scratch->stride + col];
+    else
+      for (col = 0; col < (gsize)scratch->stride; col++)
+        dst[col] = (fourier_real)((const float *)(data + offset))[row * scratch->stride + col];
+    fourier_scratch_release(scratch, row * scratch->stride, scratch->stride);
+  }
+  g_mapped_file_unref(file);
+  fourier_progress(1.0 / 3);
+
+  fourier_scratch_execute_worker(scratch);
+  fourier_progress(2.0 / 3);
+  if (!fourier_cancelled())
+    fourier_scratch_store_buffer(scratch, dest_buffer, src_buffer, roi, format);
+  fourier_progress(1.0);
+  fourier_scratch_free(scratch);
+  if (fourier_cancelled())
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INTR, _("Fourier transform cancelled"));
+    return FALSE;
+  }
+  return TRUE;
 }
 
-static void
-fourier_init(Fourier *fourier)
+
+/** Forward records **********************************************************/
+
+/*
+ * The forward transform records the selection pixels and its spectrum image
+ * in a cache file named after a random token, kept in a parasite of the
+ * drawable saved with the image, so that a saved spectrum can be inverted
+ * from its record after it is opened again. The inverse transform of the edited
+ * spectrum is then computed from the difference to the recorded spectrum
+ * only, added to the recorded pixels: unchanged frequencies are restored
+ * exactly and sparse edits are fast.
+ */
+#define FOURIER_RECORD_MAGIC 0x52464f47
+#define FOURIER_RECORD_PARASITE "fourier-record"
+/* Token of a luma spectrum, whose chroma is only kept by its record */
+#define FOURIER_LUMA_PARASITE "fourier-luma"
+#define FOURIER_RECORD_MAX_AGE (7 * 24 * 3600)
+
+typedef struct
 {
+  guint32 magic;
+  guint32 bpp;
+  guint64 token;
+  gint32 x, y, width, height;
+  guint32 luma;           /* spectrum of the luma only, the pixels keep the chroma */
+  guint32 reserved;
+} FourierRecordHeader;
+
+static gchar *fourier_record_filename(guint64 token)
+{
+  gchar name[32];
+
+  g_snprintf(name, sizeof(name), "record-%016" G_GINT64_MODIFIER "x", token);
+  return g_build_filename(gimp_directory(), "fourier-cache", name, NULL);
 }
 
-// Override standard i18n to specialize
-gboolean fourier_set_i18n (
-  GimpPlugIn* plug_in,
-  const gchar* procedure_name,
-  gchar** gettext_domain,
-  gchar** catalog_dir
-)
+/* Records left by earlier sessions are removed after a while */
+static void fourier_record_expire(const gchar *dirname)
 {
-  *gettext_domain = g_strdup(GETTEXT_PACKAGE3);
-#ifdef GETTEXT_FORCEDIMPLOCALEDIRECTORY
-  *catalog_dir = g_strdup(gimp_locale_directory());
-#endif
-  return TRUE;
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  const gchar *name;
+  gchar *filename;
+  GStatBuf info;
+
+  if (!dir)
+    return;
+  while ((name = g_dir_read_name(dir)))
+  {
+    filename = g_build_filename(dirname, name, NULL);
+    if (g_stat(filename, &info) == 0 && time(NULL) - info.st_mtime > FOURIER_RECORD_MAX_AGE)
+      g_unlink(filename);
+    g_free(filename);
+  }
+  g_dir_close(dir);
 }
 
 /*
-// This was the previous code before using set_i18n function, to be included in query & run
-#ifdef HAVE_GETTEXT
-    setlocale (LC_ALL, "");
-    bindtextdomain (GETTEXT_PACKAGE3, gimp_locale_directory ());
-#ifdef HAVE_BIND_TEXTDOMAIN_CODESET
-    bind_textdomain_codeset (GETTEXT_PACKAGE3, "UTF-8");
-#endif
-    textdomain (GETTEXT_PACKAGE3);
-#endif
-*/
+ * Open a record for the forward transform of roi, padded to padded_width *
+ * padded_height, to be passed to fourier_batch_process() then closed by
+ * fourier_record_close(). The pixels and the spectrum image take about twice
+ * the selection on disk: NULL is returned above fvals.record_limit, when the
+ * scratch would be mapped on a temporary file, or if the record cannot be
+ * written. The previous record of the drawable, when previous is not NULL,
+ * is removed, as it is not the one of its spectrum anymore.
+ */
+static FILE *fourier_record_create(const guint64 *previous, const GeglRectangle *roi,
+                                   gint padded_width, gint padded_height,
+                                   const Babl *format, gboolean luma, guint64 *token)
+{
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  FourierRecordHeader header = { FOURIER_RECORD_MAGIC, bpp, 0, roi->x, roi->y, roi->width, roi->height,
+                                 luma, 0 };
+  guint64 bytes = sizeof(header) + (guint64)roi->width * roi->height * bpp +
+                  (guint64)padded_width * padded_height * bpp;
+  gchar *filename, *dirname;
+  FILE *file = NULL;
+
+  if (previous)
+  {
+    filename = fourier_record_filename(*previous);
+    g_unlink(filename);
+    g_free(filename);
+  }
 
-static GList *
-fourier_query_procedures(GimpPlugIn *plug_in)
+  header.token = ((guint64)g_random_int() << 32) | g_random_int();
+  filename = fourier_record_filename(header.token);
+  dirname = g_path_get_dirname(filename);
+  g_mkdir_with_parents(dirname, 0700);
+  fourier_record_expire(dirname);
+
+  if (bytes <= (guint64)fvals.record_limit * 1024 * 1024 &&
+      fourier_scratch_in_memory(padded_width, padded_height, luma ? 1 : fourier_format_colors(format)))
+    file = g_fopen(filename, "wb");
+  if (file)
+  {
+    *token = header.token;
+    fwrite(&header, sizeof(header), 1, file);
+  }
+
+  g_free(dirname);
+  g_free(filename);
+  return file;
+}
+
+/* The record can be used, and its token kept, only if TRUE is returned */
+static gboolean fourier_record_close(FILE *file)
 {
-#if FOURIER_USE_DIALOG
-  // If using dialog, we define only one procedure
-  return g_list_append(NULL, g_strdup(PLUG_IN_PROC));
-#else
-  // If not using dialog, we define all procedures
-  return g_list_append(
-            g_list_append(NULL, g_strdup(PLUG_IN_DIR_PROC)),
-            g_strdup(PLUG_IN_INV_PROC)
-         );
-#endif
+  gboolean success = !ferror(file);
+
+  return (fclose(file) == 0) && success;
 }
 
-static GimpProcedure *
-fourier_create_procedure(GimpPlugIn *plug_in,
-                         const gchar *name)
+/*
+ * Map the record of token if it matches the roi, its contents are then the
+ * header, the pixels and the spectrum image of padded_width * padded_height.
+ * luma tells whether the spectrum is the one of the luma only.
+ */
+static GMappedFile *fourier_record_open(guint64 token, const GeglRectangle *roi,
+                                        gint padded_width, gint padded_height, gint bpp,
+                                        gboolean *luma)
 {
-  GimpProcedure *procedure = NULL;
+  const FourierRecordHeader *header;
+  GMappedFile *file;
+  gchar *filename;
+
+  filename = fourier_record_filename(token);
+  file = g_mapped_file_new(filename, FALSE, NULL);
+  g_free(filename);
+  if (!file)
+    return NULL;
+
+  header = (const FourierRecordHeader *)g_mapped_file_get_contents(file);
+  if (g_mapped_file_get_length(file) != sizeof(*header) + (gsize)roi->width * roi->height * bpp +
+                                         (gsize)padded_width * padded_height * bpp ||
+      header->magic != FOURIER_RECORD_MAGIC || header->token != token || header->bpp != (guint32)bpp ||
+      header->x != roi->x || header->y != roi->y ||
+      header->width != roi->width || header->height != roi->height)
+  {
+    g_mapped_file_unref(file);
+    return NULL;
+  }
+  *luma = header->luma;
+  return file;
+}
 
+static const guchar *fourier_record_data(GMappedFile *file)
+{
+  return (const guchar *)g_mapped_file_get_contents(file) + sizeof(FourierRecordHeader);
+}
 
 
-#if FOURIER_USE_DIALOG
-  if (!strcmp(name, PLUG_IN_PROC))
-  {
-    // One for all procedure with dialog
-    procedure = gimp_image_procedure_new(plug_in, name,
-                                         GIMP_PDB_PROC_TYPE_PLUGIN,
-                                         fourier_run, NULL, NULL);
+/** Padding ******************************************************************/
 
-    gimp_procedure_set_image_types(procedure, "RGB");
-    gimp_procedure_set_sensitivity_mask(procedure,
-                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE);
+/*
+ * A padded forward transform grows the layer to the padded size, with the
+ * canvas if it does not fit anymore, and keeps the sizes before in a
+ * parasite of the layer, saved in XCF files, so that the inverse transform
+ * crops back to them.
+ */
+#define FOURIER_PADDING_PARASITE "fourier-padding"
 
-    gimp_procedure_set_menu_label(procedure, _("_Fourier..."));
-    gimp_procedure_add_menu_path(procedure, PLUG_IN_MENU_LOCATION);
+typedef struct
+{
+  gint32 width, height;                 /* layer before padding */
+  gint32 canvas_width, canvas_height;   /* image before padding */
+} FourierPadding;
 
-    gimp_procedure_set_documentation(procedure,
-    /* menu entry short one-liner */ _(PLUG_IN_DIR_SHORT_DESC),
-    /* detailed help description */  _(PLUG_IN_DIR_DESC),
+
+/** Batches ******************************************************************/
+
+/*
+ * The selections of several layers are transformed as a pipeline: while the
+ * worker thread transforms one layer, the plug-in thread writes the previous
+ * one back through GEGL and reads the next one. Two scratches take turns,
+ * each kept with its plans for the next layers of the same size. Layers are
+ * prepared just before they are read and finished just after they are
+ * written, so that only a few buffers and records are open at once.
+ */
+typedef struct
+{
+  gint index;                       /* of the layer in the batch */
+  gboolean inverse;
+  const FourierFilter *filter;      /* filters read pixels and write pixels */
+  gboolean prepared;
+  GeglBuffer *src_buffer;
+  GeglBuffer *dest_buffer;
+  GeglRectangle roi;                /* pixels of the selection */
+  gint padded_width, padded_height; /* spectrum, see fourier_padded_size() */
+  const Babl *format;
+  FILE *record;                     /* see fourier_record_create() */
+  GMappedFile *recorded;
+  gboolean luma;                    /* one spectrum of the luma, recorded only */
+  guint64 token;
+  FourierPadding padding;           /* sizes before padding, when padded */
+  gboolean padded;
+  FourierScratch *scratch;          /* kept from one layer to the next */
+  GError *error;                    /* set by prepare to stop the batch */
+} FourierBatchItem;
+
+/*
+ * Fill the buffers, roi, format and records of item for the layer
+ * item->index, FALSE when there is nothing to transform in it. FALSE with
+ * item->error set stops the batch, nothing is left prepared then.
+ */
+typedef gboolean (*FourierBatchPrepare)(FourierBatchItem *item, gpointer data);
+/* Release what was prepared, the layer is written only when success is TRUE */
+typedef void (*FourierBatchFinish)(FourierBatchItem *item, gboolean success, gpointer data);
+
+/*
+ * The inverse of a luma spectrum, tagged with luma_token, needs the record of
+ * that forward, which alone keeps the chroma: without it, TRUE is returned
+ * with item->error set, rather than gray pixels.
+ */
+static gboolean fourier_batch_luma_missing(FourierBatchItem *item, guint64 luma_token, const gchar *name)
+{
+  if (item->recorded && item->luma && item->token == luma_token)
+    return FALSE;
+  if (item->recorded)
+    g_mapped_file_unref(item->recorded);
+  item->recorded = NULL;
+  g_set_error(&item->error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+              _("The colors of the luma spectrum of '%s' are only kept by the record of its FFT Forward, "
+                "which is missing: records are removed after 7 days and replaced by the next FFT Forward "
+                "of the layer. FFT Inverse would only give gray pixels, the layer is left unchanged."),
+              name);
+  return TRUE;
+}
+
+typedef struct
+{
+  gint count;
+  gint next;                        /* index of the next layer to read */
+  FourierBatchPrepare prepare;
+  FourierBatchFinish finish;
+  gpointer data;
+  GError *error;                    /* of the layer that stopped the batch */
+} FourierBatch;
+
+/*
+ * The resident service keeps the two scratches from one batch to the next,
+ * with the options their plans were made with, see fourier_service_run().
+ */
+static gboolean fourier_batch_keep = FALSE;
+static FourierScratch *fourier_batch_kept[2] = { NULL, NULL };
+static FourierVals fourier_batch_kept_vals;
+static gint64 fourier_batch_kept_time = 0;  /* monotonic, 0 when nothing is kept */
+
+static void fourier_batch_release(void)
+{
+  gint i;
+
+  for (i = 0; i < 2; i++)
+    if (fourier_batch_kept[i])
+    {
+      fourier_scratch_free(fourier_batch_kept[i]);
+      fourier_batch_kept[i] = NULL;
+    }
+  fourier_batch_kept_time = 0;
+}
+
+/* Prepare the next layer with something to transform, and read it into item */
+static void fourier_batch_load(FourierBatch *batch, FourierBatchItem *item)
+{
+  FourierScratch *scratch = item->scratch;
+  gboolean inverse = item->inverse;
+  const FourierFilter *filter = item->filter;
+  gboolean roundtrip;
+  gint planes;
+
+  while (batch->next < batch->count && !fourier_cancelled())
+  {
+    memset(item, 0, sizeof(*item));
+    item->index = batch->next++;
+    item->inverse = inverse;
+    item->filter = filter;
+    item->scratch = scratch;
+    if (!batch->prepare(item, batch->data))
+    {
+      if (item->error)
+      {
+        batch->error = item->error;
+        item->error = NULL;
+        batch->next = batch->count;
+      }
+      continue;
+    }
+    item->prepared = TRUE;
+
+    planes = item->luma ? 1 : fourier_buffer_planes(item->src_buffer,
+                                   GEGL_RECTANGLE(item->roi.x, item->roi.y,
+                                                  inverse ? item->padded_width : item->roi.width,
+                                                  inverse ? item->padded_height : item->roi.height),
+                                   item->format,
+                                   item->recorded ? fourier_record_data(item->recorded) : NULL,
+                                   (gsize)item->roi.width * item->roi.height);
+    // Scratches kept from another batch may also be of another kind
+    roundtrip = scratch && (scratch->reverse_plans[0] || scratch->reverse_plans[1]);
+    if (scratch && (scratch->width != item->padded_width || scratch->height != item->padded_height ||
+                    scratch->planes != planes || roundtrip != (filter != NULL) ||
+                    (!filter && scratch->inverse != inverse)))
+    {
+      fourier_scratch_free(scratch);
+      scratch = NULL;
+    }
+    if (scratch)
+      fourier_scratch_reset(scratch);
+    else if (filter)
+      scratch = fourier_scratch_new_roundtrip(item->padded_width, item->padded_height, planes);
+    else
+      scratch = fourier_scratch_new(item->padded_width, item->padded_height, planes, inverse);
+    item->scratch = scratch;
+
+    scratch->luma = item->luma;
+    fourier_scratch_set_image(scratch, item->roi.width, item->roi.height, fvals.padding);
+    scratch->record = item->record;
+    scratch->recorded = item->recorded ? fourier_record_data(item->recorded) : NULL;
+    fourier_scratch_load_buffer(scratch, item->src_buffer, &item->roi, item->format);
+    return;
+  }
+}
+
+/* Write the transformed item back, or drop it when cancelled, and finish it */
+static void fourier_batch_store(FourierBatch *batch, FourierBatchItem *item)
+{
+  if (!fourier_cancelled())
+    fourier_scratch_store_buffer(item->scratch, item->dest_buffer, item->src_buffer, &item->roi,
+                                 item->format);
+  batch->finish(item, !fourier_cancelled(), batch->data);
+  item->prepared = FALSE;
+}
+
+/*
+ * Transform count layers, prepared and finished by the callbacks, or filter
+ * them when filter is not NULL. Each layer reports its progress in its part
+ * of the batch. FALSE is returned when the batch is cancelled, or stopped by
+ * a layer that cannot be transformed, with error set: the layers finished
+ * before are kept, the others are left as they were.
+ */
+static gboolean fourier_batch_process(gint count, gboolean inverse, const FourierFilter *filter,
+                                      FourierBatchPrepare prepare, FourierBatchFinish finish,
+                                      gpointer data, GError **error)
+{
+  FourierBatch batch = { count, 0, prepare, finish, data, NULL };
+  FourierBatchItem items[2];
+  FourierBatchItem *running = &items[0], *other = &items[1], *swap;
+  FourierWorker worker;
+
+  memset(items, 0, sizeof(items));
+  items[0].inverse = items[1].inverse = inverse;
+  items[0].filter = items[1].filter = filter;
+  if (fourier_batch_kept_time &&
+      (fourier_batch_kept_vals.threads != fvals.threads || fourier_batch_kept_vals.rigor != fvals.rigor ||
+       fourier_batch_kept_vals.memory_limit != fvals.memory_limit))
+    fourier_batch_release();
+  items[0].scratch = fourier_batch_kept[0];
+  items[1].scratch = fourier_batch_kept[1];
+  fourier_batch_kept[0] = fourier_batch_kept[1] = NULL;
+  fourier_progress_reset();
+  fourier_progress_span = 1.0 / MAX(count, 1);
+
+  fourier_batch_load(&batch, running);
+  while (running->prepared && !fourier_cancelled())
+  {
+    // Set before the worker starts, it only reads them
+    fourier_progress_start = (double)running->index / count;
+    fourier_progress(1.0 / 3);
+    fourier_worker_start(&worker, running->scratch, filter);
+    if (other->prepared)
+      fourier_batch_store(&batch, other);
+    fourier_batch_load(&batch, other);
+    fourier_worker_wait(&worker);
+    fourier_progress(2.0 / 3);
+
+    swap = running;
+    running = other;
+    other = swap;
+  }
+
+  // The last layer is written, layers still open are dropped when cancelled
+  if (other->prepared)
+    fourier_batch_store(&batch, other);
+  if (running->prepared)
+    fourier_batch_store(&batch, running);
+  if (fourier_batch_keep)
+  {
+    fourier_batch_kept[0] = items[0].scratch;
+    fourier_batch_kept[1] = items[1].scratch;
+    fourier_batch_kept_vals = fvals;
+    fourier_batch_kept_time = g_get_monotonic_time();
+  }
+  else
+  {
+    if (items[0].scratch)
+      fourier_scratch_free(items[0].scratch);
+    if (items[1].scratch)
+      fourier_scratch_free(items[1].scratch);
+  }
+
+  fourier_progress_start = 0.0;
+  fourier_progress_span = 1.0;
+  fourier_progress(1.0);
+  if (batch.error)
+  {
+    g_propagate_error(error, batch.error);
+    return FALSE;
+  }
+  return !fourier_cancelled();
+}
+
+
+/** Filters ******************************************************************/
+
+/*
+ * Notches are given as text, "x,y" pairs separated by spaces or semicolons,
+ * in pixels of the spectrum image of the selection, so that they can be
+ * read on the layer of FFT Forward. FALSE is returned if the text cannot be
+ * read, the pairs are to be freed with g_free() otherwise.
+ */
+static gboolean fourier_filter_set_notches(FourierFilter *filter, const gchar *text)
+{
+  gchar **pairs = g_strsplit_set(text ? text : "", " ;\t\n", -1);
+  double *notch_xy = g_new(double, 2 * (g_strv_length(pairs) + 1));
+  gboolean success = TRUE;
+  gint i, notches = 0;
+  gchar end;
+
+  for (i = 0; pairs[i] && success; i++)
+    if (*pairs[i])
+    {
+      success = sscanf(pairs[i], "%lf,%lf%c", &notch_xy[2 * notches], &notch_xy[2 * notches + 1], &end) == 2;
+      notches++;
+    }
+  g_strfreev(pairs);
+
+  if (!success)
+  {
+    g_free(notch_xy);
+    return FALSE;
+  }
+  filter->notches = notches;
+  filter->notch_xy = notch_xy;
+  return TRUE;
+}
+
+
+/** Convolution **************************************************************/
+
+/*
+ * Weights of the kernel drawable, read from buffer in format, without alpha:
+ * one plane for all channels when its pixels are gray, one per channel
+ * otherwise. Each plane is normalized to a sum of one, or else weighs the
+ * pixel values / 255, as a black plane does.
+ */
+static double *fourier_kernel_read(GeglBuffer *buffer, const Babl *format, gboolean normalize,
+                                   gint *width, gint *height, gint *planes)
+{
+  const GeglRectangle *extent = gegl_buffer_get_extent(buffer);
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  gsize i, count = (gsize)extent->width * extent->height;
+  guchar *pixels = g_new(guchar, count * bpp);
+  double *kernel, *plane, sum;
+  gint cur_bpp;
+
+  gegl_buffer_get(buffer, extent, 1.0, format, pixels, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  *width = extent->width;
+  *height = extent->height;
+  *planes = fourier_pixels_gray(pixels, count, bpp, bpp) ? 1 : bpp;
+
+  kernel = g_new(double, count * *planes);
+  for (cur_bpp = 0; cur_bpp < *planes; cur_bpp++)
+  {
+    plane = kernel + cur_bpp * count;
+    sum = 0.0;
+    for (i = 0; i < count; i++)
+    {
+      plane[i] = pixels[i * bpp + cur_bpp];
+      sum += plane[i];
+    }
+    for (i = 0; i < count; i++)
+      plane[i] /= (normalize && sum > 0.0) ? sum : 255.0;
+  }
+  g_free(pixels);
+  return kernel;
+}
+
+/*
+ * Convolve the roi of src_buffer into dest_buffer. The pixels around the roi
+ * that the kernel reaches are read too, those outside the buffer are
+ * extended as extension. Alpha is kept. FALSE is returned when cancelled.
+ */
+static gboolean fourier_convolve_buffer(GeglBuffer *src_buffer, GeglBuffer *dest_buffer,
+                                        const GeglRectangle *roi, const Babl *format,
+                                        const double *kernel, gint kernel_width, gint kernel_height,
+                                        gint kernel_planes, gint extension)
+{
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  FourierConvolution *conv;
+  guchar *src_pixels, *dst_pixels;
+  GeglRectangle rect;
+  gboolean success;
+
+  // The kernel is centered, see fourier_convolution_new()
+  rect.x = roi->x - (kernel_width - 1 - kernel_width / 2);
+  rect.y = roi->y - (kernel_height - 1 - kernel_height / 2);
+  rect.width = roi->width + kernel_width - 1;
+  rect.height = roi->height + kernel_height - 1;
+  gegl_rectangle_intersect(&rect, &rect, gegl_buffer_get_extent(src_buffer));
+
+  FOURIER_TRACE_BEGIN("gegl_buffer_get");
+  src_pixels = g_new(guchar, (gsize)rect.width * rect.height * bpp);
+  gegl_buffer_get(src_buffer, &rect, 1.0, format, src_pixels, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  // Only the colors are written, alpha comes from here
+  dst_pixels = g_new(guchar, (gsize)roi->width * roi->height * bpp);
+  gegl_buffer_get(src_buffer, roi, 1.0, format, dst_pixels, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  FOURIER_TRACE_END();
+
+  conv = fourier_convolution_new(kernel, kernel_width, kernel_height, kernel_planes,
+                                 roi->width, roi->height, fourier_format_colors(format));
+  success = fourier_convolution_process(conv, src_pixels, rect.width, rect.height,
+                                        roi->x - rect.x, roi->y - rect.y, dst_pixels, bpp, extension);
+  fourier_convolution_free(conv);
+
+  if (success)
+  {
+    FOURIER_TRACE_BEGIN("gegl_buffer_set");
+    gegl_buffer_set(dest_buffer, roi, 0, format, dst_pixels, GEGL_AUTO_ROWSTRIDE);
+    FOURIER_TRACE_END();
+  }
+  g_free(src_pixels);
+  g_free(dst_pixels);
+  return success;
+}
+
+
+/** Registration *************************************************************/
+
+/*
+ * Translation of the rect of buffer relative to the ref_rect of ref_buffer,
+ * of the same size, read in format without alpha, see
+ * fourier_phase_correlate().
+ */
+static gboolean fourier_register_buffers(GeglBuffer *ref_buffer, const GeglRectangle *ref_rect,
+                                         GeglBuffer *buffer, const GeglRectangle *rect,
+                                         const Babl *format, double *dx, double *dy, double *peak,
+                                         GError **error)
+{
+  gint bpp = babl_format_get_bytes_per_pixel(format);
+  gsize size = (gsize)rect->width * rect->height * bpp;
+  guchar *ref_pixels = g_new(guchar, size);
+  guchar *pixels = g_new(guchar, size);
+  gboolean success;
+
+  FOURIER_TRACE_BEGIN("gegl_buffer_get");
+  gegl_buffer_get(ref_buffer, ref_rect, 1.0, format, ref_pixels, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gegl_buffer_get(buffer, rect, 1.0, format, pixels, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  FOURIER_TRACE_END();
+
+  success = fourier_phase_correlate(ref_pixels, pixels, rect->width, rect->height, bpp, bpp, dx, dy, peak);
+  g_free(ref_pixels);
+  g_free(pixels);
+
+  if (!success)
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INTR, _("Fourier transform cancelled"));
+  return success;
+}
+
+
+/** Resident service *********************************************************/
+
+/* Options of a fresh process, each run of the service starts from them */
+static FourierVals fourier_service_vals;
+
+/*
+ * Milliseconds the resident service waits for its next request, 0 for ever.
+ * What is kept warm, plans, geometry tables and the preview proxy, is
+ * released once it has been idle for idle_timeout seconds, 0 keeps it.
+ */
+static guint fourier_service_wait(gint idle_timeout)
+{
+  gint64 idle;
+
+  if (!fourier_batch_kept_time || idle_timeout <= 0)
+    return 0;
+  idle = g_get_monotonic_time() - fourier_batch_kept_time;
+  if (idle < (gint64)idle_timeout * G_USEC_PER_SEC)
+    return (guint)(((gint64)idle_timeout * G_USEC_PER_SEC - idle) / 1000) + 1;
+
+  fourier_batch_release();
+  fourier_proxy_free();
+  fourier_geometry_cache_free();
+  return 0;
+}
+
+
+/** Core setup ***************************************************************/
+
+/* Must be called before any transform: wisdom is kept in the GIMP directory */
+static void fourier_plugin_setup(void)
+{
+  gchar *filename = g_build_filename(gimp_directory(), FOURIER_WISDOM_FILE, NULL);
+
+  fourier_plugin_thread = g_thread_self();
+  fourier_set_wisdom_file(filename);
+  fourier_set_progress_func(fourier_progress);
+  fourier_backend_init();
+  fourier_trace_init();
+  g_free(filename);
+}
+
+
+/** GIMP Plugin Part ====================================================== **/
+
+#if (GIMP_MAJOR_VERSION == 3) || ((GIMP_MAJOR_VERSION == 2) && (GIMP_MINOR_VERSION >= 99))
+/** GIMP 3 *******************************************************************/
+
+// based on hot.c bundled GIMP plugin
+
+#include <libgimp/gimpui.h>
+
+//#define FOURIER_USE_DIALOG  false
+
+typedef struct _Fourier Fourier;
+typedef struct _FourierClass FourierClass;
+
+struct _Fourier
+{
+  GimpPlugIn parent_instance;
+};
+
+struct _FourierClass
+{
+  GimpPlugInClass parent_class;
+};
+
+#define FOURIER_TYPE (fourier_get_type())
+#define FOURIER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), FOURIER_TYPE, Fourier))
+
+#define FOURIER_DATA_DIR    (gpointer) 0x01
+#define FOURIER_DATA_INV    (gpointer) 0x02
+#define FOURIER_DATA_TUNE   (gpointer) 0x03
+#define FOURIER_DATA_EXPORT (gpointer) 0x04
+#define FOURIER_DATA_IMPORT (gpointer) 0x05
+#define FOURIER_DATA_FILTER (gpointer) 0x06
+#define FOURIER_DATA_CONVOLVE (gpointer) 0x07
+#define FOURIER_DATA_REGISTER (gpointer) 0x08
+
+GType fourier_get_type(void) G_GNUC_CONST;
+
+static GList *fourier_query_procedures(GimpPlugIn *plug_in);
+static GimpProcedure *fourier_create_procedure(GimpPlugIn *plug_in,
+                                               const gchar *name);
+gboolean fourier_set_i18n ( GimpPlugIn* plug_in, const gchar* procedure_name,
+                            gchar** gettext_domain, gchar** catalog_dir);
+
+static GimpValueArray *fourier_run(GimpProcedure *procedure,
+                                   GimpRunMode run_mode,
+                                   GimpImage *image,
+                                   GimpDrawable **drawables,
+                                   GimpProcedureConfig *config,
+                                   gpointer run_data);
+static GimpValueArray *fourier_service_run(GimpProcedure *procedure,
+                                           GimpProcedureConfig *config,
+                                           gpointer run_data);
+
+#if FOURIER_USE_DIALOG
+static gboolean plugin_dialog(GimpProcedure *procedure,
+                              GObject *config,
+                              GimpDrawable *drawable);
+#endif
+static gboolean fourier_file_dialog(GimpProcedure *procedure,
+                                    GObject *config,
+                                    gboolean export);
+static gboolean fourier_filter_dialog(GimpProcedure *procedure,
+                                      GObject *config);
+static gboolean fourier_convolve_dialog(GimpProcedure *procedure,
+                                        GObject *config);
+static gboolean fourier_register_dialog(GimpProcedure *procedure,
+                                        GObject *config);
+
+G_DEFINE_TYPE(Fourier, fourier, GIMP_TYPE_PLUG_IN)
+
+GIMP_MAIN(FOURIER_TYPE)
+
+typedef enum
+{
+  MODE_FORWARD,
+  MODE_INVERSE
+} fourierModes;
+
+static void
+fourier_class_init(FourierClass *klass)
+{
+  GimpPlugInClass *plug_in_class = GIMP_PLUG_IN_CLASS(klass);
+
+  plug_in_class->query_procedures = fourier_query_procedures;
+  plug_in_class->create_procedure = fourier_create_procedure;
+  plug_in_class->set_i18n = fourier_set_i18n;
+}
+
+static void
+fourier_init(Fourier *fourier)
+{
+}
+
+// Override standard i18n to specialize
+gboolean fourier_set_i18n (
+  GimpPlugIn* plug_in,
+  const gchar* procedure_name,
+  gchar** gettext_domain,
+  gchar** catalog_dir
+)
+{
+  *gettext_domain = g_strdup(GETTEXT_PACKAGE3);
+#ifdef GETTEXT_FORCEDIMPLOCALEDIRECTORY
+  *catalog_dir = g_strdup(gimp_locale_directory());
+#endif
+  return TRUE;
+}
+
+/*
+// This was the previous code before using set_i18n function, to be included in query & run
+#ifdef HAVE_GETTEXT
+    setlocale (LC_ALL, "");
+    bindtextdomain (GETTEXT_PACKAGE3, gimp_locale_directory ());
+#ifdef HAVE_BIND_TEXTDOMAIN_CODESET
+    bind_textdomain_codeset (GETTEXT_PACKAGE3, "UTF-8");
+#endif
+    textdomain (GETTEXT_PACKAGE3);
+#endif
+*/
+
+static GList *
+fourier_query_procedures(GimpPlugIn *plug_in)
+{
+#if FOURIER_USE_DIALOG
+  // If using dialog, we define only one transform procedure
+  GList *list = g_list_append(NULL, g_strdup(PLUG_IN_PROC));
+#else
+  // If not using dialog, we define all procedures
+  GList *list = g_list_append(
+                  g_list_append(NULL, g_strdup(PLUG_IN_DIR_PROC)),
+                  g_strdup(PLUG_IN_INV_PROC));
+#endif
+  list = g_list_append(list, g_strdup(PLUG_IN_TUNE_PROC));
+  list = g_list_append(list, g_strdup(PLUG_IN_EXPORT_PROC));
+  list = g_list_append(list, g_strdup(PLUG_IN_IMPORT_PROC));
+  list = g_list_append(list, g_strdup(PLUG_IN_FILTER_PROC));
+  list = g_list_append(list, g_strdup(PLUG_IN_CONVOLVE_PROC));
+  list = g_list_append(list, g_strdup(PLUG_IN_REGISTER_PROC));
+  return g_list_append(list, g_strdup(PLUG_IN_SERVICE_PROC));
+}
+
+/*
+ * Create procedure name, that runs as procedure base: the temporary
+ * procedures of the resident service are the plug-in ones under another name.
+ */
+static GimpProcedure *
+fourier_procedure_new(GimpPlugIn *plug_in,
+                      const gchar *name,
+                      const gchar *base,
+                      GimpPDBProcType proc_type)
+{
+  const gchar *menu_location = (proc_type == GIMP_PDB_PROC_TYPE_TEMPORARY) ?
+                               PLUG_IN_RESIDENT_MENU_LOCATION : PLUG_IN_MENU_LOCATION;
+  GimpProcedure *procedure = NULL;
+
+
+
+#if FOURIER_USE_DIALOG
+  if (!strcmp(base, PLUG_IN_PROC))
+  {
+    // One for all procedure with dialog
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, NULL, NULL);
+
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE |
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLES);
+
+    gimp_procedure_set_menu_label(procedure, _("_Fourier..."));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+    /* menu entry short one-liner */ _(PLUG_IN_DIR_SHORT_DESC),
+    /* detailed help description */  _(PLUG_IN_DIR_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+    /* GIMP3 plugin author(s) */   PLUG_IN_AUTHOR,
+    /* plugin copyright license */ "GPL3+",
+    /* date(s) created/made */     PLUG_IN_VERSION);
+
+    gimp_procedure_add_int_argument(procedure, "mode",
+                                    _("Mode"),
+                                    _("Mode { Foward (0), Inversed (1) }"),
+                                    0, 1, MODE_FORWARD,
+                                    G_PARAM_READWRITE);
+
+    gimp_procedure_add_boolean_argument(procedure, "new-layer",
+                                        _("Create _new layer"),
+                                        _("Create a new layer"),
+                                        TRUE,
+                                        G_PARAM_READWRITE);
+  }
+#endif
+
+  if (!strcmp(base, PLUG_IN_DIR_PROC))
+  {
+    // Forward without dialog
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_DIR, NULL);
+
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE |
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLES);
+
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_DIR_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_DIR_SHORT_DESC),
+                                     _(PLUG_IN_DIR_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+  }
+  else if (!strcmp(base, PLUG_IN_INV_PROC))
+  {
+    // Inverse without dialog
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_INV, NULL);
+
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE |
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLES);
+
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_INV_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_INV_SHORT_DESC),
+                                     _(PLUG_IN_INV_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+
+  }
+  else if (!strcmp(base, PLUG_IN_TUNE_PROC))
+  {
+    // Plan measurement for the selection size
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_TUNE, NULL);
+
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE);
+
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_TUNE_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_TUNE_SHORT_DESC),
+                                     _(PLUG_IN_TUNE_DESC),
                                      name);
     gimp_procedure_set_attribution(procedure,
-    /* GIMP3 plugin author(s) */   PLUG_IN_AUTHOR,
-    /* plugin copyright license */ "GPL3+",
-    /* date(s) created/made */     PLUG_IN_VERSION);
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+  }
+  else if (!strcmp(base, PLUG_IN_EXPORT_PROC))
+  {
+    // Full precision spectrum to a file
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_EXPORT, NULL);
 
-    gimp_procedure_add_int_argument(procedure, "mode",
-                                    _("Mode"),
-                                    _("Mode { Foward (0), Inversed (1) }"),
-                                    0, 1, MODE_FORWARD,
-                                    G_PARAM_READWRITE);
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE);
 
-    gimp_procedure_add_boolean_argument(procedure, "new-layer",
-                                        _("Create _new layer"),
-                                        _("Create a new layer"),
-                                        TRUE,
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_EXPORT_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_EXPORT_SHORT_DESC),
+                                     _(PLUG_IN_EXPORT_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+
+    gimp_procedure_add_file_argument(procedure, "file",
+                                     _("_File"),
+                                     _("NPY file to write"),
+                                     GIMP_FILE_CHOOSER_ACTION_SAVE,
+                                     FALSE, NULL,
+                                     G_PARAM_READWRITE);
+    gimp_procedure_add_boolean_argument(procedure, "quantized",
+                                        _("_Quantized"),
+                                        _("Export the spectrum as quantized by FFT Forward instead of as computed"),
+                                        FALSE,
                                         G_PARAM_READWRITE);
   }
-#endif
-
-  if (!strcmp(name, PLUG_IN_DIR_PROC))
+  else if (!strcmp(base, PLUG_IN_IMPORT_PROC))
   {
-    // Forward without dialog
+    // Inverse of a spectrum file
     procedure = gimp_image_procedure_new(plug_in, name,
-                                         GIMP_PDB_PROC_TYPE_PLUGIN,
-                                         fourier_run, FOURIER_DATA_DIR, NULL);
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_IMPORT, NULL);
 
-    gimp_procedure_set_image_types(procedure, "RGB");
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
     gimp_procedure_set_sensitivity_mask(procedure,
                                         GIMP_PROCEDURE_SENSITIVE_DRAWABLE);
 
-    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_DIR_MENU_LABEL));
-    gimp_procedure_add_menu_path(procedure, PLUG_IN_MENU_LOCATION);
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_IMPORT_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
 
     gimp_procedure_set_documentation(procedure,
-                                     _(PLUG_IN_DIR_SHORT_DESC),
-                                     _(PLUG_IN_DIR_DESC),
+                                     _(PLUG_IN_IMPORT_SHORT_DESC),
+                                     _(PLUG_IN_IMPORT_DESC),
                                      name);
     gimp_procedure_set_attribution(procedure,
                                    PLUG_IN_AUTHOR,
                                    "GPL3+",
                                    PLUG_IN_VERSION);
+
+    gimp_procedure_add_file_argument(procedure, "file",
+                                     _("_File"),
+                                     _("NPY file to read"),
+                                     GIMP_FILE_CHOOSER_ACTION_OPEN,
+                                     FALSE, NULL,
+                                     G_PARAM_READWRITE);
   }
-  else if (!strcmp(name, PLUG_IN_INV_PROC))
+  else if (!strcmp(base, PLUG_IN_FILTER_PROC))
   {
-    // Inverse without dialog
+    // Forward, filter and inverse in one pass
     procedure = gimp_image_procedure_new(plug_in, name,
-                                         GIMP_PDB_PROC_TYPE_PLUGIN,
-                                         fourier_run, FOURIER_DATA_INV, NULL);
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_FILTER, NULL);
+
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE |
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLES);
+
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_FILTER_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_FILTER_SHORT_DESC),
+                                     _(PLUG_IN_FILTER_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+
+    gimp_procedure_add_int_argument(procedure, "filter-type",
+                                    _("_Filter"),
+                                    _(PLUG_IN_FILTER_TYPE_DESC),
+                                    FILTER_NONE, FILTER_BAND_PASS, FILTER_LOW_PASS,
+                                    G_PARAM_READWRITE);
+    gimp_procedure_add_int_argument(procedure, "filter-shape",
+                                    _("_Shape"),
+                                    _(PLUG_IN_FILTER_SHAPE_DESC),
+                                    FILTER_IDEAL, FILTER_GAUSSIAN, FILTER_BUTTERWORTH,
+                                    G_PARAM_READWRITE);
+    gimp_procedure_add_double_argument(procedure, "cutoff",
+                                       _("_Cutoff"),
+                                       _(PLUG_IN_FILTER_CUTOFF_DESC),
+                                       0.0, 1.5, 0.25,
+                                       G_PARAM_READWRITE);
+    gimp_procedure_add_double_argument(procedure, "cutoff-high",
+                                       _("Cutoff _high"),
+                                       _(PLUG_IN_FILTER_CUTOFF_HIGH_DESC),
+                                       0.0, 1.5, 0.5,
+                                       G_PARAM_READWRITE);
+    gimp_procedure_add_int_argument(procedure, "order",
+                                    _("_Order"),
+                                    _(PLUG_IN_FILTER_ORDER_DESC),
+                                    1, 10, 2,
+                                    G_PARAM_READWRITE);
+    gimp_procedure_add_string_argument(procedure, "notches",
+                                       _("_Notches"),
+                                       _(PLUG_IN_FILTER_NOTCHES_DESC),
+                                       "",
+                                       G_PARAM_READWRITE);
+    gimp_procedure_add_double_argument(procedure, "notch-radius",
+                                       _("Notch _radius"),
+                                       _(PLUG_IN_FILTER_NOTCH_RADIUS_DESC),
+                                       0.0, 1000.0, 4.0,
+                                       G_PARAM_READWRITE);
+  }
+  else if (!strcmp(base, PLUG_IN_CONVOLVE_PROC))
+  {
+    // Convolution by a kernel drawable, in tiles
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_CONVOLVE, NULL);
+
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
+    gimp_procedure_set_sensitivity_mask(procedure,
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLE |
+                                        GIMP_PROCEDURE_SENSITIVE_DRAWABLES);
+
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_CONVOLVE_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_CONVOLVE_SHORT_DESC),
+                                     _(PLUG_IN_CONVOLVE_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+
+    gimp_procedure_add_drawable_argument(procedure, "kernel",
+                                         _("_Kernel"),
+                                         _(PLUG_IN_CONVOLVE_KERNEL_DESC),
+                                         TRUE,
+                                         G_PARAM_READWRITE);
+    gimp_procedure_add_boolean_argument(procedure, "normalize",
+                                        _("_Normalize"),
+                                        _(PLUG_IN_CONVOLVE_NORMALIZE_DESC),
+                                        TRUE,
+                                        G_PARAM_READWRITE);
+    gimp_procedure_add_int_argument(procedure, "edges",
+                                    _("_Edges"),
+                                    _(PLUG_IN_CONVOLVE_EDGES_DESC),
+                                    PADDING_EDGE, PADDING_MIRROR, PADDING_EDGE,
+                                    G_PARAM_READWRITE);
+  }
+  else if (!strcmp(base, PLUG_IN_REGISTER_PROC))
+  {
+    // Translation relative to a reference drawable
+    procedure = gimp_image_procedure_new(plug_in, name,
+                                         proc_type,
+                                         fourier_run, FOURIER_DATA_REGISTER, NULL);
 
-    gimp_procedure_set_image_types(procedure, "RGB");
+    gimp_procedure_set_image_types(procedure, "RGB*, GRAY*");
     gimp_procedure_set_sensitivity_mask(procedure,
                                         GIMP_PROCEDURE_SENSITIVE_DRAWABLE);
 
-    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_INV_MENU_LABEL));
-    gimp_procedure_add_menu_path(procedure, PLUG_IN_MENU_LOCATION);
+    gimp_procedure_set_menu_label(procedure, _(PLUG_IN_REGISTER_MENU_LABEL));
+    gimp_procedure_add_menu_path(procedure, menu_location);
 
     gimp_procedure_set_documentation(procedure,
-                                     _(PLUG_IN_INV_SHORT_DESC),
-                                     _(PLUG_IN_INV_DESC),
+                                     _(PLUG_IN_REGISTER_SHORT_DESC),
+                                     _(PLUG_IN_REGISTER_DESC),
+                                     name);
+    gimp_procedure_set_attribution(procedure,
+                                   PLUG_IN_AUTHOR,
+                                   "GPL3+",
+                                   PLUG_IN_VERSION);
+
+    gimp_procedure_add_drawable_argument(procedure, "reference",
+                                         _("_Reference"),
+                                         _(PLUG_IN_REGISTER_REFERENCE_DESC),
+                                         TRUE,
+                                         G_PARAM_READWRITE);
+    gimp_procedure_add_boolean_argument(procedure, "apply",
+                                        _("_Move the layer"),
+                                        _(PLUG_IN_REGISTER_APPLY_DESC),
+                                        TRUE,
+                                        G_PARAM_READWRITE);
+
+    gimp_procedure_add_double_return_value(procedure, "offset-x",
+                                           _("Offset _X"),
+                                           _(PLUG_IN_REGISTER_OFFSET_X_DESC),
+                                           -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
+                                           G_PARAM_READWRITE);
+    gimp_procedure_add_double_return_value(procedure, "offset-y",
+                                           _("Offset _Y"),
+                                           _(PLUG_IN_REGISTER_OFFSET_Y_DESC),
+                                           -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
+                                           G_PARAM_READWRITE);
+    gimp_procedure_add_double_return_value(procedure, "peak",
+                                           _("_Peak"),
+                                           _(PLUG_IN_REGISTER_PEAK_DESC),
+                                           0.0, 1.0, 0.0,
+                                           G_PARAM_READWRITE);
+  }
+  else if (!strcmp(base, PLUG_IN_SERVICE_PROC))
+  {
+    // Started on demand only: GIMP starts the extensions without arguments itself
+    procedure = gimp_procedure_new(plug_in, name,
+                                   GIMP_PDB_PROC_TYPE_EXTENSION,
+                                   fourier_service_run, NULL, NULL);
+
+    gimp_procedure_set_documentation(procedure,
+                                     _(PLUG_IN_SERVICE_SHORT_DESC),
+                                     _(PLUG_IN_SERVICE_DESC),
                                      name);
     gimp_procedure_set_attribution(procedure,
                                    PLUG_IN_AUTHOR,
                                    "GPL3+",
                                    PLUG_IN_VERSION);
 
+    gimp_procedure_add_int_argument(procedure, "idle-timeout",
+                                    _("_Idle timeout"),
+                                    _(PLUG_IN_SERVICE_IDLE_TIMEOUT_DESC),
+                                    0, G_MAXINT, 300,
+                                    G_PARAM_READWRITE);
+    return procedure;
+  }
+
+  if (procedure)
+  {
+    // Options shared by all procedures
+    gimp_procedure_add_int_argument(procedure, "threads",
+                                    _("_Threads"),
+                                    _(PLUG_IN_THREADS_DESC),
+                                    0, 256, 0,
+                                    G_PARAM_READWRITE);
+    // Tuning is about spending time in planning, others only use stored wisdom by default
+    gimp_procedure_add_int_argument(procedure, "rigor",
+                                    _("Planning _rigor"),
+                                    _(PLUG_IN_RIGOR_DESC),
+                                    RIGOR_ESTIMATE, RIGOR_EXHAUSTIVE,
+                                    (!strcmp(base, PLUG_IN_TUNE_PROC)) ? RIGOR_PATIENT : RIGOR_ESTIMATE,
+                                    G_PARAM_READWRITE);
+    gimp_procedure_add_int_argument(procedure, "memory-limit",
+                                    _("_Memory limit (MB)"),
+                                    _(PLUG_IN_MEMORY_LIMIT_DESC),
+                                    0, G_MAXINT, 0,
+                                    G_PARAM_READWRITE);
+    // Padding is chosen by the forward transform, filters only pad their scratch
+    if (!strcmp(base, PLUG_IN_PROC) || !strcmp(base, PLUG_IN_DIR_PROC) || !strcmp(base, PLUG_IN_FILTER_PROC))
+      gimp_procedure_add_int_argument(procedure, "padding",
+                                      _("_Padding"),
+                                      _(PLUG_IN_PADDING_DESC),
+                                      PADDING_NONE, PADDING_MIRROR, PADDING_NONE,
+                                      G_PARAM_READWRITE);
+    // The luma spectrum is chosen by the forward transform, the inverse reads it from the record
+    if (!strcmp(base, PLUG_IN_PROC) || !strcmp(base, PLUG_IN_DIR_PROC))
+      gimp_procedure_add_boolean_argument(procedure, "luma",
+                                          _("_Luma only"),
+                                          _(PLUG_IN_LUMA_DESC),
+                                          FALSE,
+                                          G_PARAM_READWRITE);
+    // Records are written by the forward transform only
+    if (!strcmp(base, PLUG_IN_PROC) || !strcmp(base, PLUG_IN_DIR_PROC))
+      gimp_procedure_add_int_argument(procedure, "record-limit",
+                                      _("_Record limit (MB)"),
+                                      _(PLUG_IN_RECORD_LIMIT_DESC),
+                                      0, G_MAXINT, 1024,
+                                      G_PARAM_READWRITE);
+    // Transforms run on all selected drawables, or on all layers
+    if (!strcmp(base, PLUG_IN_PROC) || !strcmp(base, PLUG_IN_DIR_PROC) || !strcmp(base, PLUG_IN_INV_PROC) ||
+        !strcmp(base, PLUG_IN_FILTER_PROC) || !strcmp(base, PLUG_IN_CONVOLVE_PROC))
+      gimp_procedure_add_boolean_argument(procedure, "all-layers",
+                                          _("_All layers"),
+                                          _(PLUG_IN_ALL_LAYERS_DESC),
+                                          FALSE,
+                                          G_PARAM_READWRITE);
   }
 
   return procedure;
 }
 
+static GimpProcedure *
+fourier_create_procedure(GimpPlugIn *plug_in,
+                         const gchar *name)
+{
+  return fourier_procedure_new(plug_in, name, name, GIMP_PDB_PROC_TYPE_PLUGIN);
+}
+
+/*
+ * The resident service runs the transforms of its temporary procedures in
+ * its own process, where the batch scratches with their plans, the geometry
+ * tables, the wisdom and the FFT threads are kept from one run to the next.
+ */
+static GimpValueArray *
+fourier_service_run(GimpProcedure *procedure,
+                    GimpProcedureConfig *config,
+                    gpointer run_data)
+{
+  GimpPlugIn *plug_in = gimp_procedure_get_plug_in(procedure);
+  const gchar *procs[] = {
+#if FOURIER_USE_DIALOG
+    PLUG_IN_PROC,
+#else
+    PLUG_IN_DIR_PROC, PLUG_IN_INV_PROC,
+#endif
+    PLUG_IN_FILTER_PROC
+  };
+  GimpProcedure *temp;
+  gint idle_timeout;
+  gchar *name;
+  guint i;
+
+  g_object_get(config, "idle-timeout", &idle_timeout, NULL);
+
+  gegl_init(NULL, NULL);
+  fourier_plugin_setup();
+  fourier_service_vals = fvals;
+  fourier_batch_keep = TRUE;
+
+  for (i = 0; i < G_N_ELEMENTS(procs); i++)
+  {
+    name = g_strconcat(procs[i], PLUG_IN_RESIDENT_SUFFIX, NULL);
+    temp = fourier_procedure_new(plug_in, name, procs[i], GIMP_PDB_PROC_TYPE_TEMPORARY);
+    gimp_plug_in_add_temp_procedure(plug_in, temp);
+    g_object_unref(temp);
+    g_free(name);
+  }
+
+  gimp_plug_in_extension_enable(plug_in);
+  // Runs until GIMP quits
+  while (TRUE)
+    gimp_plug_in_extension_process(plug_in, fourier_service_wait(idle_timeout));
+
+  return gimp_procedure_new_return_values(procedure, GIMP_PDB_SUCCESS, NULL);
+}
+
+
+static void
+fourier_record_set_token(GimpDrawable *drawable, const gchar *name, guint64 token)
+{
+  GimpParasite *parasite;
+
+  parasite = gimp_parasite_new(name, GIMP_PARASITE_PERSISTENT | GIMP_PARASITE_UNDOABLE,
+                               sizeof(token), &token);
+  gimp_item_attach_parasite(GIMP_ITEM(drawable), parasite);
+  gimp_parasite_free(parasite);
+}
 
+/* name is FOURIER_RECORD_PARASITE, or FOURIER_LUMA_PARASITE for luma spectra */
 static gboolean
-fourier_core(GimpDrawable *drawable, gboolean inverse /*, gboolean new_layer*/)
+fourier_record_get_token(GimpDrawable *drawable, const gchar *name, guint64 *token)
 {
-  gint action;
-  GeglBuffer *src_buffer;
-  GeglBuffer *dest_buffer;
-  const Babl *src_format;
-  const Babl *dest_format;
-  gint src_bpp;
-  gint dest_bpp;
-  gboolean success = TRUE;
-  //GimpLayer *nl = NULL;
+  GimpParasite *parasite;
+  gconstpointer data;
+  guint32 size = 0;
+
+  parasite = gimp_item_get_parasite(GIMP_ITEM(drawable), name);
+  if (!parasite)
+    return FALSE;
+  data = gimp_parasite_get_data(parasite, &size);
+  if (size == sizeof(*token))
+    memcpy(token, data, sizeof(*token));
+  gimp_parasite_free(parasite);
+  return size == sizeof(*token);
+}
+
+static gboolean
+fourier_padding_get(GimpDrawable *drawable, FourierPadding *padding)
+{
+  GimpParasite *parasite;
+  gconstpointer data;
+  guint32 size = 0;
+
+  parasite = gimp_item_get_parasite(GIMP_ITEM(drawable), FOURIER_PADDING_PARASITE);
+  if (!parasite)
+    return FALSE;
+  data = gimp_parasite_get_data(parasite, &size);
+  if (size == sizeof(*padding))
+    memcpy(padding, data, sizeof(*padding));
+  gimp_parasite_free(parasite);
+  return size == sizeof(*padding);
+}
+
+static void
+fourier_padding_grow(GimpDrawable *drawable, gint padded_width, gint padded_height)
+{
+  GimpImage *image = gimp_item_get_image(GIMP_ITEM(drawable));
+  GimpParasite *parasite;
+  FourierPadding padding;
+  gint offset_x, offset_y;
+
+  padding.width = gimp_drawable_get_width(drawable);
+  padding.height = gimp_drawable_get_height(drawable);
+  padding.canvas_width = gimp_image_get_width(image);
+  padding.canvas_height = gimp_image_get_height(image);
+
+  gimp_layer_resize(GIMP_LAYER(drawable), padded_width, padded_height, 0, 0);
+  gimp_drawable_get_offsets(drawable, &offset_x, &offset_y);
+  if (offset_x + padded_width > padding.canvas_width || offset_y + padded_height > padding.canvas_height)
+    gimp_image_resize(image,
+                      MAX(padding.canvas_width, offset_x + padded_width),
+                      MAX(padding.canvas_height, offset_y + padded_height), 0, 0);
+
+  parasite = gimp_parasite_new(FOURIER_PADDING_PARASITE, GIMP_PARASITE_PERSISTENT | GIMP_PARASITE_UNDOABLE,
+                               sizeof(padding), &padding);
+  gimp_item_attach_parasite(GIMP_ITEM(drawable), parasite);
+  gimp_parasite_free(parasite);
+}
+
+static void
+fourier_padding_crop(GimpDrawable *drawable, const FourierPadding *padding)
+{
+  GimpImage *image = gimp_item_get_image(GIMP_ITEM(drawable));
+
+  gimp_layer_resize(GIMP_LAYER(drawable), padding->width, padding->height, 0, 0);
+  if (gimp_image_get_width(image) > padding->canvas_width ||
+      gimp_image_get_height(image) > padding->canvas_height)
+    gimp_image_resize(image,
+                      MIN(gimp_image_get_width(image), padding->canvas_width),
+                      MIN(gimp_image_get_height(image), padding->canvas_height), 0, 0);
+  gimp_item_detach_parasite(GIMP_ITEM(drawable), FOURIER_PADDING_PARASITE);
+}
+
+/* Batch callbacks, data is the array of drawables */
+static gboolean
+fourier_layer_prepare(FourierBatchItem *item, gpointer data)
+{
+  GimpDrawable *drawable = ((GimpDrawable **) data)[item->index];
+  gboolean inverse = item->inverse;
   gint width, height;
-  gint sel_x1, sel_x2, sel_y1, sel_y2;
-  guchar *src, *dst;
+  gint sel_x1, sel_y1;
+  GimpImage *image = gimp_item_get_image(GIMP_ITEM(drawable));
+  gboolean whole_layer, missing;
+  guint64 token;
+  gchar *name;
 
   width = gimp_drawable_get_width(drawable);
   height = gimp_drawable_get_height(drawable);
 
-  if (gimp_drawable_has_alpha(drawable))
-    src_format = babl_format("R'G'B'A u8");
-  else
-    src_format = babl_format("R'G'B' u8");
-
-  dest_format = src_format;
+  item->format = fourier_format(gimp_drawable_is_gray(drawable), gimp_drawable_has_alpha(drawable));
 
   /*
   if (new_layer)
@@ -605,18 +2193,53 @@ fourier_core(GimpDrawable *drawable, gboolean inverse /*, gboolean new_layer*/)
 
   if (!gimp_drawable_mask_intersect(drawable,
                                     &sel_x1, &sel_y1, &width, &height))
-    return success;
-
-  src_bpp = babl_format_get_bytes_per_pixel(src_format);
-  dest_bpp = babl_format_get_bytes_per_pixel(dest_format);
-
-  sel_x2 = sel_x1 + width;
-  sel_y2 = sel_y1 + height;
+    return FALSE;
+
+  item->roi = *GEGL_RECTANGLE(sel_x1, sel_y1, width, height);
+  item->padded_width = width;
+  item->padded_height = height;
+
+  // Only whole layers can be padded, the inverse crops the padding away
+  whole_layer = GIMP_IS_LAYER(drawable) && sel_x1 == 0 && sel_y1 == 0 &&
+                width == gimp_drawable_get_width(drawable) &&
+                height == gimp_drawable_get_height(drawable);
+  // Filters only pad their scratch, the layer keeps its size
+  if (item->filter && fvals.padding != PADDING_NONE)
+    fourier_padded_size(width, height, &item->padded_width, &item->padded_height);
+  else if (item->filter)
+    ;
+  else if (whole_layer && !inverse && fvals.padding != PADDING_NONE)
+    fourier_padded_size(width, height, &item->padded_width, &item->padded_height);
+  else if (whole_layer && inverse && fourier_padding_get(drawable, &item->padding) &&
+           item->padding.width <= width && item->padding.height <= height)
+    item->roi = *GEGL_RECTANGLE(0, 0, item->padding.width, item->padding.height);
+  item->padded = !item->filter &&
+                 (item->padded_width != item->roi.width || item->padded_height != item->roi.height);
+
+  // The record of the inverse is opened before anything is changed, a luma spectrum needs it
+  if (!item->filter && inverse)
+  {
+    if (fourier_record_get_token(drawable, FOURIER_RECORD_PARASITE, &item->token))
+      item->recorded = fourier_record_open(item->token, &item->roi, item->padded_width, item->padded_height,
+                                           babl_format_get_bytes_per_pixel(item->format), &item->luma);
+    if (fourier_record_get_token(drawable, FOURIER_LUMA_PARASITE, &token))
+    {
+      name = gimp_item_get_name(GIMP_ITEM(drawable));
+      missing = fourier_batch_luma_missing(item, token, name);
+      g_free(name);
+      if (missing)
+        return FALSE;
+    }
+  }
 
-  src = g_new(guchar, width * height * src_bpp);
-  dst = g_new(guchar, width * height * dest_bpp);
+  if (item->padded)
+  {
+    gimp_image_undo_group_start(image);
+    if (!inverse)
+      fourier_padding_grow(drawable, item->padded_width, item->padded_height);
+  }
 
-  src_buffer = gimp_drawable_get_buffer(drawable);
+  item->src_buffer = gimp_drawable_get_buffer(drawable);
 
   /*if (new_layer)
   {
@@ -624,49 +2247,321 @@ fourier_core(GimpDrawable *drawable, gboolean inverse /*, gboolean new_layer*/)
   }
   else
   {*/
-    dest_buffer = gimp_drawable_get_shadow_buffer(drawable);
+    item->dest_buffer = gimp_drawable_get_shadow_buffer(drawable);
   /*}*/
 
-  gegl_buffer_get(src_buffer,
-                  GEGL_RECTANGLE(sel_x1, sel_y1, width, height), 1.0,
-                  src_format, src,
-                  GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  if (!item->filter && !inverse)
+  {
+    // The chroma of a luma spectrum is only kept by the record
+    item->luma = fvals.luma && fourier_format_colors(item->format) == 3;
+    item->record = fourier_record_create(fourier_record_get_token(drawable, FOURIER_RECORD_PARASITE, &token) ?
+                                         &token : NULL,
+                                         &item->roi, item->padded_width, item->padded_height,
+                                         item->format, item->luma, &item->token);
+    item->luma = item->luma && item->record;
+  }
+
+  return TRUE;
+}
+
+static void
+fourier_layer_finish(FourierBatchItem *item, gboolean success, gpointer data)
+{
+  GimpDrawable *drawable = ((GimpDrawable **) data)[item->index];
+  GimpImage *image = gimp_item_get_image(GIMP_ITEM(drawable));
+  FourierPadding padding;
+  guint64 token;
+
+  g_object_unref(item->src_buffer);
+  g_object_unref(item->dest_buffer);
+  if (item->recorded)
+    g_mapped_file_unref(item->recorded);
+
+  /*if (new_layer)
+  {
+    gimp_drawable_update(GIMP_DRAWABLE(nl), sel_x1, sel_y1, width, height);
+  }
+  else*/
+  // A cancelled transform drops the shadow, the drawable is left as it was
+  if (success)
+  {
+    FOURIER_TRACE_BEGIN("merge_shadow");
+    gimp_drawable_merge_shadow(drawable, TRUE);
+    FOURIER_TRACE_END();
+    gimp_drawable_update(drawable, item->roi.x, item->roi.y, item->padded_width, item->padded_height);
+  }
+
+  if (item->padded)
+  {
+    if (item->inverse && success)
+      fourier_padding_crop(drawable, &item->padding);
+    else if (!item->inverse && !success && fourier_padding_get(drawable, &padding))
+      fourier_padding_crop(drawable, &padding);
+    gimp_image_undo_group_end(image);
+  }
+
+  if (item->record && fourier_record_close(item->record) && success)
+    fourier_record_set_token(drawable, FOURIER_RECORD_PARASITE, item->token);
+  // Luma spectra are tagged even when their record failed, so that their inverse fails too
+  if (success && !item->filter && !item->inverse && item->luma)
+    fourier_record_set_token(drawable, FOURIER_LUMA_PARASITE, item->token);
+  else if (success && !item->filter && fourier_record_get_token(drawable, FOURIER_LUMA_PARASITE, &token))
+    gimp_item_detach_parasite(GIMP_ITEM(drawable), FOURIER_LUMA_PARASITE);
+}
+
+/*
+ * Transform the selection of each drawable, several drawables are one undo
+ * step. FALSE is returned when cancelled, or with error set when a drawable
+ * cannot be transformed.
+ */
+static gboolean
+fourier_core(GimpImage *image, GimpDrawable **drawables, gint count, gboolean inverse /*, gboolean new_layer*/,
+             GError **error)
+{
+  gboolean success;
 
+  if (count > 1)
+    gimp_image_undo_group_start(image);
   gimp_progress_init(inverse ? _("Applying inverse Fourier transform...") : _("Applying forward Fourier transform..."));
 
-  if (!inverse)
-  { // Forward
-    process_fft_forward(src, dst, width, height, src_bpp, dest_bpp);
-  }
-  else
-  { // Inverse
-    process_fft_inverse(src, dst, width, height, src_bpp, dest_bpp);
-  }
+  // Pixels are read and written by tiles, the spectrum never leaves the scratch
+  success = fourier_batch_process(count, inverse, NULL,
+                                  fourier_layer_prepare, fourier_layer_finish, drawables, error);
+
+  if (count > 1)
+    gimp_image_undo_group_end(image);
+  gimp_displays_flush();
+
+  return success;
+}
+
+/*
+ * Filter the selection of each drawable, several drawables are one undo
+ * step. FALSE is returned when cancelled.
+ */
+static gboolean
+fourier_filter_core(GimpImage *image, GimpDrawable **drawables, gint count, const FourierFilter *filter)
+{
+  gboolean success;
+
+  if (count > 1)
+    gimp_image_undo_group_start(image);
+  gimp_progress_init(_("Applying Fourier filter..."));
+
+  success = fourier_batch_process(count, FALSE, filter,
+                                  fourier_layer_prepare, fourier_layer_finish, drawables, NULL);
+
+  if (count > 1)
+    gimp_image_undo_group_end(image);
+  gimp_displays_flush();
+
+  return success;
+}
+
+/*
+ * Convolve the selection of each drawable but the kernel itself, several
+ * drawables are one undo step. FALSE is returned when cancelled.
+ */
+static gboolean
+fourier_convolve_core(GimpImage *image, GimpDrawable **drawables, gint count,
+                      GimpDrawable *kernel_drawable, gboolean normalize, gint extension)
+{
+  GeglBuffer *kernel_buffer = gimp_drawable_get_buffer(kernel_drawable);
+  GeglBuffer *src_buffer, *dest_buffer;
+  GimpDrawable *drawable;
+  const Babl *format;
+  double *kernel;
+  gint kernel_width, kernel_height, kernel_planes;
+  gint x, y, width, height, index;
+  gboolean success = TRUE;
+
+  if (count > 1)
+    gimp_image_undo_group_start(image);
+  gimp_progress_init(_("Applying Fourier convolution..."));
+  fourier_progress_reset();
+  fourier_progress_span = 1.0 / MAX(count, 1);
+
+  for (index = 0; index < count && success; index++)
+  {
+    drawable = drawables[index];
+    if (gimp_item_get_id(GIMP_ITEM(drawable)) == gimp_item_get_id(GIMP_ITEM(kernel_drawable)) ||
+        !gimp_drawable_mask_intersect(drawable, &x, &y, &width, &height))
+      continue;
+    fourier_progress_start = (double)index / count;
+
+    // A gray drawable takes the gray of the kernel
+    format = fourier_format(gimp_drawable_is_gray(drawable), gimp_drawable_has_alpha(drawable));
+    kernel = fourier_kernel_read(kernel_buffer, fourier_format(gimp_drawable_is_gray(drawable), FALSE),
+                                 normalize, &kernel_width, &kernel_height, &kernel_planes);
+
+    src_buffer = gimp_drawable_get_buffer(drawable);
+    dest_buffer = gimp_drawable_get_shadow_buffer(drawable);
+    success = fourier_convolve_buffer(src_buffer, dest_buffer, GEGL_RECTANGLE(x, y, width, height), format,
+                                      kernel, kernel_width, kernel_height, kernel_planes, extension);
+    g_object_unref(src_buffer);
+    g_object_unref(dest_buffer);
+    g_free(kernel);
+
+    if (success)
+    {
+      FOURIER_TRACE_BEGIN("merge_shadow");
+      gimp_drawable_merge_shadow(drawable, TRUE);
+      FOURIER_TRACE_END();
+      gimp_drawable_update(drawable, x, y, width, height);
+    }
+  }
+
+  fourier_progress_start = 0.0;
+  fourier_progress_span = 1.0;
+  fourier_progress(1.0);
+  if (count > 1)
+    gimp_image_undo_group_end(image);
+  gimp_displays_flush();
+  g_object_unref(kernel_buffer);
+
+  return success;
+}
+
+/* All layers of the image, those inside layer groups included */
+static void
+fourier_layers_collect(GimpItem **items, GPtrArray *layers)
+{
+  GimpItem **children;
+
+  for (; items && *items; items++)
+    if (gimp_item_is_group(*items))
+    {
+      children = gimp_item_get_children(*items);
+      fourier_layers_collect(children, layers);
+      g_free(children);
+    }
+    else
+      g_ptr_array_add(layers, *items);
+}
+
+static void
+fourier_tune_core(GimpDrawable *drawable)
+{
+  gint sel_x1, sel_y1, width, height;
+
+  if (!gimp_drawable_mask_intersect(drawable,
+                                    &sel_x1, &sel_y1, &width, &height))
+    return;
+
+  gimp_progress_init(_("Measuring Fourier transform plans..."));
+  process_fft_tune(width, height, gimp_drawable_is_gray(drawable) ? 1 : 3);
+}
+
+static gboolean
+fourier_export_core(GimpDrawable *drawable, GFile *file, gboolean quantized, GError **error)
+{
+  GeglBuffer *src_buffer;
+  const Babl *format;
+  gint sel_x1, sel_y1, width, height;
+  gchar *filename;
+  gboolean success;
+
+  if (!gimp_drawable_mask_intersect(drawable,
+                                    &sel_x1, &sel_y1, &width, &height))
+    return TRUE;
+
+  format = fourier_format(gimp_drawable_is_gray(drawable), gimp_drawable_has_alpha(drawable));
+  src_buffer = gimp_drawable_get_buffer(drawable);
+  filename = g_file_get_path(file);
+
+  gimp_progress_init(_("Exporting Fourier transform..."));
+  success = fourier_npy_export(src_buffer, GEGL_RECTANGLE(sel_x1, sel_y1, width, height),
+                               format, filename, quantized, error);
+
+  g_free(filename);
+  g_object_unref(src_buffer);
+
+  return success;
+}
+
+static gboolean
+fourier_import_core(GimpDrawable *drawable, GFile *file, GError **error)
+{
+  GeglBuffer *src_buffer, *dest_buffer;
+  const Babl *format;
+  gint sel_x1, sel_y1, width, height;
+  gchar *filename;
+  gboolean success;
 
-  gegl_buffer_set(dest_buffer,
-                  GEGL_RECTANGLE(sel_x1, sel_y1, width, height), 0,
-                  dest_format, dst,
-                  GEGL_AUTO_ROWSTRIDE);
+  if (!gimp_drawable_mask_intersect(drawable,
+                                    &sel_x1, &sel_y1, &width, &height))
+    return TRUE;
 
-  gimp_progress_update(1.0);
+  format = fourier_format(gimp_drawable_is_gray(drawable), gimp_drawable_has_alpha(drawable));
+  src_buffer = gimp_drawable_get_buffer(drawable);
+  dest_buffer = gimp_drawable_get_shadow_buffer(drawable);
+  filename = g_file_get_path(file);
 
-  g_free(src);
-  g_free(dst);
+  gimp_progress_init(_("Applying inverse Fourier transform..."));
+  success = fourier_npy_import(dest_buffer, src_buffer, GEGL_RECTANGLE(sel_x1, sel_y1, width, height),
+                               format, filename, error);
 
+  g_free(filename);
   g_object_unref(src_buffer);
   g_object_unref(dest_buffer);
 
-  /*if (new_layer)
+  if (success)
   {
-    gimp_drawable_update(GIMP_DRAWABLE(nl), sel_x1, sel_y1, width, height);
-  }
-  else
-  {*/
     gimp_drawable_merge_shadow(drawable, TRUE);
     gimp_drawable_update(drawable, sel_x1, sel_y1, width, height);
-  /*}*/
+  }
 
-  gimp_displays_flush();
+  return success;
+}
+
+/*
+ * Translation of the selection of drawable relative to the pixels of
+ * reference at the same place of the image. With apply, a layer is moved
+ * by the nearest whole number of pixels to match the reference.
+ */
+static gboolean
+fourier_register_core(GimpDrawable *drawable, GimpDrawable *reference, gboolean apply,
+                      double *dx, double *dy, double *peak, GError **error)
+{
+  GeglBuffer *ref_buffer, *buffer;
+  GeglRectangle rect;
+  const Babl *format;
+  gint sel_x1, sel_y1, width, height, offset_x, offset_y, ref_x, ref_y;
+  gboolean success;
+
+  *dx = *dy = *peak = 0.0;
+  gimp_drawable_get_offsets(drawable, &offset_x, &offset_y);
+  gimp_drawable_get_offsets(reference, &ref_x, &ref_y);
+  if (!gimp_drawable_mask_intersect(drawable,
+                                    &sel_x1, &sel_y1, &width, &height) ||
+      !gegl_rectangle_intersect(&rect,
+                                GEGL_RECTANGLE(sel_x1 + offset_x, sel_y1 + offset_y, width, height),
+                                GEGL_RECTANGLE(ref_x, ref_y,
+                                               gimp_drawable_get_width(reference),
+                                               gimp_drawable_get_height(reference))))
+  {
+    g_set_error(error, GIMP_PLUG_IN_ERROR, 0,
+                _("The selection does not overlap the reference drawable."));
+    return FALSE;
+  }
+
+  // Both are read in the format of drawable, alpha is ignored
+  format = fourier_format(gimp_drawable_is_gray(drawable), FALSE);
+  ref_buffer = gimp_drawable_get_buffer(reference);
+  buffer = gimp_drawable_get_buffer(drawable);
+
+  gimp_progress_init(_("Registering with the Fourier phase correlation..."));
+  success = fourier_register_buffers(ref_buffer, GEGL_RECTANGLE(rect.x - ref_x, rect.y - ref_y,
+                                                                rect.width, rect.height),
+                                     buffer, GEGL_RECTANGLE(rect.x - offset_x, rect.y - offset_y,
+                                                            rect.width, rect.height),
+                                     format, dx, dy, peak, error);
+  g_object_unref(ref_buffer);
+  g_object_unref(buffer);
+
+  if (success && apply && GIMP_IS_LAYER(drawable))
+    gimp_layer_set_offsets(GIMP_LAYER(drawable),
+                           offset_x - (gint)round(*dx), offset_y - (gint)round(*dy));
 
   return success;
 }
@@ -679,13 +2574,29 @@ fourier_run(GimpProcedure *procedure,
             GimpProcedureConfig *config,
             gpointer run_data)
 {
-  GimpDrawable *drawable;
+  GimpDrawable *drawable = NULL;
+  GPtrArray *layers;
   gboolean inverse = FALSE;
   gboolean new_layer = FALSE;
+  gboolean all_layers = FALSE;
+  gboolean transform = (run_data == NULL || run_data == FOURIER_DATA_DIR || run_data == FOURIER_DATA_INV ||
+                        run_data == FOURIER_DATA_FILTER || run_data == FOURIER_DATA_CONVOLVE);
+  FourierFilter filter = { FILTER_NONE };
+  GimpDrawable *kernel = NULL;
+  gboolean normalize = TRUE;
+  gint edges = PADDING_EDGE;
+  gboolean success;
+  GError *batch_error = NULL;
+  gsize count, index;
 
   gegl_init(NULL, NULL);
+  fourier_plugin_setup();
+  if (fourier_batch_keep)
+    fvals = fourier_service_vals;
 
-  if (gimp_core_object_array_get_length ((GObject **) drawables) != 1)
+  // Transforms take several drawables, or none with all-layers
+  count = gimp_core_object_array_get_length((GObject **) drawables);
+  if (!transform && count != 1)
   {
     GError *error = NULL;
 
@@ -697,31 +2608,246 @@ fourier_run(GimpProcedure *procedure,
                                             GIMP_PDB_CALLING_ERROR,
                                             error);
   }
-  else
+  else if (count > 0)
   {
     drawable = drawables[0];
   }
 
 #if FOURIER_USE_DIALOG
-  if (run_mode == GIMP_RUN_INTERACTIVE && !plugin_dialog(procedure, G_OBJECT(config)))
+  // Only the transform procedure has its dialog
+  if (run_data == NULL && run_mode == GIMP_RUN_INTERACTIVE && drawable &&
+      !plugin_dialog(procedure, G_OBJECT(config), drawable))
     return gimp_procedure_new_return_values(procedure,
                                             GIMP_PDB_CANCEL,
                                             NULL);
 
-  /*g_object_get(config,
-               "mode", &mode,
-               "new-layer", &new_layer,
-               NULL);*/
+  if (run_data == NULL)
+  {
+    gint mode;
+
+    g_object_get(config,
+                 "mode", &mode,
+                 /*"new-layer", &new_layer,*/
+                 NULL);
+    inverse = (mode == MODE_INVERSE);
+  }
 #else
   inverse = run_data == FOURIER_DATA_INV;
   new_layer = FALSE;
 #endif
 
-  if (!fourier_core(drawable, inverse /*, new_layer*/))
+  if ((run_data == FOURIER_DATA_EXPORT || run_data == FOURIER_DATA_IMPORT) &&
+      run_mode == GIMP_RUN_INTERACTIVE &&
+      !fourier_file_dialog(procedure, G_OBJECT(config), run_data == FOURIER_DATA_EXPORT))
+    return gimp_procedure_new_return_values(procedure,
+                                            GIMP_PDB_CANCEL,
+                                            NULL);
+  if (run_data == FOURIER_DATA_FILTER && run_mode == GIMP_RUN_INTERACTIVE &&
+      !fourier_filter_dialog(procedure, G_OBJECT(config)))
+    return gimp_procedure_new_return_values(procedure,
+                                            GIMP_PDB_CANCEL,
+                                            NULL);
+  if (run_data == FOURIER_DATA_CONVOLVE && run_mode == GIMP_RUN_INTERACTIVE &&
+      !fourier_convolve_dialog(procedure, G_OBJECT(config)))
+    return gimp_procedure_new_return_values(procedure,
+                                            GIMP_PDB_CANCEL,
+                                            NULL);
+  if (run_data == FOURIER_DATA_REGISTER && run_mode == GIMP_RUN_INTERACTIVE &&
+      !fourier_register_dialog(procedure, G_OBJECT(config)))
     return gimp_procedure_new_return_values(procedure,
-                                            GIMP_PDB_EXECUTION_ERROR,
+                                            GIMP_PDB_CANCEL,
                                             NULL);
 
+  g_object_get(config,
+               "threads", &fvals.threads,
+               "rigor", &fvals.rigor,
+               "memory-limit", &fvals.memory_limit,
+               NULL);
+  if (run_data == NULL || run_data == FOURIER_DATA_DIR || run_data == FOURIER_DATA_FILTER)
+    g_object_get(config, "padding", &fvals.padding, NULL);
+  if (run_data == NULL || run_data == FOURIER_DATA_DIR)
+    g_object_get(config, "luma", &fvals.luma, "record-limit", &fvals.record_limit, NULL);
+
+  if (run_data == FOURIER_DATA_FILTER)
+  {
+    gchar *notches = NULL;
+    gboolean valid;
+
+    g_object_get(config,
+                 "filter-type", &filter.type,
+                 "filter-shape", &filter.shape,
+                 "cutoff", &filter.cutoff,
+                 "cutoff-high", &filter.cutoff_high,
+                 "order", &filter.order,
+                 "notches", &notches,
+                 "notch-radius", &filter.notch_radius,
+                 NULL);
+    valid = fourier_filter_set_notches(&filter, notches);
+    g_free(notches);
+    if (!valid)
+    {
+      GError *error = NULL;
+
+      g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
+                  _("Procedure '%s' needs notches as \"x,y\" positions."),
+                  gimp_procedure_get_name(procedure));
+      return gimp_procedure_new_return_values(procedure,
+                                              GIMP_PDB_CALLING_ERROR,
+                                              error);
+    }
+  }
+
+  if (run_data == FOURIER_DATA_CONVOLVE)
+  {
+    g_object_get(config,
+                 "kernel", &kernel,
+                 "normalize", &normalize,
+                 "edges", &edges,
+                 NULL);
+    if (!kernel)
+    {
+      GError *error = NULL;
+
+      g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
+                  _("Procedure '%s' needs a kernel drawable."),
+                  gimp_procedure_get_name(procedure));
+      return gimp_procedure_new_return_values(procedure,
+                                              GIMP_PDB_CALLING_ERROR,
+                                              error);
+    }
+  }
+
+  if (run_data == FOURIER_DATA_TUNE)
+  {
+    fourier_tune_core(drawable);
+    fourier_trace_finish();
+    return gimp_procedure_new_return_values(procedure, GIMP_PDB_SUCCESS, NULL);
+  }
+
+  if (run_data == FOURIER_DATA_EXPORT || run_data == FOURIER_DATA_IMPORT)
+  {
+    GFile *file = NULL;
+    gboolean quantized = FALSE;
+    GError *error = NULL;
+
+    g_object_get(config, "file", &file, NULL);
+    if (run_data == FOURIER_DATA_EXPORT)
+      g_object_get(config, "quantized", &quantized, NULL);
+    if (!file)
+    {
+      g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
+                  _("Procedure '%s' needs a file."),
+                  gimp_procedure_get_name(procedure));
+      return gimp_procedure_new_return_values(procedure,
+                                              GIMP_PDB_CALLING_ERROR,
+                                              error);
+    }
+
+    if (run_data == FOURIER_DATA_EXPORT)
+      success = fourier_export_core(drawable, file, quantized, &error);
+    else
+      success = fourier_import_core(drawable, file, &error);
+    g_object_unref(file);
+    fourier_trace_finish();
+
+    if (!success)
+      return gimp_procedure_new_return_values(procedure,
+                                              fourier_cancelled() ? GIMP_PDB_CANCEL : GIMP_PDB_EXECUTION_ERROR,
+                                              error);
+    if (run_mode != GIMP_RUN_NONINTERACTIVE)
+      gimp_displays_flush();
+    return gimp_procedure_new_return_values(procedure, GIMP_PDB_SUCCESS, NULL);
+  }
+
+  if (run_data == FOURIER_DATA_REGISTER)
+  {
+    GimpDrawable *reference = NULL;
+    GimpValueArray *return_vals;
+    gboolean apply = TRUE;
+    double dx, dy, peak;
+    GError *error = NULL;
+
+    g_object_get(config,
+                 "reference", &reference,
+                 "apply", &apply,
+                 NULL);
+    if (!reference)
+    {
+      g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
+                  _("Procedure '%s' needs a reference drawable."),
+                  gimp_procedure_get_name(procedure));
+      return gimp_procedure_new_return_values(procedure,
+                                              GIMP_PDB_CALLING_ERROR,
+                                              error);
+    }
+
+    success = fourier_register_core(drawable, reference, apply, &dx, &dy, &peak, &error);
+    g_object_unref(reference);
+    fourier_trace_finish();
+
+    if (!success)
+      return gimp_procedure_new_return_values(procedure,
+                                              fourier_cancelled() ? GIMP_PDB_CANCEL : GIMP_PDB_EXECUTION_ERROR,
+                                              error);
+    if (run_mode == GIMP_RUN_INTERACTIVE)
+      g_message(_("The drawable is translated by %.2f, %.2f pixels from the reference (peak %.2f)."),
+                dx, dy, peak);
+    if (run_mode != GIMP_RUN_NONINTERACTIVE)
+      gimp_displays_flush();
+
+    return_vals = gimp_procedure_new_return_values(procedure, GIMP_PDB_SUCCESS, NULL);
+    GIMP_VALUES_SET_DOUBLE(return_vals, 1, dx);
+    GIMP_VALUES_SET_DOUBLE(return_vals, 2, dy);
+    GIMP_VALUES_SET_DOUBLE(return_vals, 3, peak);
+    return return_vals;
+  }
+
+  layers = g_ptr_array_new();
+  g_object_get(config, "all-layers", &all_layers, NULL);
+  if (all_layers)
+  {
+    GimpLayer **image_layers = gimp_image_get_layers(image);
+
+    fourier_layers_collect((GimpItem **) image_layers, layers);
+    g_free(image_layers);
+  }
+  else
+    for (index = 0; index < count; index++)
+      g_ptr_array_add(layers, drawables[index]);
+  if (layers->len == 0)
+  {
+    GError *error = NULL;
+
+    g_set_error(&error, GIMP_PLUG_IN_ERROR, 0,
+                _("Procedure '%s' has no drawable to transform."),
+                gimp_procedure_get_name(procedure));
+    g_ptr_array_free(layers, TRUE);
+    g_free((gpointer) filter.notch_xy);
+    g_clear_object(&kernel);
+
+    return gimp_procedure_new_return_values(procedure,
+                                            GIMP_PDB_CALLING_ERROR,
+                                            error);
+  }
+
+  if (run_data == FOURIER_DATA_FILTER)
+    success = fourier_filter_core(image, (GimpDrawable **) layers->pdata, layers->len, &filter);
+  else if (run_data == FOURIER_DATA_CONVOLVE)
+    success = fourier_convolve_core(image, (GimpDrawable **) layers->pdata, layers->len,
+                                    kernel, normalize, edges);
+  else
+    success = fourier_core(image, (GimpDrawable **) layers->pdata, layers->len, inverse /*, new_layer*/,
+                           &batch_error);
+  g_ptr_array_free(layers, TRUE);
+  g_free((gpointer) filter.notch_xy);
+  g_clear_object(&kernel);
+  fourier_trace_finish();
+  if (!success)
+    return gimp_procedure_new_return_values(procedure,
+                                            (fourier_cancelled() && !batch_error) ? GIMP_PDB_CANCEL
+                                                                                  : GIMP_PDB_EXECUTION_ERROR,
+                                            batch_error);
+
   if (run_mode != GIMP_RUN_NONINTERACTIVE)
     gimp_displays_flush();
 
@@ -730,13 +2856,300 @@ fourier_run(GimpProcedure *procedure,
 
 #if FOURIER_USE_DIALOG
 
+/*
+ * The dialog preview transforms a proxy of the selection, at most
+ * FOURIER_PREVIEW_SIZE pixels wide and high so that it is refreshed well
+ * within 50 ms. The forward proxy is the downsampled selection, whose
+ * spectrum is the center of the full one. The inverse proxy is the center
+ * of the spectrum, whose inverse is the downsampled image. Odd sizes keep
+ * the center of the spectrum aligned with the full one.
+ */
+#define FOURIER_PREVIEW_SIZE 256
+
+typedef struct
+{
+  GimpDrawable *drawable;
+  GObject *config;
+  GtkWidget *area;
+  const Babl *format;
+  gint bpp;
+  gint x, y, width, height;        /* selection */
+  gint proxy_width, proxy_height;
+  double scale;                    /* of the forward proxy */
+  guchar *src, *dst;
+} FourierPreview;
+
+static void
+fourier_preview_update(GObject *config,
+                       GParamSpec *pspec,
+                       FourierPreview *preview)
+{
+  GeglBuffer *buffer;
+  gboolean luma;
+  gint mode;
+  gsize i;
+  guchar *pixel;
+
+  g_object_get(config, "mode", &mode, "luma", &luma, NULL);
+
+  buffer = gimp_drawable_get_buffer(preview->drawable);
+  if (mode == MODE_INVERSE)
+    gegl_buffer_get(buffer,
+                    GEGL_RECTANGLE(preview->x + preview->width / 2 - preview->proxy_width / 2,
+                                   preview->y + preview->height / 2 - preview->proxy_height / 2,
+                                   preview->proxy_width, preview->proxy_height),
+                    1.0, preview->format, preview->src,
+                    GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  else
+    gegl_buffer_get(buffer,
+                    GEGL_RECTANGLE(floor(preview->x * preview->scale),
+                                   floor(preview->y * preview->scale),
+                                   preview->proxy_width, preview->proxy_height),
+                    preview->scale, preview->format, preview->src,
+                    GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  g_object_unref(buffer);
+
+  // The luma spectrum is shown in all channels, as the forward writes it
+  if (luma && mode != MODE_INVERSE && preview->bpp == 3)
+    for (i = 0, pixel = preview->src; i < (gsize)preview->proxy_width * preview->proxy_height; i++, pixel += 3)
+      pixel[0] = pixel[1] = pixel[2] = (guchar)(0.299 * pixel[0] + 0.587 * pixel[1] + 0.114 * pixel[2] + 0.5);
+
+  fourier_proxy_process(preview->src, preview->dst,
+                        preview->proxy_width, preview->proxy_height,
+                        preview->bpp, mode == MODE_INVERSE);
+
+  gimp_preview_area_draw(GIMP_PREVIEW_AREA(preview->area),
+                         0, 0, preview->proxy_width, preview->proxy_height,
+                         (preview->bpp == 1) ? GIMP_GRAY_IMAGE : GIMP_RGB_IMAGE,
+                         preview->dst, preview->proxy_width * preview->bpp);
+}
+
+// The area can only be drawn once allocated
+static void
+fourier_preview_allocate(GtkWidget *area,
+                         GdkRectangle *allocation,
+                         FourierPreview *preview)
+{
+  fourier_preview_update(preview->config, NULL, preview);
+}
+
+static gboolean
+fourier_preview_init(FourierPreview *preview,
+                     GObject *config,
+                     GimpDrawable *drawable)
+{
+  preview->config = config;
+  preview->drawable = drawable;
+  if (!gimp_drawable_mask_intersect(drawable,
+                                    &preview->x, &preview->y,
+                                    &preview->width, &preview->height))
+    return FALSE;
+
+  // Alpha is not transformed, the preview shows the color channels only
+  preview->format = fourier_format(gimp_drawable_is_gray(drawable), FALSE);
+  preview->bpp = babl_format_get_bytes_per_pixel(preview->format);
+  preview->scale = MIN(1.0, (double)FOURIER_PREVIEW_SIZE / MAX(preview->width, preview->height));
+  preview->proxy_width = MAX(1, (gint)(preview->width * preview->scale));
+  preview->proxy_height = MAX(1, (gint)(preview->height * preview->scale));
+  if (preview->proxy_width < preview->width && preview->proxy_width % 2 == 0)
+    preview->proxy_width--;
+  if (preview->proxy_height < preview->height && preview->proxy_height % 2 == 0)
+    preview->proxy_height--;
+
+  preview->src = g_new(guchar, (gsize)preview->proxy_width * preview->proxy_height * preview->bpp);
+  preview->dst = g_new(guchar, (gsize)preview->proxy_width * preview->proxy_height * preview->bpp);
+  return TRUE;
+}
+
 static gboolean
 plugin_dialog(GimpProcedure *procedure,
-              GObject *config)
+              GObject *config,
+              GimpDrawable *drawable)
 {
   GtkWidget *dlg;
   GtkWidget *vbox;
   GtkWidget *hbox;
+  GtkWidget *frame;
+  GtkListStore *store;
+  FourierPreview preview = { NULL };
+  gboolean has_preview;
+  gboolean run;
+
+  gimp_ui_init(PLUG_IN_BINARY);
+
+  dlg = gimp_procedure_dialog_new(procedure,
+                                  GIMP_PROCEDURE_CONFIG(config),
+                                  _("Fourier"));
+
+  gimp_dialog_set_alternative_button_order(GTK_DIALOG(dlg),
+                                           GTK_RESPONSE_OK,
+                                           GTK_RESPONSE_CANCEL,
+                                           -1);
+
+  gimp_window_set_transient(GTK_WINDOW(dlg));
+
+  store = gimp_int_store_new(_("_Forward"), MODE_FORWARD,
+                             _("_Inverse"), MODE_INVERSE,
+                             NULL);
+  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
+                                      "mode", GIMP_INT_STORE(store));
+
+  store = gimp_int_store_new(_("No_ne"), PADDING_NONE,
+                             _("_Edge"), PADDING_EDGE,
+                             _("Mi_rror"), PADDING_MIRROR,
+                             NULL);
+  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
+                                      "padding", GIMP_INT_STORE(store));
+
+  vbox = gimp_procedure_dialog_fill_box(GIMP_PROCEDURE_DIALOG(dlg),
+                                        "fourier-left-side",
+                                        "mode",
+                                        "padding",
+                                        "luma",
+                                        "all-layers",
+                                        "new-layer",
+                                        NULL);
+  gtk_box_set_spacing(GTK_BOX(vbox), 12);
+
+  hbox = gimp_procedure_dialog_fill_box(GIMP_PROCEDURE_DIALOG(dlg),
+                                        "fourier-hbox",
+                                        "fourier-left-side",
+                                        "action",
+                                        NULL);
+  gtk_box_set_spacing(GTK_BOX(hbox), 12);
+  gtk_box_set_homogeneous(GTK_BOX(hbox), TRUE);
+  gtk_widget_set_margin_bottom(hbox, 12);
+  gtk_orientable_set_orientation(GTK_ORIENTABLE(hbox),
+                                 GTK_ORIENTATION_HORIZONTAL);
+
+  has_preview = fourier_preview_init(&preview, config, drawable);
+  if (has_preview)
+  {
+    frame = gtk_frame_new(NULL);
+    gtk_frame_set_shadow_type(GTK_FRAME(frame), GTK_SHADOW_IN);
+    gtk_widget_set_halign(frame, GTK_ALIGN_CENTER);
+    gtk_widget_set_valign(frame, GTK_ALIGN_CENTER);
+    gtk_box_pack_start(GTK_BOX(hbox), frame, FALSE, FALSE, 0);
+
+    preview.area = gimp_preview_area_new();
+    gtk_widget_set_size_request(preview.area, preview.proxy_width, preview.proxy_height);
+    gtk_container_add(GTK_CONTAINER(frame), preview.area);
+    gtk_widget_show_all(frame);
+
+    g_signal_connect_after(preview.area, "size-allocate",
+                           G_CALLBACK(fourier_preview_allocate), &preview);
+    g_signal_connect(config, "notify::mode",
+                     G_CALLBACK(fourier_preview_update), &preview);
+    g_signal_connect(config, "notify::luma",
+                     G_CALLBACK(fourier_preview_update), &preview);
+  }
+
+  gimp_procedure_dialog_fill(GIMP_PROCEDURE_DIALOG(dlg),
+                             "fourier-hbox",
+                             NULL);
+
+  gtk_widget_show(dlg);
+
+  run = gimp_procedure_dialog_run(GIMP_PROCEDURE_DIALOG(dlg));
+
+  if (has_preview)
+    g_signal_handlers_disconnect_by_func(config, fourier_preview_update, &preview);
+  gtk_widget_destroy(dlg);
+  g_free(preview.src);
+  g_free(preview.dst);
+  // The full resolution transform only runs on OK, with its own plans
+  fourier_proxy_free();
+
+  return run;
+}
+
+#endif
+
+static gboolean
+fourier_file_dialog(GimpProcedure *procedure,
+                    GObject *config,
+                    gboolean export)
+{
+  GtkWidget *dlg;
+  gboolean run;
+
+  gimp_ui_init(PLUG_IN_BINARY);
+
+  dlg = gimp_procedure_dialog_new(procedure,
+                                  GIMP_PROCEDURE_CONFIG(config),
+                                  export ? _("Export Spectrum") : _("Import Spectrum"));
+
+  if (export)
+    gimp_procedure_dialog_fill(GIMP_PROCEDURE_DIALOG(dlg),
+                               "file", "quantized",
+                               NULL);
+  else
+    gimp_procedure_dialog_fill(GIMP_PROCEDURE_DIALOG(dlg),
+                               "file",
+                               NULL);
+
+  run = gimp_procedure_dialog_run(GIMP_PROCEDURE_DIALOG(dlg));
+
+  gtk_widget_destroy(dlg);
+
+  return run;
+}
+
+static gboolean
+fourier_filter_dialog(GimpProcedure *procedure,
+                      GObject *config)
+{
+  GtkWidget *dlg;
+  GtkListStore *store;
+  gboolean run;
+
+  gimp_ui_init(PLUG_IN_BINARY);
+
+  dlg = gimp_procedure_dialog_new(procedure,
+                                  GIMP_PROCEDURE_CONFIG(config),
+                                  _("Fourier Filter"));
+
+  store = gimp_int_store_new(_("No_ne, notches only"), FILTER_NONE,
+                             _("_Low pass"), FILTER_LOW_PASS,
+                             _("_High pass"), FILTER_HIGH_PASS,
+                             _("_Band pass"), FILTER_BAND_PASS,
+                             NULL);
+  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
+                                      "filter-type", GIMP_INT_STORE(store));
+
+  store = gimp_int_store_new(_("_Ideal"), FILTER_IDEAL,
+                             _("B_utterworth"), FILTER_BUTTERWORTH,
+                             _("_Gaussian"), FILTER_GAUSSIAN,
+                             NULL);
+  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
+                                      "filter-shape", GIMP_INT_STORE(store));
+
+  store = gimp_int_store_new(_("No_ne"), PADDING_NONE,
+                             _("_Edge"), PADDING_EDGE,
+                             _("Mi_rror"), PADDING_MIRROR,
+                             NULL);
+  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
+                                      "padding", GIMP_INT_STORE(store));
+
+  gimp_procedure_dialog_fill(GIMP_PROCEDURE_DIALOG(dlg),
+                             "filter-type", "filter-shape",
+                             "cutoff", "cutoff-high", "order",
+                             "notches", "notch-radius",
+                             "padding", "all-layers",
+                             NULL);
+
+  run = gimp_procedure_dialog_run(GIMP_PROCEDURE_DIALOG(dlg));
+
+  gtk_widget_destroy(dlg);
+
+  return run;
+}
+
+static gboolean
+fourier_convolve_dialog(GimpProcedure *procedure,
+                        GObject *config)
+{
+  GtkWidget *dlg;
   GtkListStore *store;
   gboolean run;
 
@@ -744,45 +3157,42 @@ plugin_dialog(GimpProcedure *procedure,
 
   dlg = gimp_procedure_dialog_new(procedure,
                                   GIMP_PROCEDURE_CONFIG(config),
-                                  _("Fourier"));
-
-  gimp_dialog_set_alternative_button_order(GTK_DIALOG(dlg),
-                                           GTK_RESPONSE_OK,
-                                           GTK_RESPONSE_CANCEL,
-                                           -1);
-
-  gimp_window_set_transient(GTK_WINDOW(dlg));
-
-  store = gimp_int_store_new(_("_Forward"), MODE_FORWARD,
-                             _("_Inverse"), MODE_INVERSE,
-                             NULL);
-  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
-                                      "mode", GIMP_INT_STORE(store));
-
-  vbox = gimp_procedure_dialog_fill_box(GIMP_PROCEDURE_DIALOG(dlg),
-                                        "fourier-left-side",
-                                        "mode",
-                                        "new-layer",
-                                        NULL);
-  gtk_box_set_spacing(GTK_BOX(vbox), 12);
-
-  hbox = gimp_procedure_dialog_fill_box(GIMP_PROCEDURE_DIALOG(dlg),
-                                        "fourier-hbox",
-                                        "fourier-left-side",
-                                        "action",
-                                        NULL);
-  gtk_box_set_spacing(GTK_BOX(hbox), 12);
-  gtk_box_set_homogeneous(GTK_BOX(hbox), TRUE);
-  gtk_widget_set_margin_bottom(hbox, 12);
-  gtk_orientable_set_orientation(GTK_ORIENTABLE(hbox),
-                                 GTK_ORIENTATION_HORIZONTAL);
+                                  _("Fourier Convolution"));
+
+  store = gimp_int_store_new(_("_Edge"), PADDING_EDGE,
+                             _("Mi_rror"), PADDING_MIRROR,
+                             NULL);
+  gimp_procedure_dialog_get_int_radio(GIMP_PROCEDURE_DIALOG(dlg),
+                                      "edges", GIMP_INT_STORE(store));
+
+  gimp_procedure_dialog_fill(GIMP_PROCEDURE_DIALOG(dlg),
+                             "kernel", "normalize", "edges", "all-layers",
+                             NULL);
+
+  run = gimp_procedure_dialog_run(GIMP_PROCEDURE_DIALOG(dlg));
+
+  gtk_widget_destroy(dlg);
+
+  return run;
+}
+
+static gboolean
+fourier_register_dialog(GimpProcedure *procedure,
+                        GObject *config)
+{
+  GtkWidget *dlg;
+  gboolean run;
+
+  gimp_ui_init(PLUG_IN_BINARY);
+
+  dlg = gimp_procedure_dialog_new(procedure,
+                                  GIMP_PROCEDURE_CONFIG(config),
+                                  _("Fourier Registration"));
 
   gimp_procedure_dialog_fill(GIMP_PROCEDURE_DIALOG(dlg),
-                             "fourier-hbox",
+                             "reference", "apply",
                              NULL);
 
-  gtk_widget_show(dlg);
-
   run = gimp_procedure_dialog_run(GIMP_PROCEDURE_DIALOG(dlg));
 
   gtk_widget_destroy(dlg);
@@ -790,8 +3200,6 @@ plugin_dialog(GimpProcedure *procedure,
   return run;
 }
 
-#endif
-
 #elif GIMP_MAJOR_VERSION == 2
 /** GIMP 2 *******************************************************************/
 
@@ -814,14 +3222,73 @@ GimpPlugInInfo PLUG_IN_INFO = {
 
 MAIN()
 
+/* Definition of parameters */
+static GimpParamDef fourier_args[] = {
+    {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
+    {GIMP_PDB_IMAGE, (gchar *)"image", (gchar *)"Input image (unused)"},
+    {GIMP_PDB_DRAWABLE, (gchar *)"drawable", (gchar *)"Input drawable"},
+    {GIMP_PDB_INT32, (gchar *)"threads", (gchar *)PLUG_IN_THREADS_DESC},
+    {GIMP_PDB_INT32, (gchar *)"rigor", (gchar *)PLUG_IN_RIGOR_DESC},
+    {GIMP_PDB_INT32, (gchar *)"memory_limit", (gchar *)PLUG_IN_MEMORY_LIMIT_DESC},
+    {GIMP_PDB_INT32, (gchar *)"padding", (gchar *)PLUG_IN_PADDING_DESC " (forward only)"},
+    {GIMP_PDB_INT32, (gchar *)"all_layers", (gchar *)PLUG_IN_ALL_LAYERS_DESC " (forward and inverse only)"},
+    {GIMP_PDB_INT32, (gchar *)"luma", (gchar *)PLUG_IN_LUMA_DESC " (forward only)"},
+    {GIMP_PDB_INT32, (gchar *)"record_limit", (gchar *)PLUG_IN_RECORD_LIMIT_DESC " (forward only)"}};
+static GimpParamDef fourier_export_args[] = {
+    {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
+    {GIMP_PDB_IMAGE, (gchar *)"image", (gchar *)"Input image (unused)"},
+    {GIMP_PDB_DRAWABLE, (gchar *)"drawable", (gchar *)"Input drawable"},
+    {GIMP_PDB_INT32, (gchar *)"threads", (gchar *)PLUG_IN_THREADS_DESC},
+    {GIMP_PDB_INT32, (gchar *)"rigor", (gchar *)PLUG_IN_RIGOR_DESC},
+    {GIMP_PDB_INT32, (gchar *)"memory_limit", (gchar *)PLUG_IN_MEMORY_LIMIT_DESC},
+    {GIMP_PDB_STRING, (gchar *)"filename", (gchar *)"NPY file"},
+    {GIMP_PDB_INT32, (gchar *)"quantized", (gchar *)"Export the spectrum as quantized by FFT Forward (export only)"}};
+static GimpParamDef fourier_filter_args[] = {
+    {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
+    {GIMP_PDB_IMAGE, (gchar *)"image", (gchar *)"Input image (unused)"},
+    {GIMP_PDB_DRAWABLE, (gchar *)"drawable", (gchar *)"Input drawable"},
+    {GIMP_PDB_INT32, (gchar *)"threads", (gchar *)PLUG_IN_THREADS_DESC},
+    {GIMP_PDB_INT32, (gchar *)"rigor", (gchar *)PLUG_IN_RIGOR_DESC},
+    {GIMP_PDB_INT32, (gchar *)"memory_limit", (gchar *)PLUG_IN_MEMORY_LIMIT_DESC},
+    {GIMP_PDB_INT32, (gchar *)"padding", (gchar *)PLUG_IN_PADDING_DESC},
+    {GIMP_PDB_INT32, (gchar *)"all_layers", (gchar *)PLUG_IN_ALL_LAYERS_DESC},
+    {GIMP_PDB_INT32, (gchar *)"filter_type", (gchar *)PLUG_IN_FILTER_TYPE_DESC},
+    {GIMP_PDB_INT32, (gchar *)"filter_shape", (gchar *)PLUG_IN_FILTER_SHAPE_DESC},
+    {GIMP_PDB_FLOAT, (gchar *)"cutoff", (gchar *)PLUG_IN_FILTER_CUTOFF_DESC},
+    {GIMP_PDB_FLOAT, (gchar *)"cutoff_high", (gchar *)PLUG_IN_FILTER_CUTOFF_HIGH_DESC},
+    {GIMP_PDB_INT32, (gchar *)"order", (gchar *)PLUG_IN_FILTER_ORDER_DESC},
+    {GIMP_PDB_STRING, (gchar *)"notches", (gchar *)PLUG_IN_FILTER_NOTCHES_DESC},
+    {GIMP_PDB_FLOAT, (gchar *)"notch_radius", (gchar *)PLUG_IN_FILTER_NOTCH_RADIUS_DESC}};
+static GimpParamDef fourier_convolve_args[] = {
+    {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
+    {GIMP_PDB_IMAGE, (gchar *)"image", (gchar *)"Input image (unused)"},
+    {GIMP_PDB_DRAWABLE, (gchar *)"drawable", (gchar *)"Input drawable"},
+    {GIMP_PDB_INT32, (gchar *)"threads", (gchar *)PLUG_IN_THREADS_DESC},
+    {GIMP_PDB_INT32, (gchar *)"rigor", (gchar *)PLUG_IN_RIGOR_DESC},
+    {GIMP_PDB_INT32, (gchar *)"memory_limit", (gchar *)PLUG_IN_MEMORY_LIMIT_DESC},
+    {GIMP_PDB_INT32, (gchar *)"edges", (gchar *)PLUG_IN_CONVOLVE_EDGES_DESC},
+    {GIMP_PDB_INT32, (gchar *)"all_layers", (gchar *)PLUG_IN_ALL_LAYERS_DESC},
+    {GIMP_PDB_DRAWABLE, (gchar *)"kernel", (gchar *)PLUG_IN_CONVOLVE_KERNEL_DESC},
+    {GIMP_PDB_INT32, (gchar *)"normalize", (gchar *)PLUG_IN_CONVOLVE_NORMALIZE_DESC}};
+static GimpParamDef fourier_register_args[] = {
+    {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
+    {GIMP_PDB_IMAGE, (gchar *)"image", (gchar *)"Input image (unused)"},
+    {GIMP_PDB_DRAWABLE, (gchar *)"drawable", (gchar *)"Input drawable"},
+    {GIMP_PDB_INT32, (gchar *)"threads", (gchar *)PLUG_IN_THREADS_DESC},
+    {GIMP_PDB_INT32, (gchar *)"rigor", (gchar *)PLUG_IN_RIGOR_DESC},
+    {GIMP_PDB_INT32, (gchar *)"memory_limit", (gchar *)PLUG_IN_MEMORY_LIMIT_DESC},
+    {GIMP_PDB_DRAWABLE, (gchar *)"reference", (gchar *)PLUG_IN_REGISTER_REFERENCE_DESC},
+    {GIMP_PDB_INT32, (gchar *)"apply", (gchar *)PLUG_IN_REGISTER_APPLY_DESC}};
+static GimpParamDef fourier_register_return_vals[] = {
+    {GIMP_PDB_FLOAT, (gchar *)"offset_x", (gchar *)PLUG_IN_REGISTER_OFFSET_X_DESC},
+    {GIMP_PDB_FLOAT, (gchar *)"offset_y", (gchar *)PLUG_IN_REGISTER_OFFSET_Y_DESC},
+    {GIMP_PDB_FLOAT, (gchar *)"peak", (gchar *)PLUG_IN_REGISTER_PEAK_DESC}};
+static GimpParamDef fourier_service_args[] = {
+    {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
+    {GIMP_PDB_INT32, (gchar *)"idle_timeout", (gchar *)PLUG_IN_SERVICE_IDLE_TIMEOUT_DESC}};
+
 void query(void)
 {
-  /* Definition of parameters */
-  static GimpParamDef args[] = {
-      {GIMP_PDB_INT32, (gchar *)"run_mode", (gchar *)"Interactive, non-interactive"},
-      {GIMP_PDB_IMAGE, (gchar *)"image", (gchar *)"Input image (unused)"},
-      {GIMP_PDB_DRAWABLE, (gchar *)"drawable", (gchar *)"Input drawable"}};
-
   /* Forward FFT */
   gimp_install_procedure(
       PLUG_IN_DIR_PROC,
@@ -833,8 +3300,8 @@ void query(void)
       PLUG_IN_DIR_MENU_LABEL,
       "RGB*, GRAY*",
       GIMP_PLUGIN,
-      G_N_ELEMENTS(args), 0,
-      args, NULL);
+      G_N_ELEMENTS(fourier_args), 0,
+      fourier_args, NULL);
   gimp_plugin_menu_register(PLUG_IN_DIR_PROC, PLUG_IN_MENU_LOCATION);
 
   /* Inverse FFT */
@@ -848,9 +3315,478 @@ void query(void)
       PLUG_IN_INV_MENU_LABEL,
       "RGB*, GRAY*",
       GIMP_PLUGIN,
-      G_N_ELEMENTS(args), 0,
-      args, NULL);
+      G_N_ELEMENTS(fourier_args), 0,
+      fourier_args, NULL);
   gimp_plugin_menu_register(PLUG_IN_INV_PROC, PLUG_IN_MENU_LOCATION);
+
+  /* Tune FFT plans */
+  gimp_install_procedure(
+      PLUG_IN_TUNE_PROC,
+      PLUG_IN_TUNE_DESC,
+      PLUG_IN_TUNE_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      PLUG_IN_TUNE_MENU_LABEL,
+      "RGB*, GRAY*",
+      GIMP_PLUGIN,
+      G_N_ELEMENTS(fourier_args), 0,
+      fourier_args, NULL);
+  gimp_plugin_menu_register(PLUG_IN_TUNE_PROC, PLUG_IN_MENU_LOCATION);
+
+  /* Spectrum files, no menu as there is no dialog to choose the file */
+  gimp_install_procedure(
+      PLUG_IN_EXPORT_PROC,
+      PLUG_IN_EXPORT_DESC,
+      PLUG_IN_EXPORT_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      NULL,
+      "RGB*, GRAY*",
+      GIMP_PLUGIN,
+      G_N_ELEMENTS(fourier_export_args), 0,
+      fourier_export_args, NULL);
+  gimp_install_procedure(
+      PLUG_IN_IMPORT_PROC,
+      PLUG_IN_IMPORT_DESC,
+      PLUG_IN_IMPORT_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      NULL,
+      "RGB*, GRAY*",
+      GIMP_PLUGIN,
+      G_N_ELEMENTS(fourier_export_args) - 1, 0,
+      fourier_export_args, NULL);
+
+  /* One pass filter, no menu as there is no dialog to choose the filter */
+  gimp_install_procedure(
+      PLUG_IN_FILTER_PROC,
+      PLUG_IN_FILTER_DESC,
+      PLUG_IN_FILTER_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      NULL,
+      "RGB*, GRAY*",
+      GIMP_PLUGIN,
+      G_N_ELEMENTS(fourier_filter_args), 0,
+      fourier_filter_args, NULL);
+
+  /* Convolution by a kernel drawable, no menu as there is no dialog to choose the kernel */
+  gimp_install_procedure(
+      PLUG_IN_CONVOLVE_PROC,
+      PLUG_IN_CONVOLVE_DESC,
+      PLUG_IN_CONVOLVE_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      NULL,
+      "RGB*, GRAY*",
+      GIMP_PLUGIN,
+      G_N_ELEMENTS(fourier_convolve_args), 0,
+      fourier_convolve_args, NULL);
+
+  /* Registration, no menu as there is no dialog to choose the reference */
+  gimp_install_procedure(
+      PLUG_IN_REGISTER_PROC,
+      PLUG_IN_REGISTER_DESC,
+      PLUG_IN_REGISTER_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      NULL,
+      "RGB*, GRAY*",
+      GIMP_PLUGIN,
+      G_N_ELEMENTS(fourier_register_args), G_N_ELEMENTS(fourier_register_return_vals),
+      fourier_register_args, fourier_register_return_vals);
+
+  /* Resident service, started on demand, see fourier_service_run() */
+  gimp_install_procedure(
+      PLUG_IN_SERVICE_PROC,
+      PLUG_IN_SERVICE_DESC,
+      PLUG_IN_SERVICE_SHORT_DESC,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_AUTHOR,
+      PLUG_IN_VERSION,
+      NULL,
+      NULL,
+      GIMP_EXTENSION,
+      G_N_ELEMENTS(fourier_service_args), 0,
+      fourier_service_args, NULL);
+}
+
+static void
+fourier_record_set_token(gint32 drawable_id, const gchar *name, guint64 token)
+{
+  GimpParasite *parasite;
+
+  parasite = gimp_parasite_new(name, GIMP_PARASITE_PERSISTENT | GIMP_PARASITE_UNDOABLE,
+                               sizeof(token), &token);
+  gimp_item_attach_parasite(drawable_id, parasite);
+  gimp_parasite_free(parasite);
+}
+
+/* name is FOURIER_RECORD_PARASITE, or FOURIER_LUMA_PARASITE for luma spectra */
+static gboolean
+fourier_record_get_token(gint32 drawable_id, const gchar *name, guint64 *token)
+{
+  GimpParasite *parasite;
+  gboolean valid;
+
+  parasite = gimp_item_get_parasite(drawable_id, name);
+  if (!parasite)
+    return FALSE;
+  valid = (gimp_parasite_data_size(parasite) == sizeof(*token));
+  if (valid)
+    memcpy(token, gimp_parasite_data(parasite), sizeof(*token));
+  gimp_parasite_free(parasite);
+  return valid;
+}
+
+static gboolean
+fourier_padding_get(gint32 drawable_id, FourierPadding *padding)
+{
+  GimpParasite *parasite;
+  gboolean valid;
+
+  parasite = gimp_item_get_parasite(drawable_id, FOURIER_PADDING_PARASITE);
+  if (!parasite)
+    return FALSE;
+  valid = (gimp_parasite_data_size(parasite) == sizeof(*padding));
+  if (valid)
+    memcpy(padding, gimp_parasite_data(parasite), sizeof(*padding));
+  gimp_parasite_free(parasite);
+  return valid;
+}
+
+static void
+fourier_padding_grow(gint32 drawable_id, gint padded_width, gint padded_height)
+{
+  gint32 image_id = gimp_item_get_image(drawable_id);
+  GimpParasite *parasite;
+  FourierPadding padding;
+  gint offset_x, offset_y;
+
+  padding.width = gimp_drawable_width(drawable_id);
+  padding.height = gimp_drawable_height(drawable_id);
+  padding.canvas_width = gimp_image_width(image_id);
+  padding.canvas_height = gimp_image_height(image_id);
+
+  gimp_layer_resize(drawable_id, padded_width, padded_height, 0, 0);
+  gimp_drawable_offsets(drawable_id, &offset_x, &offset_y);
+  if (offset_x + padded_width > padding.canvas_width || offset_y + padded_height > padding.canvas_height)
+    gimp_image_resize(image_id,
+                      MAX(padding.canvas_width, offset_x + padded_width),
+                      MAX(padding.canvas_height, offset_y + padded_height), 0, 0);
+
+  parasite = gimp_parasite_new(FOURIER_PADDING_PARASITE, GIMP_PARASITE_PERSISTENT | GIMP_PARASITE_UNDOABLE,
+                               sizeof(padding), &padding);
+  gimp_item_attach_parasite(drawable_id, parasite);
+  gimp_parasite_free(parasite);
+}
+
+static void
+fourier_padding_crop(gint32 drawable_id, const FourierPadding *padding)
+{
+  gint32 image_id = gimp_item_get_image(drawable_id);
+
+  gimp_layer_resize(drawable_id, padding->width, padding->height, 0, 0);
+  if (gimp_image_width(image_id) > padding->canvas_width ||
+      gimp_image_height(image_id) > padding->canvas_height)
+    gimp_image_resize(image_id,
+                      MIN(gimp_image_width(image_id), padding->canvas_width),
+                      MIN(gimp_image_height(image_id), padding->canvas_height), 0, 0);
+  gimp_item_detach_parasite(drawable_id, FOURIER_PADDING_PARASITE);
+}
+
+/* Batch callbacks, data is the array of drawable ids */
+static gboolean
+fourier_layer_prepare(FourierBatchItem *item, gpointer data)
+{
+  gint32 drawable_id = ((gint32 *) data)[item->index];
+  gint32 image_id = gimp_item_get_image(drawable_id);
+  gint sel_x1, sel_y1, sel_width, sel_height, bpp;
+  gboolean whole_layer, missing;
+  guint64 token;
+  gchar *name;
+
+  if (!gimp_drawable_mask_intersect(drawable_id, &sel_x1, &sel_y1, &sel_width, &sel_height))
+    return FALSE;
+
+  item->format = fourier_format(gimp_drawable_is_gray(drawable_id), gimp_drawable_has_alpha(drawable_id));
+  bpp = babl_format_get_bytes_per_pixel(item->format);
+
+  item->roi = *GEGL_RECTANGLE(sel_x1, sel_y1, sel_width, sel_height);
+  item->padded_width = sel_width;
+  item->padded_height = sel_height;
+
+  // Only whole layers can be padded, the inverse crops the padding away
+  whole_layer = gimp_item_is_layer(drawable_id) && sel_x1 == 0 && sel_y1 == 0 &&
+                sel_width == gimp_drawable_width(drawable_id) &&
+                sel_height == gimp_drawable_height(drawable_id);
+  // Filters only pad their scratch, the layer keeps its size
+  if (item->filter && fvals.padding != PADDING_NONE)
+    fourier_padded_size(sel_width, sel_height, &item->padded_width, &item->padded_height);
+  else if (item->filter)
+    ;
+  else if (whole_layer && !item->inverse && fvals.padding != PADDING_NONE)
+    fourier_padded_size(sel_width, sel_height, &item->padded_width, &item->padded_height);
+  else if (whole_layer && item->inverse && fourier_padding_get(drawable_id, &item->padding) &&
+           item->padding.width <= sel_width && item->padding.height <= sel_height)
+    item->roi = *GEGL_RECTANGLE(0, 0, item->padding.width, item->padding.height);
+  item->padded = !item->filter &&
+                 (item->padded_width != item->roi.width || item->padded_height != item->roi.height);
+
+  // The record of the inverse is opened before anything is changed, a luma spectrum needs it
+  if (!item->filter && item->inverse)
+  {
+    if (fourier_record_get_token(drawable_id, FOURIER_RECORD_PARASITE, &item->token))
+      item->recorded = fourier_record_open(item->token, &item->roi,
+                                           item->padded_width, item->padded_height, bpp, &item->luma);
+    if (fourier_record_get_token(drawable_id, FOURIER_LUMA_PARASITE, &token))
+    {
+      name = gimp_item_get_name(drawable_id);
+      missing = fourier_batch_luma_missing(item, token, name);
+      g_free(name);
+      if (missing)
+        return FALSE;
+    }
+  }
+
+  if (item->padded)
+  {
+    gimp_image_undo_group_start(image_id);
+    if (!item->inverse)
+      fourier_padding_grow(drawable_id, item->padded_width, item->padded_height);
+  }
+
+  // Buffers are taken on the grown layer
+  item->src_buffer = gimp_drawable_get_buffer(drawable_id);
+  item->dest_buffer = gimp_drawable_get_shadow_buffer(drawable_id);
+
+  // Forward is recorded, so that the inverse of an edited spectrum only transforms the changes
+  if (!item->filter && !item->inverse)
+  {
+    // The chroma of a luma spectrum is only kept by the record
+    item->luma = fvals.luma && fourier_format_colors(item->format) == 3;
+    item->record = fourier_record_create(fourier_record_get_token(drawable_id, FOURIER_RECORD_PARASITE, &token) ?
+                                         &token : NULL,
+                                         &item->roi, item->padded_width, item->padded_height,
+                                         item->format, item->luma, &item->token);
+    item->luma = item->luma && item->record;
+  }
+
+  return TRUE;
+}
+
+static void
+fourier_layer_finish(FourierBatchItem *item, gboolean success, gpointer data)
+{
+  gint32 drawable_id = ((gint32 *) data)[item->index];
+  gint32 image_id = gimp_item_get_image(drawable_id);
+  FourierPadding padded_from;
+  guint64 token;
+
+  g_object_unref(item->src_buffer);
+  g_object_unref(item->dest_buffer);
+  if (item->recorded)
+    g_mapped_file_unref(item->recorded);
+
+  // A cancelled transform drops the shadow, the drawable is left as it was
+  if (success)
+  {
+    FOURIER_TRACE_BEGIN("merge_shadow");
+    gimp_drawable_merge_shadow(drawable_id, TRUE);
+    FOURIER_TRACE_END();
+    gimp_drawable_update(drawable_id, item->roi.x, item->roi.y, item->padded_width, item->padded_height);
+  }
+  if (item->padded)
+  {
+    if (item->inverse && success)
+      fourier_padding_crop(drawable_id, &item->padding);
+    else if (!item->inverse && !success && fourier_padding_get(drawable_id, &padded_from))
+      fourier_padding_crop(drawable_id, &padded_from);
+    gimp_image_undo_group_end(image_id);
+  }
+
+  if (item->record && fourier_record_close(item->record) && success)
+    fourier_record_set_token(drawable_id, FOURIER_RECORD_PARASITE, item->token);
+  // Luma spectra are tagged even when their record failed, so that their inverse fails too
+  if (success && !item->filter && !item->inverse && item->luma)
+    fourier_record_set_token(drawable_id, FOURIER_LUMA_PARASITE, item->token);
+  else if (success && !item->filter && fourier_record_get_token(drawable_id, FOURIER_LUMA_PARASITE, &token))
+    gimp_item_detach_parasite(drawable_id, FOURIER_LUMA_PARASITE);
+}
+
+/* All layers of the image, those inside layer groups included */
+static void
+fourier_layers_collect(const gint32 *items, gint count, GArray *layers)
+{
+  gint32 *children;
+  gint i, num_children;
+
+  for (i = 0; i < count; i++)
+    if (gimp_item_is_group(items[i]))
+    {
+      children = gimp_item_get_children(items[i], &num_children);
+      fourier_layers_collect(children, num_children, layers);
+      g_free(children);
+    }
+    else
+      g_array_append_val(layers, items[i]);
+}
+
+
+/* Convolve the selection of each layer but the kernel itself, FALSE when cancelled */
+static gboolean
+fourier_convolve_layers(const gint32 *layers, gint count, gint32 kernel_id,
+                        gboolean normalize, gint extension)
+{
+  GeglBuffer *kernel_buffer = gimp_drawable_get_buffer(kernel_id);
+  GeglBuffer *src_buffer, *dest_buffer;
+  const Babl *format;
+  double *kernel;
+  gint kernel_width, kernel_height, kernel_planes;
+  gint x, y, width, height, index;
+  gboolean success = TRUE;
+
+  fourier_progress_reset();
+  fourier_progress_span = 1.0 / MAX(count, 1);
+  for (index = 0; index < count && success; index++)
+  {
+    if (layers[index] == kernel_id ||
+        !gimp_drawable_mask_intersect(layers[index], &x, &y, &width, &height))
+      continue;
+    fourier_progress_start = (double)index / count;
+
+    format = fourier_format(gimp_drawable_is_gray(layers[index]), gimp_drawable_has_alpha(layers[index]));
+    kernel = fourier_kernel_read(kernel_buffer, fourier_format(gimp_drawable_is_gray(layers[index]), FALSE),
+                                 normalize, &kernel_width, &kernel_height, &kernel_planes);
+
+    src_buffer = gimp_drawable_get_buffer(layers[index]);
+    dest_buffer = gimp_drawable_get_shadow_buffer(layers[index]);
+    success = fourier_convolve_buffer(src_buffer, dest_buffer, GEGL_RECTANGLE(x, y, width, height), format,
+                                      kernel, kernel_width, kernel_height, kernel_planes, extension);
+    g_object_unref(src_buffer);
+    g_object_unref(dest_buffer);
+    g_free(kernel);
+
+    if (success)
+    {
+      FOURIER_TRACE_BEGIN("merge_shadow");
+      gimp_drawable_merge_shadow(layers[index], TRUE);
+      FOURIER_TRACE_END();
+      gimp_drawable_update(layers[index], x, y, width, height);
+    }
+  }
+  fourier_progress_start = 0.0;
+  fourier_progress_span = 1.0;
+  fourier_progress(1.0);
+  g_object_unref(kernel_buffer);
+
+  return success;
+}
+
+/* Translation of the selection of drawable_id relative to reference_id, see fourier_register_core() of GIMP 3 */
+static gboolean
+fourier_register_layer(gint32 drawable_id, gint32 reference_id, gboolean apply,
+                       double *dx, double *dy, double *peak, GError **error)
+{
+  GeglBuffer *ref_buffer, *buffer;
+  GeglRectangle rect;
+  const Babl *format;
+  gint sel_x1, sel_y1, width, height, offset_x, offset_y, ref_x, ref_y;
+  gboolean success;
+
+  *dx = *dy = *peak = 0.0;
+  gimp_drawable_offsets(drawable_id, &offset_x, &offset_y);
+  gimp_drawable_offsets(reference_id, &ref_x, &ref_y);
+  if (!gimp_drawable_mask_intersect(drawable_id, &sel_x1, &sel_y1, &width, &height) ||
+      !gegl_rectangle_intersect(&rect,
+                                GEGL_RECTANGLE(sel_x1 + offset_x, sel_y1 + offset_y, width, height),
+                                GEGL_RECTANGLE(ref_x, ref_y,
+                                               gimp_drawable_width(reference_id),
+                                               gimp_drawable_height(reference_id))))
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                _("The selection does not overlap the reference drawable."));
+    return FALSE;
+  }
+
+  format = fourier_format(gimp_drawable_is_gray(drawable_id), FALSE);
+  ref_buffer = gimp_drawable_get_buffer(reference_id);
+  buffer = gimp_drawable_get_buffer(drawable_id);
+
+  success = fourier_register_buffers(ref_buffer, GEGL_RECTANGLE(rect.x - ref_x, rect.y - ref_y,
+                                                                rect.width, rect.height),
+                                     buffer, GEGL_RECTANGLE(rect.x - offset_x, rect.y - offset_y,
+                                                            rect.width, rect.height),
+                                     format, dx, dy, peak, error);
+  g_object_unref(ref_buffer);
+  g_object_unref(buffer);
+
+  if (success && apply && gimp_item_is_layer(drawable_id))
+    gimp_layer_set_offsets(drawable_id, offset_x - (gint)round(*dx), offset_y - (gint)round(*dy));
+
+  return success;
+}
+
+/* name is procedure proc, or its temporary procedure in the resident service */
+static gboolean
+fourier_proc_is(const gchar *name, const gchar *proc)
+{
+  gsize length = strlen(proc);
+
+  return strncmp(name, proc, length) == 0 &&
+         (name[length] == '\0' || strcmp(name + length, PLUG_IN_RESIDENT_SUFFIX) == 0);
+}
+
+static void
+fourier_service_install(const gchar *proc, const gchar *desc, const gchar *short_desc,
+                        const gchar *menu_label, gint nargs, const GimpParamDef *args)
+{
+  gchar *name = g_strconcat(proc, PLUG_IN_RESIDENT_SUFFIX, NULL);
+
+  gimp_install_temp_proc(name, desc, short_desc,
+                         PLUG_IN_AUTHOR, PLUG_IN_AUTHOR, PLUG_IN_VERSION,
+                         menu_label, "RGB*, GRAY*", GIMP_TEMPORARY,
+                         nargs, 0, args, NULL, run);
+  if (menu_label)
+    gimp_plugin_menu_register(name, PLUG_IN_RESIDENT_MENU_LOCATION);
+  g_free(name);
+}
+
+/*
+ * The resident service runs the transforms of its temporary procedures in
+ * its own process, where the batch scratches with their plans, the geometry
+ * tables, the wisdom and the FFT threads are kept from one run to the next.
+ */
+static void
+fourier_service_run(gint nparams, const GimpParam *param)
+{
+  gint idle_timeout = 300;
+
+  if (nparams > 1 && param[1].type == GIMP_PDB_INT32)
+    idle_timeout = param[1].data.d_int32;
+
+  gegl_init(NULL, NULL);
+  fourier_plugin_setup();
+  fourier_service_vals = fvals;
+  fourier_batch_keep = TRUE;
+
+  fourier_service_install(PLUG_IN_DIR_PROC, PLUG_IN_DIR_DESC, PLUG_IN_DIR_SHORT_DESC,
+                          PLUG_IN_DIR_MENU_LABEL, G_N_ELEMENTS(fourier_args), fourier_args);
+  fourier_service_install(PLUG_IN_INV_PROC, PLUG_IN_INV_DESC, PLUG_IN_INV_SHORT_DESC,
+                          PLUG_IN_INV_MENU_LABEL, G_N_ELEMENTS(fourier_args), fourier_args);
+  fourier_service_install(PLUG_IN_FILTER_PROC, PLUG_IN_FILTER_DESC, PLUG_IN_FILTER_SHORT_DESC,
+                          NULL, G_N_ELEMENTS(fourier_filter_args), fourier_filter_args);
+
+  gimp_extension_enable();
+  // Runs until GIMP quits
+  while (TRUE)
+    gimp_extension_process(fourier_service_wait(idle_timeout));
 }
 
 static void
@@ -860,8 +3796,8 @@ run(const gchar *name,
     gint *nreturn_vals,
     GimpParam **return_vals)
 {
-  /* Return values */
-  static GimpParam values[1];
+  /* Return values, the status and those of the registration */
+  static GimpParam values[4];
 
   gint sel_x1, sel_y1, sel_x2, sel_y2, sel_width, sel_height, padding;
   gint img_height, img_width, img_bpp, img_has_alpha;
@@ -874,19 +3810,64 @@ run(const gchar *name,
 
   GeglBuffer *buffer;
   GeglRectangle *roi;
-  guchar *img_pixels;
 
   int fft_inv = 0;
-
-  if (strcmp(name, PLUG_IN_INV_PROC) == 0)
+  int fft_tune = 0;
+  int fft_export = 0;
+  int fft_import = 0;
+  int fft_all_layers = 0;
+  int fft_filter = 0;
+  int fft_convolve = 0;
+  int fft_register = 0;
+  FourierFilter filter = { FILTER_NONE };
+  gint32 kernel_id = -1;
+  gboolean normalize = TRUE;
+  gint32 reference_id = -1;
+  gboolean apply = TRUE;
+  const gchar *filename = NULL;
+  GError *error = NULL;
+
+  if (strcmp(name, PLUG_IN_SERVICE_PROC) == 0)
+    fourier_service_run(nparams, param);
+  if (fourier_batch_keep)
+    fvals = fourier_service_vals;
+
+  if (fourier_proc_is(name, PLUG_IN_INV_PROC))
   {
     fft_inv = 1;
   }
+  if (fourier_proc_is(name, PLUG_IN_TUNE_PROC))
+  {
+    fft_tune = 1;
+    fvals.rigor = RIGOR_PATIENT;
+  }
+  if (fourier_proc_is(name, PLUG_IN_EXPORT_PROC))
+  {
+    fft_export = 1;
+  }
+  if (fourier_proc_is(name, PLUG_IN_IMPORT_PROC))
+  {
+    fft_import = 1;
+  }
+  if (fourier_proc_is(name, PLUG_IN_FILTER_PROC))
+  {
+    fft_filter = 1;
+  }
+  if (fourier_proc_is(name, PLUG_IN_CONVOLVE_PROC))
+  {
+    fft_convolve = 1;
+  }
+  if (fourier_proc_is(name, PLUG_IN_REGISTER_PROC))
+  {
+    fft_register = 1;
+  }
 
   *nreturn_vals = 1;
   *return_vals = values;
 
   status = GIMP_PDB_SUCCESS;
+  values[0].type = GIMP_PDB_STATUS;
+  values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
 
   if (param[0].type != GIMP_PDB_INT32)
     status = GIMP_PDB_CALLING_ERROR;
@@ -895,7 +3876,73 @@ run(const gchar *name,
 
   run_mode = (GimpRunMode)param[0].data.d_int32;
 
+  // Optional arguments, older callers may not pass them
+  if (nparams > 3 && param[3].type == GIMP_PDB_INT32)
+    fvals.threads = param[3].data.d_int32;
+  if (nparams > 4 && param[4].type == GIMP_PDB_INT32 && run_mode == GIMP_RUN_NONINTERACTIVE)
+    fvals.rigor = CLAMP(param[4].data.d_int32, RIGOR_ESTIMATE, RIGOR_EXHAUSTIVE);
+  if (nparams > 5 && param[5].type == GIMP_PDB_INT32)
+    fvals.memory_limit = MAX(param[5].data.d_int32, 0);
+  if (!fft_inv && !fft_export && !fft_import && !fft_register && nparams > 6 && param[6].type == GIMP_PDB_INT32)
+    fvals.padding = CLAMP(param[6].data.d_int32, PADDING_NONE, PADDING_MIRROR);
+  if (!fft_tune && !fft_export && !fft_import && !fft_register && nparams > 7 && param[7].type == GIMP_PDB_INT32)
+    fft_all_layers = param[7].data.d_int32;
+  if (!fft_inv && !fft_tune && !fft_export && !fft_import && !fft_filter && !fft_convolve && !fft_register &&
+      nparams > 8 && param[8].type == GIMP_PDB_INT32)
+    fvals.luma = param[8].data.d_int32;
+  // Menus pass 0 for every argument, which would turn records off
+  if (!fft_inv && !fft_tune && !fft_export && !fft_import && !fft_filter && !fft_convolve && !fft_register &&
+      nparams > 9 && param[9].type == GIMP_PDB_INT32 && run_mode == GIMP_RUN_NONINTERACTIVE)
+    fvals.record_limit = MAX(param[9].data.d_int32, 0);
+  if (fft_export || fft_import)
+  {
+    if (nparams > 6 && param[6].type == GIMP_PDB_STRING)
+      filename = param[6].data.d_string;
+    if (!filename)
+      status = GIMP_PDB_CALLING_ERROR;
+  }
+  if (fft_filter)
+  {
+    if (nparams < 15 || param[8].type != GIMP_PDB_INT32 || param[9].type != GIMP_PDB_INT32 ||
+        param[10].type != GIMP_PDB_FLOAT || param[11].type != GIMP_PDB_FLOAT ||
+        param[12].type != GIMP_PDB_INT32 || param[13].type != GIMP_PDB_STRING ||
+        param[14].type != GIMP_PDB_FLOAT)
+      status = GIMP_PDB_CALLING_ERROR;
+    else
+    {
+      filter.type = CLAMP(param[8].data.d_int32, FILTER_NONE, FILTER_BAND_PASS);
+      filter.shape = CLAMP(param[9].data.d_int32, FILTER_IDEAL, FILTER_GAUSSIAN);
+      filter.cutoff = MAX(param[10].data.d_float, 0.0);
+      filter.cutoff_high = MAX(param[11].data.d_float, 0.0);
+      filter.order = CLAMP(param[12].data.d_int32, 1, 10);
+      filter.notch_radius = MAX(param[14].data.d_float, 0.0);
+      if (!fourier_filter_set_notches(&filter, param[13].data.d_string))
+        status = GIMP_PDB_CALLING_ERROR;
+    }
+  }
+  if (fft_convolve)
+  {
+    // Edges at param 6 are read as the padding, which has the same values
+    if (nparams < 9 || param[8].type != GIMP_PDB_DRAWABLE || param[8].data.d_drawable == -1)
+      status = GIMP_PDB_CALLING_ERROR;
+    else
+      kernel_id = param[8].data.d_drawable;
+    if (nparams > 9 && param[9].type == GIMP_PDB_INT32)
+      normalize = param[9].data.d_int32;
+  }
+  if (fft_register)
+  {
+    if (nparams < 7 || param[6].type != GIMP_PDB_DRAWABLE || param[6].data.d_drawable == -1)
+      status = GIMP_PDB_CALLING_ERROR;
+    else
+      reference_id = param[6].data.d_drawable;
+    if (nparams > 7 && param[7].type == GIMP_PDB_INT32)
+      apply = param[7].data.d_int32;
+  }
+
   gegl_init (NULL, NULL);
+  fourier_plugin_setup();
+  FOURIER_TRACE_BEGIN("run");
 
   drawable_id = param[2].data.d_drawable;
 
@@ -904,10 +3951,7 @@ run(const gchar *name,
   // img_bpp = gimp_drawable_get_bpp(drawable_id);
   img_has_alpha = gimp_drawable_has_alpha(drawable_id);
 
-  if (gimp_drawable_has_alpha(drawable_id)) //  gimp_drawable_is_rgb (drawable)
-    format = babl_format("R'G'B'A u8");
-  else
-    format = babl_format("R'G'B' u8");
+  format = fourier_format(gimp_drawable_is_gray(drawable_id), img_has_alpha);
 
   img_bpp = babl_format_get_bytes_per_pixel(format);
 
@@ -925,55 +3969,155 @@ run(const gchar *name,
   //printf("Image size %dx%d - %d bpp\n", img_width, img_height, img_bpp);
   //printf("Selection size %dx%d (%d,%d-%d,%d)\n", sel_width, sel_height, sel_x1, sel_y1, sel_x2, sel_y2);
 
-  if (status == GIMP_PDB_SUCCESS)
+  if (status == GIMP_PDB_SUCCESS && fft_tune)
   {
-    gimp_progress_init(fft_inv ? _("Applying inverse Fourier transform...") : _("Applying forward Fourier transform..."));
+    gimp_progress_init(_("Measuring Fourier transform plans..."));
+    process_fft_tune(sel_width, sel_height, fourier_format_colors(format));
 
-    // Init buffers
-    GeglBuffer *src_buffer = gimp_drawable_get_buffer(drawable_id);
-    GeglBuffer *dest_buffer = gimp_drawable_get_shadow_buffer(drawable_id);
+    values[0].type = GIMP_PDB_STATUS;
+    values[0].data.d_status = status;
+  }
+  else if (status == GIMP_PDB_SUCCESS && fft_register)
+  {
+    double dx, dy, peak;
 
-    roi = GEGL_RECTANGLE(sel_x1, sel_y1, sel_width, sel_height);
-    img_pixels = g_malloc(roi->width * roi->height * img_bpp);
+    gimp_progress_init(_("Registering with the Fourier phase correlation..."));
+    if (fourier_register_layer(drawable_id, reference_id, apply, &dx, &dy, &peak, &error))
+    {
+      gimp_displays_flush();
+      *nreturn_vals = 4;
+      values[1].type = GIMP_PDB_FLOAT;
+      values[1].data.d_float = dx;
+      values[2].type = GIMP_PDB_FLOAT;
+      values[2].data.d_float = dy;
+      values[3].type = GIMP_PDB_FLOAT;
+      values[3].data.d_float = peak;
+    }
+    else
+    {
+      if (!fourier_cancelled())
+        g_message("%s", error->message);
+      g_error_free(error);
+      status = fourier_cancelled() ? GIMP_PDB_CANCEL : GIMP_PDB_EXECUTION_ERROR;
+    }
+
+    values[0].type = GIMP_PDB_STATUS;
+    values[0].data.d_status = status;
+  }
+  else if (status == GIMP_PDB_SUCCESS && (fft_export || fft_import))
+  {
+    gboolean success;
 
-    // Get source image
-    gegl_buffer_get(src_buffer, roi, 1.0, format, img_pixels, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+    roi = GEGL_RECTANGLE(sel_x1, sel_y1, sel_width, sel_height);
 
-    if (fft_inv == 0)
+    if (fft_export)
     {
-      process_fft_forward(img_pixels, img_pixels, sel_width, sel_height, img_bpp, img_bpp);
+      GeglBuffer *src_buffer = gimp_drawable_get_buffer(drawable_id);
+
+      gimp_progress_init(_("Exporting Fourier transform..."));
+      success = fourier_npy_export(src_buffer, roi, format, filename,
+                                   nparams > 7 && param[7].data.d_int32, &error);
+      g_object_unref(src_buffer);
     }
     else
     {
-      process_fft_inverse(img_pixels, img_pixels, sel_width, sel_height, img_bpp, img_bpp);
+      GeglBuffer *src_buffer = gimp_drawable_get_buffer(drawable_id);
+      GeglBuffer *dest_buffer = gimp_drawable_get_shadow_buffer(drawable_id);
+
+      gimp_progress_init(_("Applying inverse Fourier transform..."));
+      success = fourier_npy_import(dest_buffer, src_buffer, roi, format, filename, &error);
+      g_object_unref(src_buffer);
+      g_object_unref(dest_buffer);
+      if (success)
+      {
+        FOURIER_TRACE_BEGIN("merge_shadow");
+        gimp_drawable_merge_shadow(drawable_id, TRUE);
+        FOURIER_TRACE_END();
+        gimp_drawable_update(drawable_id, sel_x1, sel_y1, sel_width, sel_height);
+        gimp_displays_flush();
+      }
     }
 
-    // Set result to image
-    gegl_buffer_set(dest_buffer, GEGL_RECTANGLE(sel_x1, sel_y1, sel_x2, sel_y2), 0,
-                    format, img_pixels,
-                    GEGL_AUTO_ROWSTRIDE);
+    if (!success)
+    {
+      if (!fourier_cancelled())
+        g_message("%s", error->message);
+      g_error_free(error);
+      status = fourier_cancelled() ? GIMP_PDB_CANCEL : GIMP_PDB_EXECUTION_ERROR;
+    }
 
-    g_free(img_pixels);
-    g_object_unref(src_buffer);
-    g_object_unref(dest_buffer);
+    values[0].type = GIMP_PDB_STATUS;
+    values[0].data.d_status = status;
+  }
+  else if (status == GIMP_PDB_SUCCESS)
+  {
+    GArray *layers = g_array_new(FALSE, FALSE, sizeof(gint32));
+    gint32 image_id = gimp_item_get_image(drawable_id);
+    gboolean success;
 
-    gimp_drawable_merge_shadow(drawable_id, TRUE);
-    gimp_drawable_update(drawable_id, sel_x1, sel_y1, (sel_x2 - sel_x1), (sel_y2 - sel_y1));
+    if (fft_all_layers)
+    {
+      gint num_layers;
+      gint32 *image_layers = gimp_image_get_layers(image_id, &num_layers);
+
+      fourier_layers_collect(image_layers, num_layers, layers);
+      g_free(image_layers);
+    }
+    else
+      g_array_append_val(layers, drawable_id);
+
+    if (fft_convolve)
+      gimp_progress_init(_("Applying Fourier convolution..."));
+    else if (fft_filter)
+      gimp_progress_init(_("Applying Fourier filter..."));
+    else
+      gimp_progress_init(fft_inv ? _("Applying inverse Fourier transform...") : _("Applying forward Fourier transform..."));
+
+    // Transform the selection of each layer from source to shadow, as one undo step
+    if (layers->len > 1)
+      gimp_image_undo_group_start(image_id);
+    if (fft_convolve)
+      success = fourier_convolve_layers((const gint32 *) layers->data, layers->len, kernel_id, normalize,
+                                        fvals.padding == PADDING_MIRROR ? PADDING_MIRROR : PADDING_EDGE);
+    else
+      success = fourier_batch_process(layers->len, fft_inv, fft_filter ? &filter : NULL,
+                                      fourier_layer_prepare, fourier_layer_finish, layers->data, &error);
+    if (layers->len > 1)
+      gimp_image_undo_group_end(image_id);
+    g_array_free(layers, TRUE);
     gimp_displays_flush();
 
+    if (!success && error)
+    {
+      g_message("%s", error->message);
+      g_clear_error(&error);
+      status = GIMP_PDB_EXECUTION_ERROR;
+    }
+    else if (!success)
+      status = GIMP_PDB_CANCEL;
+
     // set FG to neutral grey; used to mask moire patterns, etc
-    if (fft_inv == 0)
+    if (fft_inv == 0 && fft_filter == 0 && fft_convolve == 0 && success)
     {
       GimpRGB neutral_grey;
       gimp_rgba_set_uchar(&neutral_grey, 128, 128, 128, 1);
       gimp_context_set_foreground(&neutral_grey);
     }
 
-    gimp_progress_init(fft_inv ? _("Inverse Fourier transform applied successfully.") : _("Forward Fourier transform applied successfully."));
+    if (success && fft_convolve)
+      gimp_progress_init(_("Fourier convolution applied successfully."));
+    else if (success && fft_filter)
+      gimp_progress_init(_("Fourier filter applied successfully."));
+    else if (success)
+      gimp_progress_init(fft_inv ? _("Inverse Fourier transform applied successfully.") : _("Forward Fourier transform applied successfully."));
 
     values[0].type = GIMP_PDB_STATUS;
     values[0].data.d_status = status;
   }
+
+  g_free((gpointer) filter.notch_xy);
+  FOURIER_TRACE_END();
+  fourier_trace_finish();
 }
 
 #else